@@ -681,31 +681,60 @@ class ArchiveFile(Base):
         if not input and is_last_coder:
             remaining = self._start+size
             out = BytesIO()
-            cache = getattr(self._folder, '_decompress_cache', None)
-            if cache is not None:
-                data, pos, decompressor = cache
-                out.write(data)
-                remaining -= len(data)
-                self._file.seek(pos)
-            else:
-                self._file.seek(self._src_start)
             checkremaining = is_last_coder and not self._folder.solid and can_partial_decompress
+            if checkremaining:
+                # the size is known, decompress in one call so the LZMA
+                # decoders can use the result as dictionary
+                self._file.seek(self._src_start)
+                data = decompressor.decompress(self._file.read(total), remaining)
+                if len(data) < remaining:
+                    raise DecompressionError('end of stream while decompressing')
+                return data[self._start:self._start+size]
+
+            if hasattr(decompressor, 'skip'):
+                # the data of previous files in a solid archive is decompressed
+                # without keeping it, the decompressor is cached to continue
+                # with the next file, only the data of the last file is kept
+                cache = getattr(self._folder, '_decompress_cache', None)
+                if cache is not None and cache[0] == self._start and len(cache[1]) == size:
+                    return cache[1]
+                elif cache is not None and cache[0] + len(cache[1]) <= self._start:
+                    start, data, pos, decompressor = cache
+                    offset = start + len(data)
+                    self._file.seek(pos)
+                else:
+                    offset = 0
+                    self._file.seek(self._src_start)
+                skip = self._start - offset
+                remaining = size
+                while skip > 0 or remaining > 0:
+                    data = self._file.read(READ_BLOCKSIZE) if decompressor.needs_input else b''
+                    if skip > 0:
+                        count = decompressor.skip(skip, data)
+                        skip -= count
+                    else:
+                        tmp = decompressor.decompress(data, remaining)
+                        count = len(tmp)
+                        out.write(tmp)
+                        remaining -= count
+                    if not count and not data:
+                        raise DecompressionError('end of stream while decompressing')
+
+                data = out.getvalue()
+                if with_cache:
+                    self._folder._decompress_cache = (self._start, data, self._file.tell(), decompressor)
+                return data
+
+            self._file.seek(self._src_start)
             while remaining > 0:
                 data = self._file.read(READ_BLOCKSIZE)
-                if checkremaining or (with_cache and len(data) < READ_BLOCKSIZE):
-                    tmp = decompressor.decompress(data, remaining)
-                else:
-                    tmp = decompressor.decompress(data)
+                tmp = decompressor.decompress(data)
                 if not tmp and not data:
                     raise DecompressionError('end of stream while decompressing')
                 out.write(tmp)
                 remaining -= len(tmp)
             
             data = out.getvalue()
-            if with_cache and self._folder.solid:
-                # don't decompress start of solid archive for next file
-                # TODO: limit size of cached data
-                self._folder._decompress_cache = (data, self._file.tell(), decompressor)
         else:
             if not input:
                 self._file.seek(self._src_start)
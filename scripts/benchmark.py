@@ -0,0 +1,418 @@
+#!/usr/bin/python -u
+#
+# Python Bindings for LZMA
+#
+# Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+# 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+# LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+# $Id$
+#
+"""Benchmarks for PyLZMA.
+
+Usage: benchmark.py <name> [arguments]
+
+Unless noted otherwise, the argument is the name of a file to use as input.
+If no filename is given, generated log-like data is used as input.
+"""
+import random
+import sys
+import time
+
+import pylzma
+
+BENCHMARKS = {}
+
+def benchmark(func):
+    BENCHMARKS[func.__name__] = func
+    return func
+
+def generate_logs(size, seed=0):
+    rnd = random.Random(seed)
+    methods = ['GET', 'POST', 'PUT', 'DELETE']
+    paths = ['/api/v1/items', '/api/v1/users', '/static/app.js', '/index.html', '/login']
+    lines = []
+    total = 0
+    while total < size:
+        line = '2024-01-%02d %02d:%02d:%02d host%d %s %s/%d %d %d\n' % (
+            rnd.randint(1, 28), rnd.randint(0, 23), rnd.randint(0, 59), rnd.randint(0, 59),
+            rnd.randint(0, 15), rnd.choice(methods), rnd.choice(paths), rnd.randint(0, 100000),
+            rnd.choice([200, 200, 200, 304, 404, 500]), rnd.randint(100, 50000))
+        lines.append(line)
+        total += len(line)
+    return ''.join(lines).encode('ascii')[:size]
+
+def load_data(args, size=4*1024*1024):
+    if args:
+        fp = open(args[0], 'rb')
+        try:
+            return fp.read()
+        finally:
+            fp.close()
+    return generate_logs(size)
+
+def timed(func, *args, **kwargs):
+    start = time.time()
+    result = func(*args, **kwargs)
+    return time.time() - start, result
+
+def mb_per_second(size, duration):
+    return (size / (1024.0 * 1024.0)) / max(duration, 1e-9)
+
+@benchmark
+def matchfinder(args):
+    """Speed and ratio of the different match finders and cycles."""
+    data = load_data(args)
+    print('%d bytes of input' % (len(data)))
+    print('%-6s %6s %6s %10s %8s' % ('mf', 'mc', 'algo', 'MB/s', 'ratio'))
+    for mf, algorithms in (('hc4', (0,)), ('hc5', (0,)), ('bt2', (0, 2)),
+                           ('bt3', (0, 2)), ('bt4', (0, 2)), ('bt5', (2,))):
+        for algorithm in algorithms:
+            for mc in (4, 16, 0):
+                duration, compressed = timed(pylzma.compress, data, matchfinder=mf,
+                    mc=mc, algorithm=algorithm, dictionary=23, fastBytes=32)
+                print('%-6s %6s %6d %10.2f %7.2f%%' % (mf, mc or 'auto', algorithm,
+                    mb_per_second(len(data), duration), 100.0 * len(compressed) / len(data)))
+
+    print('')
+    print('%-6s %10s %8s' % ('level', 'MB/s', 'ratio'))
+    for level in range(10):
+        duration, compressed = timed(pylzma.compress, data, level=level)
+        print('%-6d %10.2f %7.2f%%' % (level, mb_per_second(len(data), duration),
+            100.0 * len(compressed) / len(data)))
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+@benchmark
+def small(args):
+    """Latency of compressing small messages (argument: number of runs)."""
+    count = int(args[0]) if args else 2000
+    print('%8s %-12s %10s %10s %10s' % ('size', 'method', 'median', 'p99', 'ratio'))
+    for size in (100, 1024, 4096, 16384, 65536):
+        data = generate_logs(size, seed=size)
+        compressor = pylzma.Compressor()
+        for name, func in (('compress', pylzma.compress), ('Compressor', compressor.compress)):
+            timings = []
+            for _ in range(max(10, count * 1024 // max(size, 1024))):
+                duration, compressed = timed(func, data)
+                timings.append(duration)
+            print('%8d %-12s %8.1fus %8.1fus %9.2f%%' % (size, name,
+                percentile(timings, 50) * 1e6, percentile(timings, 99) * 1e6,
+                100.0 * len(compressed) / len(data)))
+
+@benchmark
+def many(args):
+    """Compress and decompress many small messages (argument: number of messages)."""
+    count = int(args[0]) if args else 5000
+    items = [generate_logs(256 + (i * 37) % 4096, seed=i) for i in range(count)]
+    size = sum(len(x) for x in items)
+    duration, compressed = timed(lambda: [pylzma.compress(x) for x in items])
+    print('%-16s %10.2f MB/s' % ('compress', mb_per_second(size, duration)))
+    duration, compressed = timed(pylzma.compress_many, items)
+    print('%-16s %10.2f MB/s' % ('compress_many', mb_per_second(size, duration)))
+    duration, _ = timed(lambda: [pylzma.decompress(x) for x in compressed])
+    print('%-16s %10.2f MB/s' % ('decompress', mb_per_second(size, duration)))
+    duration, _ = timed(pylzma.decompress_many, compressed)
+    print('%-16s %10.2f MB/s' % ('decompress_many', mb_per_second(size, duration)))
+
+@benchmark
+def compressfile(args):
+    """Compress from file-like objects and regular files."""
+    import io
+    import os
+    import tempfile
+    data = load_data(args, size=16*1024*1024)
+
+    class ReadOnly(object):
+        # file-like object that doesn't support "readinto"
+        def __init__(self, data):
+            self.fp = io.BytesIO(data)
+        def read(self, length):
+            return self.fp.read(length)
+
+    fd, path = tempfile.mkstemp()
+    try:
+        os.write(fd, data)
+        os.close(fd)
+        for name, create in (('read', lambda: ReadOnly(data)),
+                             ('readinto', lambda: io.BytesIO(data)),
+                             ('os file', lambda: open(path, 'rb'))):
+            fp = create()
+            duration, _ = timed(lambda: pylzma.compressfile(fp, level=1).read())
+            print('%-16s %10.2f MB/s' % (name, mb_per_second(len(data), duration)))
+            if hasattr(fp, 'close'):
+                fp.close()
+    finally:
+        os.unlink(path)
+
+    def read_all(compressor, size):
+        while compressor.read(size):
+            pass
+    for size in (4096, 1 << 16):
+        duration, _ = timed(read_all, pylzma.compressfile(io.BytesIO(data), level=1), size)
+        print('%-16s %10.2f MB/s' % ('read(%d)' % (size), mb_per_second(len(data), duration)))
+    duration, _ = timed(lambda: pylzma.compressfile(io.BytesIO(data), level=1, outfile=io.BytesIO()).read())
+    print('%-16s %10.2f MB/s' % ('outfile', mb_per_second(len(data), duration)))
+
+@benchmark
+def files(args):
+    """Compress and decompress files path to path compared to a loop in Python."""
+    import io
+    import os
+    import shutil
+    import tempfile
+    data = load_data(args, size=64*1024*1024)
+    path = tempfile.mkdtemp()
+    try:
+        src = os.path.join(path, 'src')
+        compressed = os.path.join(path, 'compressed')
+        dst = os.path.join(path, 'dst')
+        with open(src, 'wb') as fp:
+            fp.write(data)
+
+        def compress_loop():
+            with open(src, 'rb') as infile, open(compressed, 'wb') as outfile:
+                compressor = pylzma.compressfile(infile, level=1)
+                while True:
+                    chunk = compressor.read(io.DEFAULT_BUFFER_SIZE)
+                    if not chunk:
+                        break
+                    outfile.write(chunk)
+
+        def decompress_loop():
+            with open(compressed, 'rb') as infile, open(dst, 'wb') as outfile:
+                decompressor = pylzma.decompressobj()
+                while True:
+                    chunk = infile.read(io.DEFAULT_BUFFER_SIZE)
+                    if not chunk:
+                        break
+                    outfile.write(decompressor.decompress(chunk))
+                outfile.write(decompressor.flush())
+
+        print('%-16s %10s %10s %10s %10s %10s' % ('', 'MB/s', 'reader', 'codec in', 'codec out', 'writer'))
+        duration, _ = timed(compress_loop)
+        print('%-16s %10.2f' % ('compressfile', mb_per_second(len(data), duration)))
+        stats = pylzma.compress_file(src, compressed, level=1)
+        print('%-16s %10.2f %9.2fs %9.2fs %9.2fs %9.2fs' % ('compress_file', mb_per_second(len(data), stats['time']),
+            stats['reader_stall'], stats['codec_input_stall'], stats['codec_output_stall'], stats['writer_stall']))
+        duration, _ = timed(decompress_loop)
+        print('%-16s %10.2f' % ('decompressobj', mb_per_second(len(data), duration)))
+        stats = pylzma.decompress_file(compressed, dst)
+        print('%-16s %10.2f %9.2fs %9.2fs %9.2fs %9.2fs' % ('decompress_file', mb_per_second(len(data), stats['time']),
+            stats['reader_stall'], stats['codec_input_stall'], stats['codec_output_stall'], stats['writer_stall']))
+    finally:
+        shutil.rmtree(path)
+
+@benchmark
+def feed(args):
+    """Overhead of feeding decompressobj in pieces (argument: size in MB)."""
+    import struct
+    size = int(args[0]) * 1024 * 1024 if args else 1024 * 1024 * 1024
+    # LZMA2 stream of uncompressed chunks, decoding is a copy so the time is
+    # spent handling the input
+    payload = generate_logs(65536)
+    chunks = b''.join([struct.pack('>BH', 2, len(payload) - 1) + payload] * 256)
+    header = pylzma.compress(b'', lzma2=1)[:1] + struct.pack('>BH', 1, len(payload) - 1) + payload
+    repeat = max(1, size // (256 * len(payload)))
+    size = len(payload) * (256 * repeat + 1)
+
+    def feed_pieces(piece, bufsize):
+        obj = pylzma.decompressobj(lzma2=1)
+        total = len(obj.decompress(header, len(payload)))
+        view = memoryview(chunks)
+        for _ in range(repeat):
+            for pos in range(0, len(chunks), piece):
+                data = obj.decompress(view[pos:pos + piece], bufsize)
+                while data:
+                    total += len(data)
+                    data = obj.decompress(b'', bufsize)
+        return total
+
+    def feed_into(piece, bufsize):
+        obj = pylzma.decompressobj(lzma2=1)
+        total = len(obj.decompress(header, len(payload)))
+        output = bytearray(bufsize)
+        view = memoryview(chunks)
+        for _ in range(repeat):
+            for pos in range(0, len(chunks), piece):
+                end = min(pos + piece, len(chunks))
+                while pos < end:
+                    written, consumed = obj.decompress_into(view[pos:end], output)
+                    total += written
+                    pos += consumed
+        return total
+
+    def decode_blocks():
+        obj = pylzma.decompressobj(lzma2=1)
+        total = len(obj.decompress(header, len(payload)))
+        for _ in range(repeat):
+            total += len(obj.decompress(chunks, len(chunks)))
+        return total
+
+    duration, total = timed(decode_blocks)
+    assert total == size, (total, size)
+    baseline = duration
+    print('%d bytes of input' % (size))
+    print('%-8s %-8s %10s %10s %10s' % ('piece', 'bufsize', 'MB/s', 'ns/byte', 'overhead'))
+    print('%-17s %10.2f %10.3f' % ('16MB blocks', mb_per_second(size, duration), duration * 1e9 / size))
+    for piece, bufsize in ((4096, 1 << 17), (4096, 3996), (4096, 1000), (1 << 24, 1 << 14)):
+        duration, total = timed(feed_pieces, piece, bufsize)
+        assert total == size, (total, size)
+        print('%-8d %-8d %10.2f %10.3f %10.3f' % (piece, bufsize, mb_per_second(size, duration),
+            duration * 1e9 / size, (duration - baseline) * 1e9 / size))
+    duration, total = timed(feed_into, 4096, 1 << 17)
+    assert total == size, (total, size)
+    print('%-17s %10.2f %10.3f %10.3f' % ('decompress_into', mb_per_second(size, duration),
+        duration * 1e9 / size, (duration - baseline) * 1e9 / size))
+
+@benchmark
+def unknown(args):
+    """Decompress without passing the size of the output (argument: size in MB)."""
+    import struct
+    size = int(args[0]) * 1024 * 1024 if args else 1024 * 1024 * 1024
+    # LZMA2 stream of uncompressed chunks, decoding is a copy so the time is
+    # spent handling the output
+    payload = generate_logs(65536)
+    count = max(1, size // len(payload))
+    size = count * len(payload)
+    chunk = struct.pack('>BH', 2, len(payload) - 1) + payload
+    stored = b''.join([pylzma.compress(b'', lzma2=1)[:1], struct.pack('>BH', 1, len(payload) - 1), payload,
+        chunk * (count - 1), b'\0'])
+    # LZMA stream of highly compressible data, the size ratio is large
+    compressed = pylzma.compress(payload * count, algorithm=0)
+    print('%d bytes of output' % (size))
+    print('%-24s %10s' % ('method', 'MB/s'))
+    for name, data, kwargs in (
+            ('stored, maxlength', stored, {'maxlength': size, 'lzma2': 1}),
+            ('stored', stored, {'lzma2': 1}),
+            ('compressed, maxlength', compressed, {'maxlength': size}),
+            ('compressed', compressed, {})):
+        duration, result = timed(pylzma.decompress, data, **kwargs)
+        assert len(result) == size, (len(result), size)
+        del result
+        print('%-24s %10.2f' % (name, mb_per_second(size, duration)))
+
+@benchmark
+def lines(args):
+    """Iterate over the lines of a compressed file compared to a loop in Python."""
+    import io
+    data = load_data(args, size=64*1024*1024)
+    compressed = pylzma.compress(data, level=1)
+    count = data.count(b'\n') + (not data.endswith(b'\n'))
+
+    def decompressobj_lines():
+        infile = io.BytesIO(compressed)
+        decompressor = pylzma.decompressobj()
+        total = 0
+        pending = b''
+        while True:
+            chunk = infile.read(io.DEFAULT_BUFFER_SIZE)
+            if not chunk:
+                break
+            lines = (pending + decompressor.decompress(chunk)).split(b'\n')
+            pending = lines.pop()
+            total += len(lines)
+        pending += decompressor.flush()
+        total += len(pending.split(b'\n')) if pending else 0
+        return total
+
+    def lzmafile_lines():
+        total = 0
+        for line in pylzma.LZMAFile(io.BytesIO(compressed)):
+            total += 1
+        return total
+
+    print('%d bytes in %d lines' % (len(data), count))
+    print('%-24s %10s' % ('method', 'MB/s'))
+    for name, func in (('decompressobj + split', decompressobj_lines),
+                       ('LZMAFile', lzmafile_lines)):
+        duration, total = timed(func)
+        assert total == count, (total, count)
+        print('%-24s %10.2f' % (name, mb_per_second(len(data), duration)))
+
+@benchmark
+def xz(args):
+    """Compress files to .xz with compress_file and threads compared to the xz tool."""
+    import os
+    import shutil
+    import subprocess
+    import tempfile
+    data = load_data(args, size=64*1024*1024)
+    path = tempfile.mkdtemp()
+    try:
+        src = os.path.join(path, 'src')
+        dst = os.path.join(path, 'dst.xz')
+        with open(src, 'wb') as fp:
+            fp.write(data)
+
+        print('%-16s %10s %8s' % ('threads', 'MB/s', 'ratio'))
+        for threads in (1, 2, 4):
+            stats = pylzma.compress_file(src, dst, format='xz', preset=6, threads=threads)
+            print('%-16d %10.2f %7.2f%%' % (threads, mb_per_second(len(data), stats['time']),
+                100.0 * stats['bytes_written'] / len(data)))
+            if shutil.which('xz'):
+                with open(src, 'rb') as infile, open(dst, 'wb') as outfile:
+                    duration, _ = timed(subprocess.check_call, ['xz', '-6', '-T%d' % (threads), '-c'],
+                        stdin=infile, stdout=outfile)
+                print('%-16s %10.2f %7.2f%%' % ('  xz -T%d' % (threads), mb_per_second(len(data), duration),
+                    100.0 * os.path.getsize(dst) / len(data)))
+    finally:
+        shutil.rmtree(path)
+
+@benchmark
+def unxz(args):
+    """Decompress .xz files with blocks using decompress_file and threads compared to the xz tool."""
+    import os
+    import shutil
+    import subprocess
+    import tempfile
+    data = load_data(args, size=64*1024*1024)
+    path = tempfile.mkdtemp()
+    try:
+        src = os.path.join(path, 'src.xz')
+        dst = os.path.join(path, 'dst')
+        with open(src, 'wb') as fp:
+            fp.write(pylzma.compress(data, format='xz', preset=1, threads=4, block_size=4*1024*1024))
+
+        print('%-16s %10s %8s' % ('threads', 'MB/s', 'blocks'))
+        for threads in (1, 2, 4):
+            stats = pylzma.decompress_file(src, dst, format='xz', threads=threads)
+            print('%-16d %10.2f %8d%s' % (threads, mb_per_second(len(data), stats['time']), stats['blocks'],
+                '' if stats['multithreaded'] else ' (single-threaded)'))
+            if shutil.which('xz'):
+                with open(src, 'rb') as infile, open(dst, 'wb') as outfile:
+                    duration, _ = timed(subprocess.check_call, ['xz', '-d', '-T%d' % (threads), '-c'],
+                        stdin=infile, stdout=outfile)
+                print('%-16s %10.2f' % ('  xz -T%d' % (threads), mb_per_second(len(data), duration)))
+    finally:
+        shutil.rmtree(path)
+
+def main(argv):
+    if len(argv) < 2 or argv[1] not in BENCHMARKS:
+        print(__doc__)
+        print('Available benchmarks:')
+        for name in sorted(BENCHMARKS):
+            print('  %-16s %s' % (name, BENCHMARKS[name].__doc__))
+        return 1
+
+    BENCHMARKS[argv[1]](argv[2:])
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -141,8 +141,14 @@ c_files = [
     'src/pylzma/pylzma_aes.c',
     'src/pylzma/pylzma_compress.c',
     'src/pylzma/pylzma_compressfile.c',
+    'src/pylzma/pylzma_compressobj.c',
+    'src/pylzma/pylzma_compressor.c',
     'src/pylzma/pylzma_decompress.c',
     'src/pylzma/pylzma_decompressobj.c',
+    'src/pylzma/pylzma_estimate.c',
+    'src/pylzma/pylzma_file.c',
+    'src/pylzma/pylzma_lzmafile.c',
+    'src/pylzma/pylzma_pool.c',
     'src/pylzma/pylzma_streams.c',
 ]
 compile_args = []
@@ -151,9 +157,12 @@ macros = [
     ('PY_SSIZE_T_CLEAN', 1),
 ]
 lzma_files = (
+    'src/sdk/C/7zCrc.c',
+    'src/sdk/C/7zCrcOpt.c',
     'src/sdk/C/7zStream.c',
     'src/sdk/C/Aes.c',
     'src/sdk/C/AesOpt.c',
+    'src/sdk/C/Alloc.c',
     'src/sdk/C/Bcj2.c',
     'src/sdk/C/Bra.c',
     'src/sdk/C/Bra86.c',
@@ -165,12 +174,19 @@ lzma_files = (
     'src/sdk/C/LzmaDec.c',
     'src/sdk/C/LzmaEnc.c',
     'src/sdk/C/Lzma2Dec.c',
+    'src/sdk/C/Lzma2DecMt.c',
     'src/sdk/C/Lzma2Enc.c',
     'src/sdk/C/Sha256.c',
     'src/sdk/C/Sha256Opt.c',
     'src/sdk/C/SwapBytes.c',
     'src/sdk/C/Ppmd7.c',
     'src/sdk/C/Ppmd7Dec.c',
+    'src/sdk/C/Xz.c',
+    'src/sdk/C/XzCrc64.c',
+    'src/sdk/C/XzCrc64Opt.c',
+    'src/sdk/C/XzDec.c',
+    'src/sdk/C/XzEnc.c',
+    'src/sdk/C/XzIn.c',
 )
 if ENABLE_COMPATIBILITY:
     c_files += (
@@ -26,21 +26,25 @@
 #include <Python.h>
 
 #include "../sdk/C/7zVersion.h"
+#include "../sdk/C/7zCrc.h"
 #include "../sdk/C/Sha256.h"
 #include "../sdk/C/Aes.h"
 #include "../sdk/C/Bra.h"
 #include "../sdk/C/Bcj2.h"
 #include "../sdk/C/Delta.h"
 #include "../sdk/C/Ppmd7.h"
+#include "../sdk/C/XzCrc64.h"
 
 #include "pylzma.h"
 #include "pylzma_compress.h"
+#include "pylzma_compressor.h"
 #include "pylzma_decompress.h"
+#include "pylzma_estimate.h"
+#include "pylzma_file.h"
 #include "pylzma_decompressobj.h"
-#if 0
 #include "pylzma_compressobj.h"
-#endif
 #include "pylzma_compressfile.h"
+#include "pylzma_lzmafile.h"
 #include "pylzma_aes.h"
 #ifdef WITH_COMPAT
 #include "pylzma_decompress_compat.h"
@@ -135,20 +139,23 @@ doc_bcj_x86_convert[] = \
 static PyObject *
 pylzma_bcj_x86_convert(PyObject *self, PyObject *args)
 {
-    char *data;
+    Py_buffer data;
     Py_ssize_t length;
     int encoding=0;
     PyObject *result;
 
-    if (!PyArg_ParseTuple(args, "s#|i", &data, &length, &encoding)) {
+    if (!PyArg_ParseTuple(args, "s*|i", &data, &encoding)) {
         return NULL;
     }
 
+    length = data.len;
     if (!length) {
+        PyBuffer_Release(&data);
         return PyBytes_FromString("");
     }
 
-    result = PyBytes_FromStringAndSize(data, length);
+    result = PyBytes_FromStringAndSize(data.buf, length);
+    PyBuffer_Release(&data);
     if (result != NULL) {
         UInt32 state = Z7_BRANCH_CONV_ST_X86_STATE_INIT_VAL;
         Py_BEGIN_ALLOW_THREADS
@@ -171,20 +178,23 @@ doc_bcj_##id##_convert[] = \
 static PyObject * \
 pylzma_bcj_##id##_convert(PyObject *self, PyObject *args) \
 { \
-    char *data; \
+    Py_buffer data; \
     Py_ssize_t length; \
     int encoding=0; \
     PyObject *result; \
      \
-    if (!PyArg_ParseTuple(args, "s#|i", &data, &length, &encoding)) { \
+    if (!PyArg_ParseTuple(args, "s*|i", &data, &encoding)) { \
         return NULL; \
     } \
      \
+    length = data.len; \
     if (!length) { \
+        PyBuffer_Release(&data); \
         return PyBytes_FromString(""); \
     } \
      \
-    result = PyBytes_FromStringAndSize(data, length); \
+    result = PyBytes_FromStringAndSize(data.buf, length); \
+    PyBuffer_Release(&data); \
     if (result != NULL) { \
         Py_BEGIN_ALLOW_THREADS \
         if (encoding) { \
@@ -217,41 +227,40 @@ doc_bcj2_decode[] =
 static PyObject *
 pylzma_bcj2_decode(PyObject *self, PyObject *args)
 {
-    char *main_data, *call_data, *jump_data, *rc_data;
-    Py_ssize_t main_length, call_length, jump_length, rc_length;
+    Py_buffer main_data, call_data, jump_data, rc_data;
     Py_ssize_t dest_len = -1;
     CBcj2Dec dec;
     SRes res;
-    PyObject *result;
+    PyObject *result = NULL;
     int i;
 
-    if (!PyArg_ParseTuple(args, "s#s#s#s#|n", &main_data, &main_length,
-        &call_data, &call_length, &jump_data, &jump_length,
-        &rc_data, &rc_length, &dest_len)) {
+    if (!PyArg_ParseTuple(args, "s*s*s*s*|n", &main_data, &call_data,
+        &jump_data, &rc_data, &dest_len)) {
         return NULL;
     }
     if (dest_len == -1) {
-        dest_len = main_length;
+        dest_len = main_data.len;
     }
 
     if (!dest_len) {
-        return PyBytes_FromString("");
+        result = PyBytes_FromString("");
+        goto exit;
     }
 
     result = PyBytes_FromStringAndSize(NULL, dest_len);
     if (!result) {
-        return NULL;
+        goto exit;
     }
 
     memset(&dec, 0, sizeof(dec));
-    dec.bufs[BCJ2_STREAM_MAIN] = (const Byte *) main_data;
-    dec.lims[BCJ2_STREAM_MAIN] = (const Byte *) (main_data + main_length);
-    dec.bufs[BCJ2_STREAM_CALL] = (const Byte *) call_data;
-    dec.lims[BCJ2_STREAM_CALL] = (const Byte *) (call_data + call_length);
-    dec.bufs[BCJ2_STREAM_JUMP] = (const Byte *) jump_data;
-    dec.lims[BCJ2_STREAM_JUMP] = (const Byte *) (jump_data + jump_length);
-    dec.bufs[BCJ2_STREAM_RC] = (const Byte *) rc_data;
-    dec.lims[BCJ2_STREAM_RC] = (const Byte *) (rc_data + rc_length);
+    dec.bufs[BCJ2_STREAM_MAIN] = (const Byte *) main_data.buf;
+    dec.lims[BCJ2_STREAM_MAIN] = (const Byte *) main_data.buf + main_data.len;
+    dec.bufs[BCJ2_STREAM_CALL] = (const Byte *) call_data.buf;
+    dec.lims[BCJ2_STREAM_CALL] = (const Byte *) call_data.buf + call_data.len;
+    dec.bufs[BCJ2_STREAM_JUMP] = (const Byte *) jump_data.buf;
+    dec.lims[BCJ2_STREAM_JUMP] = (const Byte *) jump_data.buf + jump_data.len;
+    dec.bufs[BCJ2_STREAM_RC] = (const Byte *) rc_data.buf;
+    dec.lims[BCJ2_STREAM_RC] = (const Byte *) rc_data.buf + rc_data.len;
 
     dec.dest = (Byte *) PyBytes_AS_STRING(result);
     dec.destLim = dec.dest + dest_len;
@@ -277,12 +286,17 @@ pylzma_bcj2_decode(PyObject *self, PyObject *args)
     } else if (dec.dest != dec.destLim || dec.state != BCJ2_STREAM_MAIN) {
         goto error;
     }
-    return result;
+    goto exit;
 
 error:
-    Py_DECREF(result);
+    DEC_AND_NULL(result);
     PyErr_SetString(PyExc_TypeError, "bcj2 decoding failed");
-    return NULL;
+exit:
+    PyBuffer_Release(&main_data);
+    PyBuffer_Release(&call_data);
+    PyBuffer_Release(&jump_data);
+    PyBuffer_Release(&rc_data);
+    return result;
 }
 
 const char
@@ -292,27 +306,31 @@ doc_delta_decode[] =
 static PyObject *
 pylzma_delta_decode(PyObject *self, PyObject *args)
 {
-    char *data;
+    Py_buffer data;
     Py_ssize_t length;
     unsigned int delta;
     Byte state[DELTA_STATE_SIZE];
     Byte *tmp;
     PyObject *result;
 
-    if (!PyArg_ParseTuple(args, "s#I", &data, &length, &delta)) {
+    if (!PyArg_ParseTuple(args, "s*I", &data, &delta)) {
         return NULL;
     }
 
+    length = data.len;
     if (!delta) {
+        PyBuffer_Release(&data);
         PyErr_SetString(PyExc_TypeError, "delta must be non-zero");
         return NULL;
     }
 
     if (!length) {
+        PyBuffer_Release(&data);
         return PyBytes_FromString("");
     }
 
-    result = PyBytes_FromStringAndSize(data, length);
+    result = PyBytes_FromStringAndSize(data.buf, length);
+    PyBuffer_Release(&data);
     if (!result) {
         return NULL;
     }
@@ -332,27 +350,31 @@ doc_delta_encode[] =
 static PyObject *
 pylzma_delta_encode(PyObject *self, PyObject *args)
 {
-    char *data;
+    Py_buffer data;
     Py_ssize_t length;
     unsigned int delta;
     Byte state[DELTA_STATE_SIZE];
     Byte *tmp;
     PyObject *result;
 
-    if (!PyArg_ParseTuple(args, "s#I", &data, &length, &delta)) {
+    if (!PyArg_ParseTuple(args, "s*I", &data, &delta)) {
         return NULL;
     }
 
+    length = data.len;
     if (!delta) {
+        PyBuffer_Release(&data);
         PyErr_SetString(PyExc_TypeError, "delta must be non-zero");
         return NULL;
     }
 
     if (!length) {
+        PyBuffer_Release(&data);
         return PyBytes_FromString("");
     }
 
-    result = PyBytes_FromStringAndSize(data, length);
+    result = PyBytes_FromStringAndSize(data.buf, length);
+    PyBuffer_Release(&data);
     if (!result) {
         return NULL;
     }
@@ -407,12 +429,11 @@ ReadByte(const IByteIn *pp) {
 static PyObject *
 pylzma_ppmd_decompress(PyObject *self, PyObject *args)
 {
-    char *data;
-    Py_ssize_t length;
-    char *props;
-    Py_ssize_t propssize;
+    Py_buffer data;
+    Py_buffer props_buffer;
+    const Byte *props;
     unsigned int outsize;
-    PyObject *result;
+    PyObject *result = NULL;
     Byte *tmp;
     unsigned order;
     UInt32 memSize;
@@ -421,15 +442,16 @@ pylzma_ppmd_decompress(PyObject *self, PyObject *args)
     SRes res = SZ_OK;
     CMemoryLookInStream stream;
 
-    if (!PyArg_ParseTuple(args, "s#s#I", &data, &length, &props, &propssize, &outsize)) {
+    if (!PyArg_ParseTuple(args, "s*s*I", &data, &props_buffer, &outsize)) {
         return NULL;
     }
 
-    if (propssize != 5) {
-        PyErr_Format(PyExc_TypeError, "properties must be exactly 5 bytes, got %ld", propssize);
-        return NULL;
+    if (props_buffer.len != 5) {
+        PyErr_Format(PyExc_TypeError, "properties must be exactly 5 bytes, got %zd", props_buffer.len);
+        goto exit;
     }
 
+    props = (const Byte *) props_buffer.buf;
     order = props[0];
     memSize = GetUi32(props + 1);
     if (order < PPMD7_MIN_ORDER ||
@@ -437,25 +459,28 @@ pylzma_ppmd_decompress(PyObject *self, PyObject *args)
         memSize < PPMD7_MIN_MEM_SIZE ||
         memSize > PPMD7_MAX_MEM_SIZE) {
         PyErr_SetString(PyExc_TypeError, "unsupporter compression properties");
-        return NULL;
+        goto exit;
     }
 
     if (!outsize) {
-        return PyBytes_FromString("");
+        result = PyBytes_FromString("");
+        goto exit;
     }
 
     Ppmd7_Construct(&ppmd);
     if (!Ppmd7_Alloc(&ppmd, memSize, &allocator)) {
-        return PyErr_NoMemory();
+        PyErr_NoMemory();
+        goto exit;
     }
     Ppmd7_Init(&ppmd, order);
 
     result = PyBytes_FromStringAndSize(NULL, outsize);
     if (!result) {
-        return NULL;
+        Ppmd7_Free(&ppmd, &allocator);
+        goto exit;
     }
 
-    CreateMemoryLookInStream(&stream, (Byte*) data, length);
+    CreateMemoryLookInStream(&stream, (Byte*) data.buf, data.len);
     tmp = (Byte *) PyBytes_AS_STRING(result);
     Py_BEGIN_ALLOW_THREADS
     s.vt.Read = ReadByte;
@@ -480,7 +505,7 @@ pylzma_ppmd_decompress(PyObject *self, PyObject *args)
         }
         if (i != outsize) {
             res = (s.res != SZ_OK ? s.res : SZ_ERROR_DATA);
-        } else if (s.processed + (s.cur - s.begin) != (UInt64)length || !Ppmd7z_RangeDec_IsFinishedOK(&ppmd.rc.dec)) {
+        } else if (s.processed + (s.cur - s.begin) != (UInt64)data.len || !Ppmd7z_RangeDec_IsFinishedOK(&ppmd.rc.dec)) {
             res = SZ_ERROR_DATA;
         }
     }
@@ -491,6 +516,10 @@ pylzma_ppmd_decompress(PyObject *self, PyObject *args)
         PyErr_SetString(PyExc_TypeError, "error during decompression");
         result = NULL;
     }
+
+exit:
+    PyBuffer_Release(&data);
+    PyBuffer_Release(&props_buffer);
     return result;
 }
 
@@ -498,7 +527,15 @@ PyMethodDef
 methods[] = {
     // exported functions
     {"compress",      (PyCFunction)pylzma_compress,      METH_VARARGS | METH_KEYWORDS, (char *)&doc_compress},
+    {"compress_into", (PyCFunction)pylzma_compress_into, METH_VARARGS | METH_KEYWORDS, (char *)&doc_compress_into},
+    {"compress_bound", (PyCFunction)pylzma_compress_bound, METH_VARARGS,                (char *)&doc_compress_bound},
+    {"compress_many", (PyCFunction)pylzma_compress_many, METH_VARARGS | METH_KEYWORDS, (char *)&doc_compress_many},
     {"decompress",    (PyCFunction)pylzma_decompress,    METH_VARARGS | METH_KEYWORDS, (char *)&doc_decompress},
+    {"decompress_many", (PyCFunction)pylzma_decompress_many, METH_VARARGS | METH_KEYWORDS, (char *)&doc_decompress_many},
+    {"verify",        (PyCFunction)pylzma_verify,        METH_VARARGS | METH_KEYWORDS, (char *)&doc_verify},
+    {"compress_file", (PyCFunction)pylzma_compress_file, METH_VARARGS | METH_KEYWORDS, (char *)&doc_compress_file},
+    {"decompress_file", (PyCFunction)pylzma_decompress_file, METH_VARARGS | METH_KEYWORDS, (char *)&doc_decompress_file},
+    {"estimate_ratio", (PyCFunction)pylzma_py_estimate_ratio, METH_VARARGS | METH_KEYWORDS, (char *)&doc_estimate_ratio},
 #ifdef WITH_COMPAT
     // compatibility functions
     {"decompress_compat",    (PyCFunction)pylzma_decompress_compat,    METH_VARARGS | METH_KEYWORDS, (char *)&doc_decompress_compat},
@@ -527,6 +564,27 @@ static void *Alloc(ISzAllocPtr p, size_t size) { (void)p; return malloc(size); }
 static void Free(ISzAllocPtr p, void *address) { (void)p; free(address); }
 ISzAlloc allocator = { Alloc, Free };
 
+int
+pylzma_parse_format(const char *name, int lzma2)
+{
+    if (name == NULL) {
+        return FORMAT_DEFAULT;
+    }
+    if (strcmp(name, "alone") == 0) {
+        if (lzma2) {
+            PyErr_SetString(PyExc_ValueError, "format 'alone' is not supported for lzma2");
+            return -1;
+        }
+        return FORMAT_ALONE;
+    }
+    if (strcmp(name, "xz") == 0) {
+        // always uses LZMA2
+        return FORMAT_XZ;
+    }
+    PyErr_Format(PyExc_ValueError, "unsupported format %s, must be None, 'alone' or 'xz'", name);
+    return -1;
+}
+
 #if PY_MAJOR_VERSION >= 3
 static struct PyModuleDef
 pylzma_module = {
@@ -553,14 +611,18 @@ initpylzma(void)
     CDecompressionObject_Type.tp_new = PyType_GenericNew;
     if (PyType_Ready(&CDecompressionObject_Type) < 0)
         RETURN_MODULE_ERROR;
-#if 0
     CCompressionObject_Type.tp_new = PyType_GenericNew;
     if (PyType_Ready(&CCompressionObject_Type) < 0)
         RETURN_MODULE_ERROR;
-#endif
+    CCompressorObject_Type.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&CCompressorObject_Type) < 0)
+        RETURN_MODULE_ERROR;
     CCompressionFileObject_Type.tp_new = PyType_GenericNew;
     if (PyType_Ready(&CCompressionFileObject_Type) < 0)
         RETURN_MODULE_ERROR;
+    CLZMAFileObject_Type.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&CLZMAFileObject_Type) < 0)
+        RETURN_MODULE_ERROR;
 
     CAESDecrypt_Type.tp_new = PyType_GenericNew;
     if (PyType_Ready(&CAESDecrypt_Type) < 0)
@@ -574,12 +636,16 @@ initpylzma(void)
 
     Py_INCREF(&CDecompressionObject_Type);
     PyModule_AddObject(m, "decompressobj", (PyObject *)&CDecompressionObject_Type);
-#if 0
     Py_INCREF(&CCompressionObject_Type);
     PyModule_AddObject(m, "compressobj", (PyObject *)&CCompressionObject_Type);
-#endif
+    PyModule_AddIntConstant(m, "FLUSH_SYNC", FLUSH_SYNC);
+    PyModule_AddIntConstant(m, "FLUSH_FINISH", FLUSH_FINISH);
+    Py_INCREF(&CCompressorObject_Type);
+    PyModule_AddObject(m, "Compressor", (PyObject *)&CCompressorObject_Type);
     Py_INCREF(&CCompressionFileObject_Type);
     PyModule_AddObject(m, "compressfile", (PyObject *)&CCompressionFileObject_Type);
+    Py_INCREF(&CLZMAFileObject_Type);
+    PyModule_AddObject(m, "LZMAFile", (PyObject *)&CLZMAFileObject_Type);
 
     Py_INCREF(&CAESDecrypt_Type);
     PyModule_AddObject(m, "AESDecrypt", (PyObject *)&CAESDecrypt_Type);
@@ -599,7 +665,12 @@ initpylzma(void)
 #endif
 
     AesGenTables();
+    CrcGenerateTable();
+    Crc64GenerateTable();
+    Sha256Prepare();
     pylzma_init_compfile();
+    if (pylzma_init_lzmafile() != 0)
+        RETURN_MODULE_ERROR;
 
 #if defined(WITH_THREAD)
 #if PY_VERSION_HEX < 0x03090000
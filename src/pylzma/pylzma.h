@@ -103,6 +103,20 @@ PyInterpreterState* _pylzma_interpreterState;
 #define PYLZMA_TP_PRINT NULL
 #endif
 
+// Container formats of compressed streams.
+#define FORMAT_DEFAULT          0   // properties followed by the compressed data
+#define FORMAT_ALONE            1   // .lzma files, properties and uncompressed size
+#define FORMAT_XZ               2   // .xz files, blocks of LZMA2 data with checks and an index
+
+// The header of "alone" streams contains the uncompressed size as 64 bit
+// little endian value after the properties, all bits are set if it's unknown.
+#define ALONE_HEADER_SIZE       (5 + 8)
+#define ALONE_UNKNOWN_SIZE      ((UInt64) (Int64) -1)
+
 extern ISzAlloc allocator;
 
+// Return the FORMAT_* constant for the name of a format (NULL for the
+// default) or -1 with an exception set.
+int pylzma_parse_format(const char *name, int lzma2);
+
 #endif
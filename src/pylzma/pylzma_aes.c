@@ -88,23 +88,26 @@ doc_aesdecrypt_decrypt[] = \
 static PyObject *
 aesdecrypt_decrypt(CAESDecryptObject *self, PyObject *args)
 {
-    char *data;
+    Py_buffer data;
     Py_ssize_t length;
     PyObject *result;
     char *out;
     Py_ssize_t outlength;
     char *tmpdata = NULL;
 
-    if (!PyArg_ParseTuple(args, "s#", &data, &length))
+    if (!PyArg_ParseTuple(args, "s*", &data))
         return NULL;
 
+    length = data.len;
     if (length % AES_BLOCK_SIZE) {
+        PyBuffer_Release(&data);
         PyErr_Format(PyExc_TypeError, "data must be a multiple of %d bytes, got %zd", AES_BLOCK_SIZE, length);
         return NULL;
     }
 
     result = PyBytes_FromStringAndSize(NULL, length);
     if (result == NULL) {
+        PyBuffer_Release(&data);
         return NULL;
     }
 
@@ -125,7 +128,7 @@ aesdecrypt_decrypt(CAESDecryptObject *self, PyObject *args)
         }
         assert(((uintptr_t) out & ALIGNMENT_MASK) == 0);
     }
-    memcpy(out, data, length);
+    memcpy(out, data.buf, length);
     g_AesCbc_Decode(self->aes, (Byte *) out, outlength / AES_BLOCK_SIZE);
     if (tmpdata != NULL) {
         memcpy(PyBytes_AS_STRING(result), out, length);
@@ -139,6 +142,7 @@ exit:
         PyErr_NoMemory();
     }
     free(tmpdata);
+    PyBuffer_Release(&data);
     return result;
 }
 
@@ -25,110 +25,945 @@
 
 #include <Python.h>
 
+#include "../sdk/C/CpuArch.h"
 #include "../sdk/C/LzmaEnc.h"
+#include "../sdk/C/Lzma2Enc.h"
+#include "../sdk/C/Xz.h"
+#include "../sdk/C/XzEnc.h"
 
 #include "pylzma.h"
+#include "pylzma_compress.h"
+#include "pylzma_estimate.h"
+#include "pylzma_pool.h"
 #include "pylzma_streams.h"
 
+void
+pylzma_init_compression_options(CCompressionOptions *options)
+{
+    // Parameters with a value of -1 have not been set by the caller.
+    options->dictionary = -1;
+    options->fastBytes = -1;
+    options->literalContextBits = 3;
+    options->literalPosBits = 0;
+    options->posBits = 2;
+    options->algorithm = -1;
+    options->eos = 1;
+    options->multithreading = 1;
+    options->matchfinder = NULL;
+    options->lzma2 = 0;
+    options->threads = 0;
+    options->block_size = 0;
+    options->mc = 0;
+    options->numHashOutBits = 0;
+    options->level = -1;
+    options->preset = -1;
+    options->extreme = 0;
+    options->store_if_incompressible = 0;
+    options->format = NULL;
+    options->container = FORMAT_DEFAULT;
+    options->check = NULL;
+    options->checkId = XZ_CHECK_CRC64;
+}
+
+typedef struct {
+    const char *name;
+    int btMode;
+    int numHashBytes;
+} CMatchFinderInfo;
+
+static const CMatchFinderInfo
+matchfinders[] = {
+    {"hc4", 0, 4},
+    {"hc5", 0, 5},
+    {"bt2", 1, 2},
+    {"bt3", 1, 3},
+    {"bt4", 1, 4},
+    {"bt5", 1, 5},
+    {NULL, 0, 0},
+};
+
+#define MF_HC4  (&matchfinders[0])
+#define MF_BT4  (&matchfinders[4])
+
+typedef struct {
+    int dictionary;
+    int fastBytes;
+    int algorithm;
+    const CMatchFinderInfo *matchfinder;
+    int mc;
+} CPresetInfo;
+
+// Presets as used by xz, the hc3 matchfinder of preset 0 is not
+// available in the LZMA SDK and is replaced by hc4.
+static const CPresetInfo
+presets[10] = {
+    {18, 128, 0, MF_HC4,   4},
+    {20, 128, 0, MF_HC4,   8},
+    {21, 273, 0, MF_HC4,  24},
+    {22, 273, 0, MF_HC4,  48},
+    {22,  16, 1, MF_BT4,   0},
+    {23,  32, 1, MF_BT4,   0},
+    {23,  64, 1, MF_BT4,   0},
+    {24,  64, 1, MF_BT4,   0},
+    {25,  64, 1, MF_BT4,   0},
+    {26,  64, 1, MF_BT4,   0},
+};
+
+// The preset that is used if only "extreme" is given.
+#define DEFAULT_PRESET  6
+
+typedef struct {
+    const char *name;
+    int id;
+} CCheckInfo;
+
+static const CCheckInfo
+checks[] = {
+    {"crc64", XZ_CHECK_CRC64},
+    {"crc32", XZ_CHECK_CRC32},
+    {"sha256", XZ_CHECK_SHA256},
+    {"none", XZ_CHECK_NO},
+    {NULL, 0},
+};
+
+// Smaller blocks could make the xz overhead exceed the space reserved by
+// pylzma_max_compressed_size.
+#define XZ_MIN_BLOCK_SIZE   (64 * 1024)
+
+int
+pylzma_parse_compression_options(CCompressionOptions *options, CLzmaEncProps *props)
+{
+    const CMatchFinderInfo *matchfinder = NULL;
+    const CCheckInfo *check;
+    CPresetInfo preset;
+    int result = -1;
+
+    CHECK_RANGE(options->preset,            -1,   9, "preset must be between 0 and 9");
+    if (options->preset != -1 && options->level != -1) {
+        PyErr_SetString(PyExc_ValueError, "level and preset can not be used together");
+        goto exit;
+    }
+    if (options->preset == -1 && options->extreme) {
+        options->preset = DEFAULT_PRESET;
+    }
+    if (options->preset != -1) {
+        preset = presets[options->preset];
+        if (options->extreme) {
+            preset.algorithm = 1;
+            preset.matchfinder = MF_BT4;
+            if (options->preset == 3 || options->preset == 5) {
+                preset.fastBytes = 192;
+                preset.mc = 0;
+            } else {
+                preset.fastBytes = 273;
+                preset.mc = 512;
+            }
+        }
+        // explicitly passed parameters override the preset
+        if (options->dictionary == -1) options->dictionary = preset.dictionary;
+        if (options->fastBytes == -1) options->fastBytes = preset.fastBytes;
+        if (options->algorithm == -1) options->algorithm = preset.algorithm;
+        if (options->matchfinder == NULL) matchfinder = preset.matchfinder;
+        if (options->mc == 0) options->mc = preset.mc;
+    } else if (options->level == -1) {
+        // defaults of previous versions of pylzma
+        if (options->dictionary == -1) options->dictionary = 23;
+        if (options->fastBytes == -1) options->fastBytes = 128;
+        if (options->algorithm == -1) options->algorithm = 2;
+    }
+
+    CHECK_RANGE(options->level,             -1,   9, "level must be between 0 and 9");
+    if (options->dictionary != -1) {
+        CHECK_RANGE(options->dictionary,     0,  28, "dictionary must be between 0 and 28");
+    }
+    if (options->fastBytes != -1) {
+        CHECK_RANGE(options->fastBytes,      5, 273, "fastBytes must be between 5 and 273");
+    }
+    CHECK_RANGE(options->literalContextBits, 0,   8, "literalContextBits must be between 0 and 8");
+    CHECK_RANGE(options->literalPosBits,     0,   4, "literalPosBits must be between 0 and 4");
+    CHECK_RANGE(options->posBits,            0,   4, "posBits must be between 0 and 4");
+    if (options->algorithm != -1) {
+        CHECK_RANGE(options->algorithm,      0,   2, "algorithm must be between 0 and 2");
+    }
+    CHECK_RANGE(options->mc,                 0, 1 << 30, "mc must be between 0 and 1073741824");
+    CHECK_RANGE(options->numHashOutBits,     0,  32, "numHashOutBits must be between 0 and 32");
+    if (options->threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be zero or greater");
+        goto exit;
+    }
+    if (options->block_size < 0) {
+        PyErr_SetString(PyExc_ValueError, "block_size must be zero or greater");
+        goto exit;
+    }
+
+    options->container = pylzma_parse_format(options->format, options->lzma2);
+    if (options->container < 0) {
+        goto exit;
+    }
+    // the name is only valid while the arguments are parsed
+    options->format = NULL;
+
+    if (options->container == FORMAT_XZ) {
+        if (options->block_size > 0 && options->block_size < XZ_MIN_BLOCK_SIZE) {
+            PyErr_Format(PyExc_ValueError, "block_size must be at least %d for format 'xz'", XZ_MIN_BLOCK_SIZE);
+            goto exit;
+        }
+        if (options->store_if_incompressible) {
+            PyErr_SetString(PyExc_ValueError, "store_if_incompressible is not supported for format 'xz'");
+            goto exit;
+        }
+    } else if (!options->lzma2 && (options->threads > 1 || options->block_size > 0)) {
+        PyErr_SetString(PyExc_ValueError, "threads and block_size are only supported for lzma2 and format 'xz'");
+        goto exit;
+    }
+    if (!options->lzma2 && options->store_if_incompressible) {
+        // LZMA streams can't contain uncompressed data
+        PyErr_SetString(PyExc_ValueError, "store_if_incompressible is only supported for lzma2");
+        goto exit;
+    }
+
+    if (options->matchfinder != NULL) {
+        for (matchfinder = matchfinders; matchfinder->name != NULL; matchfinder++) {
+            if (strcmp(matchfinder->name, options->matchfinder) == 0) {
+                break;
+            }
+        }
+        if (matchfinder->name == NULL) {
+            PyErr_Format(PyExc_ValueError, "unsupported matchfinder %s, must be one of hc4, hc5, bt2, bt3, bt4 or bt5", options->matchfinder);
+            goto exit;
+        }
+        // the name is only valid while the arguments are parsed
+        options->matchfinder = NULL;
+    }
+
+    if (options->check != NULL) {
+        if (options->container != FORMAT_XZ) {
+            PyErr_SetString(PyExc_ValueError, "check is only supported for format 'xz'");
+            goto exit;
+        }
+        for (check = checks; check->name != NULL; check++) {
+            if (strcmp(check->name, options->check) == 0) {
+                break;
+            }
+        }
+        if (check->name == NULL) {
+            PyErr_Format(PyExc_ValueError, "unsupported check %s, must be one of crc64, crc32, sha256 or none", options->check);
+            goto exit;
+        }
+        options->checkId = check->id;
+        // the name is only valid while the arguments are parsed
+        options->check = NULL;
+    }
+
+    LzmaEncProps_Init(props);
+
+    if (options->level != -1) {
+        props->level = options->level;
+    }
+    if (options->dictionary != -1) {
+        props->dictSize = 1 << options->dictionary;
+    }
+    props->lc = options->literalContextBits;
+    props->lp = options->literalPosBits;
+    props->pb = options->posBits;
+    if (options->algorithm != -1) {
+        props->algo = options->algorithm;
+    }
+    if (options->fastBytes != -1) {
+        props->fb = options->fastBytes;
+    }
+    if (matchfinder != NULL) {
+        props->btMode = matchfinder->btMode;
+        props->numHashBytes = matchfinder->numHashBytes;
+    }
+    props->mc = (UInt32) options->mc;
+    props->numHashOutBits = (unsigned) options->numHashOutBits;
+    props->writeEndMark = options->eos ? 1 : 0;
+    props->numThreads = options->multithreading ? 2 : 1;
+    result = 0;
+
+exit:
+    return result;
+}
+
+int
+pylzma_parse_progress(CPythonProgress *progress, PyObject *callback, Py_ssize_t interval)
+{
+    if (callback == Py_None) {
+        callback = NULL;
+    }
+    if (callback != NULL && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+        return -1;
+    }
+    if (interval < 0) {
+        PyErr_SetString(PyExc_ValueError, "progress_interval must be zero or greater");
+        return -1;
+    }
+
+    CreatePythonProgress(progress, callback, (UInt64) interval);
+    return 0;
+}
+
+size_t
+pylzma_max_compressed_size(size_t size)
+{
+    // LZMA can increase the size of incompressible data, LZMA2 stores them
+    // in uncompressed chunks with a few bytes of overhead.
+    return ALONE_HEADER_SIZE + size + size / 3 + 128;
+}
+
+// Inputs up to this size are compressed without the match finder thread.
+#define SMALL_INPUT_SIZE        (64 * 1024)
+// Inputs that fit into the minimum dictionary use the hash chain match finder
+// unless a match finder was selected explicitly.
+#define TINY_INPUT_SIZE         (4 * 1024)
+// Size of the buffer on the stack to compress small messages to.
+#define STACK_BUFFER_SIZE       (4 * 1024)
+
+void
+pylzma_reduce_encoder_props(CLzmaEncProps *props, size_t size)
+{
+    // The dictionary and the tables of the match finder are sized to the
+    // input, so small inputs don't allocate and initialize large tables.
+    props->reduceSize = (UInt64) size;
+    if (size <= SMALL_INPUT_SIZE) {
+        // starting the thread costs more than it saves for small inputs
+        props->numThreads = 1;
+    }
+    if (size <= TINY_INPUT_SIZE && props->btMode < 0) {
+        props->btMode = 0;
+        props->numHashBytes = 4;
+    }
+}
+
+void
+pylzma_init_buffer_encoder(CBufferEncoder *encoder, const CCompressionOptions *options, const CLzmaEncProps *props)
+{
+    encoder->options = *options;
+    encoder->props = *props;
+    encoder->lzma = NULL;
+    encoder->lzma2 = NULL;
+    encoder->xz = NULL;
+}
+
+void
+pylzma_free_buffer_encoder(CBufferEncoder *encoder)
+{
+    if (encoder->lzma != NULL) {
+        LzmaEnc_Destroy(encoder->lzma, &allocator, &allocator);
+        encoder->lzma = NULL;
+    }
+    if (encoder->lzma2 != NULL) {
+        Lzma2Enc_Destroy(encoder->lzma2);
+        encoder->lzma2 = NULL;
+    }
+    if (encoder->xz != NULL) {
+        XzEnc_Destroy(encoder->xz);
+        encoder->xz = NULL;
+    }
+}
+
+SRes
+pylzma_set_xz_encoder_props(CXzEncHandle xz, const CCompressionOptions *options, const CLzmaEncProps *props, UInt64 size)
+{
+    CXzProps xzProps;
+    SRes res;
+
+    XzProps_Init(&xzProps);
+    xzProps.lzma2Props.lzmaProps = *props;
+    if (size != (UInt64) (Int64) -1) {
+        pylzma_reduce_encoder_props(&xzProps.lzma2Props.lzmaProps, size > (size_t) -1 ? (size_t) -1 : (size_t) size);
+    }
+    xzProps.checkId = (unsigned) options->checkId;
+    // the input is split into blocks that are compressed in parallel, the
+    // remaining threads are used by the encoders of the blocks
+    if (options->threads > 0) {
+        xzProps.numTotalThreads = options->threads;
+    }
+    if (options->block_size > 0) {
+        xzProps.blockSize = (UInt64) options->block_size;
+    }
+    xzProps.reduceSize = size;
+    res = XzEnc_SetProps(xz, &xzProps);
+    if (res == SZ_OK) {
+        XzEnc_SetDataSize(xz, size);
+    }
+    return res;
+}
+
+// Size of the regions that are checked if they can be compressed.
+#define STORE_REGION_SIZE       (1024 * 1024)
+// Number of bytes of a region that are probed.
+#define STORE_REGION_SAMPLE     (16 * 1024)
+// Regions with a higher estimated ratio are stored uncompressed.
+#define STORE_RATIO             0.95
+
+// Write the data as uncompressed LZMA2 chunks.
+static SRes
+pylzma_lzma2_store(Byte *dest, size_t *destLen, const Byte *src, size_t srcLen)
+{
+    size_t written = 0;
+    size_t pos = 0;
+
+    while (pos < srcLen) {
+        size_t chunk = min(srcLen - pos, (size_t) LZMA2_COPY_CHUNK_SIZE);
+        if (*destLen - written < chunk + 3) {
+            return SZ_ERROR_OUTPUT_EOF;
+        }
+        dest[written++] = pos == 0 ? LZMA2_CONTROL_COPY_RESET_DIC : LZMA2_CONTROL_COPY_NO_RESET;
+        dest[written++] = (Byte) ((chunk - 1) >> 8);
+        dest[written++] = (Byte) (chunk - 1);
+        memcpy(dest + written, src + pos, chunk);
+        written += chunk;
+        pos += chunk;
+    }
+    *destLen = written;
+    return SZ_OK;
+}
+
+static int
+pylzma_is_incompressible(const Byte *src, size_t srcLen)
+{
+    return pylzma_estimate_ratio(src, srcLen, STORE_REGION_SAMPLE) >= STORE_RATIO;
+}
+
+// Reports the progress of one run of regions relative to the whole input.
+typedef struct {
+    ICompressProgress s;
+    ICompressProgressPtr progress;
+    UInt64 inOffset;
+    UInt64 outOffset;
+} COffsetProgress;
+
+static SRes
+OffsetProgress_Progress(ICompressProgressPtr p, UInt64 inSize, UInt64 outSize)
+{
+    const COffsetProgress *self = (const COffsetProgress *) p;
+
+    if (inSize != (UInt64) (Int64) -1) {
+        inSize += self->inOffset;
+    }
+    if (outSize != (UInt64) (Int64) -1) {
+        outSize += self->outOffset;
+    }
+    return ICompressProgress_Progress(self->progress, inSize, outSize);
+}
+
+// Consecutive regions of the input that are estimated to be incompressible
+// are stored as uncompressed chunks without running the encoder, all other
+// regions are compressed. Each compressed run of regions starts with a
+// dictionary reset.
+static SRes
+pylzma_lzma2_compress_or_store(CLzma2EncHandle lzma2, Byte *dest, size_t *destLen, const Byte *src, size_t srcLen,
+    ICompressProgressPtr progress)
+{
+    size_t written = 0;
+    size_t pos = 0;
+    int store = 0;
+    int nextStore;
+    COffsetProgress runProgress;
+    SRes res;
+
+    runProgress.s.Progress = OffsetProgress_Progress;
+    runProgress.progress = progress;
+    if (srcLen > 0) {
+        store = pylzma_is_incompressible(src, min(srcLen, (size_t) STORE_REGION_SIZE));
+    }
+    while (pos < srcLen) {
+        size_t end = pos + min(srcLen - pos, (size_t) STORE_REGION_SIZE);
+        size_t outSize = *destLen - written;
+
+        nextStore = store;
+        while (end < srcLen) {
+            size_t regionSize = min(srcLen - end, (size_t) STORE_REGION_SIZE);
+            nextStore = pylzma_is_incompressible(src + end, regionSize);
+            if (nextStore != store) {
+                break;
+            }
+            end += regionSize;
+        }
+
+        if (store) {
+            res = pylzma_lzma2_store(dest + written, &outSize, src + pos, end - pos);
+        } else {
+            Lzma2Enc_SetDataSize(lzma2, (UInt64) (end - pos));
+            runProgress.inOffset = pos;
+            runProgress.outOffset = written;
+            res = Lzma2Enc_Encode2(lzma2, NULL, dest + written, &outSize, NULL, src + pos, end - pos,
+                progress != NULL ? &runProgress.s : NULL);
+            if (res == SZ_OK) {
+                // the stream continues after the compressed regions
+                if (outSize == 0 || dest[written + outSize - 1] != LZMA2_CONTROL_EOF) {
+                    return SZ_ERROR_FAIL;
+                }
+                outSize--;
+            }
+        }
+        if (res != SZ_OK) {
+            return res;
+        }
+
+        written += outSize;
+        pos = end;
+        store = nextStore;
+        if (progress != NULL) {
+            // stored regions are not reported by the encoder
+            RINOK(ICompressProgress_Progress(progress, pos, written))
+        }
+    }
+
+    if (written >= *destLen) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+    dest[written++] = LZMA2_CONTROL_EOF;
+    *destLen = written;
+    return SZ_OK;
+}
+
+static SRes
+pylzma_buffer_encoder_compress_lzma2(CBufferEncoder *encoder, Byte *dest, size_t *destLen, const Byte *src, size_t srcLen, ICompressProgressPtr progress)
+{
+    CLzma2EncProps props;
+    size_t outSize;
+    SRes res;
+
+    if (*destLen < 1) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+
+    if (encoder->lzma2 == NULL) {
+        encoder->lzma2 = Lzma2Enc_Create(&allocator, &allocator);
+        if (encoder->lzma2 == NULL) {
+            return SZ_ERROR_MEM;
+        }
+    }
+
+    Lzma2EncProps_Init(&props);
+    props.lzmaProps = encoder->props;
+    // also allows the encoder to limit the number of block threads for small inputs
+    pylzma_reduce_encoder_props(&props.lzmaProps, srcLen);
+    if (encoder->options.threads > 0) {
+        props.numTotalThreads = encoder->options.threads;
+    }
+    if (encoder->options.block_size > 0) {
+        props.blockSize = (UInt64) encoder->options.block_size;
+    }
+    res = Lzma2Enc_SetProps(encoder->lzma2, &props);
+    if (res != SZ_OK) {
+        return res;
+    }
+
+    dest[0] = Lzma2Enc_WriteProperties(encoder->lzma2);
+    outSize = *destLen - 1;
+    if (encoder->options.store_if_incompressible) {
+        res = pylzma_lzma2_compress_or_store(encoder->lzma2, dest + 1, &outSize, src, srcLen, progress);
+    } else {
+        Lzma2Enc_SetDataSize(encoder->lzma2, (UInt64) srcLen);
+        res = Lzma2Enc_Encode2(encoder->lzma2, NULL, dest + 1, &outSize, NULL, src, srcLen, progress);
+    }
+    *destLen = outSize + 1;
+    return res;
+}
+
+static SRes
+pylzma_buffer_encoder_compress_xz(CBufferEncoder *encoder, Byte *dest, size_t *destLen, const Byte *src, size_t srcLen, ICompressProgressPtr progress)
+{
+    CMemoryInStream inStream;
+    CBufferOutStream outStream;
+    SRes res;
+
+    if (encoder->xz == NULL) {
+        encoder->xz = XzEnc_Create(&allocator, &allocator);
+        if (encoder->xz == NULL) {
+            return SZ_ERROR_MEM;
+        }
+    }
+
+    res = pylzma_set_xz_encoder_props(encoder->xz, &encoder->options, &encoder->props, (UInt64) srcLen);
+    if (res != SZ_OK) {
+        return res;
+    }
+
+    // blocks are read from the input and written to the output by the encoder
+    CreateMemoryInStream(&inStream, (Byte *) src, srcLen);
+    CreateBufferOutStream(&outStream, dest, *destLen);
+    res = XzEnc_Encode(encoder->xz, &outStream.s, &inStream.s, progress);
+    if (res == SZ_ERROR_WRITE && outStream.overflow) {
+        res = SZ_ERROR_OUTPUT_EOF;
+    }
+    *destLen = outStream.pos;
+    return res;
+}
+
+SRes
+pylzma_buffer_encoder_compress(CBufferEncoder *encoder, Byte *dest, size_t *destLen, const Byte *src, size_t srcLen, ICompressProgressPtr progress)
+{
+    CLzmaEncProps props;
+    size_t headerSize = LZMA_PROPS_SIZE;
+    size_t outSize;
+    SRes res;
+
+    if (encoder->options.container == FORMAT_XZ) {
+        return pylzma_buffer_encoder_compress_xz(encoder, dest, destLen, src, srcLen, progress);
+    }
+    if (encoder->options.lzma2) {
+        return pylzma_buffer_encoder_compress_lzma2(encoder, dest, destLen, src, srcLen, progress);
+    }
+
+    if (*destLen < ALONE_HEADER_SIZE) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+
+    if (encoder->lzma == NULL) {
+        encoder->lzma = LzmaEnc_Create(&allocator);
+        if (encoder->lzma == NULL) {
+            return SZ_ERROR_MEM;
+        }
+    }
+
+    props = encoder->props;
+    pylzma_reduce_encoder_props(&props, srcLen);
+    res = LzmaEnc_SetProps(encoder->lzma, &props);
+    if (res != SZ_OK) {
+        return res;
+    }
+    LzmaEnc_SetDataSize(encoder->lzma, (UInt64) srcLen);
+
+    res = LzmaEnc_WriteProperties(encoder->lzma, dest, &headerSize);
+    if (res != SZ_OK) {
+        return res;
+    }
+    if (encoder->options.container == FORMAT_ALONE) {
+        SetUi64(dest + headerSize, (UInt64) srcLen);
+        headerSize += 8;
+    }
+
+    // The input is used directly by the match finder without being copied.
+    // Tables of the match finder are kept and reused in the next call.
+    outSize = *destLen - headerSize;
+    res = LzmaEnc_MemEncode(encoder->lzma, dest + headerSize, &outSize, src, srcLen,
+        encoder->props.writeEndMark, progress, &allocator, &allocator);
+    *destLen = headerSize + outSize;
+    return res;
+}
+
+void
+pylzma_set_compression_error(SRes res)
+{
+    switch (res) {
+    case SZ_ERROR_MEM:
+        PyErr_NoMemory();
+        break;
+    case SZ_ERROR_PARAM:
+        PyErr_Format(PyExc_TypeError, "could not set encoder properties: %d", res);
+        break;
+    case SZ_ERROR_OUTPUT_EOF:
+        PyErr_SetString(PyExc_ValueError, "output buffer is too small");
+        break;
+    default:
+        PyErr_Format(PyExc_TypeError, "Error during compressing: %d", res);
+        break;
+    }
+}
+
 const char
 doc_compress[] = \
-    "compress(string, dictionary=23, fastBytes=128, literalContextBits=3, literalPosBits=0, posBits=2, algorithm=2, eos=1, multithreading=1, matchfinder='bt4') -- Compress the data in string using the given parameters, returning a string containing the compressed data.";
+    "compress(string, dictionary=23, fastBytes=128, literalContextBits=3, literalPosBits=0, posBits=2, algorithm=2, eos=1, multithreading=1, matchfinder='bt4', lzma2=0, threads=0, block_size=0, mc=0, numHashOutBits=0, level=-1, preset=-1, extreme=0, store_if_incompressible=0, format=None, check='crc64', progress=None, progress_interval=1048576) -- Compress the data in string using the given parameters, returning a string containing the compressed data.\n" \
+    "matchfinder can be one of hc4, hc5, bt2, bt3, bt4 or bt5, mc is the number of match finder cycles (0 selects a value based on fastBytes). "\
+    "If level is given, parameters that are not set explicitly are derived from the level (0-9) like in the LZMA SDK.\n" \
+    "preset (0-9) and extreme select the same parameters as the presets of xz, explicitly given parameters override the preset.\n" \
+    "If lzma2 is true, a LZMA2 stream is created that can be decompressed with decompress(data, lzma2=1). The input is split into "\
+    "blocks of block_size bytes (0 selects a size based on the dictionary) which are compressed in parallel using up to threads threads. "\
+    "If store_if_incompressible is true, parts of the data that are estimated to be incompressible are stored without compressing them.\n" \
+    "If format is 'alone', the header of .lzma files is written that contains the size of the uncompressed data. "\
+    "If format is 'xz', a .xz stream is created whose blocks are verified with the given check (crc64, crc32, sha256 or none), "\
+    "threads and block_size are used like for lzma2.\n" \
+    "If progress is given, it is called with the number of bytes read and written every progress_interval bytes of input. "\
+    "Compression is aborted if it returns a false value or raises an exception.";
 
 PyObject *
 pylzma_compress(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     PyObject *result = NULL;
+    CCompressionOptions options;
     CLzmaEncProps props;
-    CLzmaEncHandle encoder=NULL;
-    CMemoryOutStream outStream;
-    CMemoryInStream inStream;
-    Byte header[LZMA_PROPS_SIZE];
-    size_t headerSize = LZMA_PROPS_SIZE;
-    int res;
+    CBufferEncoder encoder;
+    Py_buffer data;
+    Byte buffer[STACK_BUFFER_SIZE];
+    Byte *dest;
+    size_t length;
+    PyObject *callback = NULL;
+    Py_ssize_t interval = DEFAULT_PROGRESS_INTERVAL;
+    CPythonProgress progress;
+    SRes res;
     // possible keywords for this function
-    static char *kwlist[] = {"data", "dictionary", "fastBytes", "literalContextBits",
-                             "literalPosBits", "posBits", "algorithm", "eos", "multithreading", "matchfinder", NULL};
-    int dictionary = 23;         // [0,27], default 23 (8MB)
-    int fastBytes = 128;         // [5,273], default 128
-    int literalContextBits = 3;  // [0,8], default 3
-    int literalPosBits = 0;      // [0,4], default 0
-    int posBits = 2;             // [0,4], default 2
-    int eos = 1;                 // write "end of stream" marker?
-    int multithreading = 1;      // use multithreading if available?
-    char *matchfinder = NULL;    // matchfinder algorithm
-    int algorithm = 2;
-    char *data;
-    Py_ssize_t length;
+    static char *kwlist[] = {"data", COMPRESSION_OPTIONS_KWLIST, "progress", "progress_interval", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|iiiiiiiis", kwlist, &data, &length, &dictionary, &fastBytes,
-                                                                  &literalContextBits, &literalPosBits, &posBits, &algorithm, &eos, &multithreading, &matchfinder))
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|" COMPRESSION_OPTIONS_FORMAT "On", kwlist, &data,
+                                                                  COMPRESSION_OPTIONS_ARGS(options), &callback, &interval))
         return NULL;
 
-    outStream.data = NULL;
-    CHECK_RANGE(dictionary,         0,  27, "dictionary must be between 0 and 27");
-    CHECK_RANGE(fastBytes,          5, 273, "fastBytes must be between 5 and 273");
-    CHECK_RANGE(literalContextBits, 0,   8, "literalContextBits must be between 0 and 8");
-    CHECK_RANGE(literalPosBits,     0,   4, "literalPosBits must be between 0 and 4");
-    CHECK_RANGE(posBits,            0,   4, "posBits must be between 0 and 4");
-    CHECK_RANGE(algorithm,          0,   2, "algorithm must be between 0 and 2");
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        goto exit;
+    }
 
-    if (matchfinder != NULL) {
-#if (PY_VERSION_HEX >= 0x02050000)
-        PyErr_WarnEx(PyExc_DeprecationWarning, "matchfinder selection is deprecated and will be ignored", 1);
-#else
-        PyErr_Warn(PyExc_DeprecationWarning, "matchfinder selection is deprecated and will be ignored");
-#endif
-    }
-
-    encoder = LzmaEnc_Create(&allocator);
-    if (encoder == NULL)
-        return PyErr_NoMemory();
-
-    CreateMemoryInStream(&inStream, (Byte *) data, length);
-    CreateMemoryOutStream(&outStream);
-
-    LzmaEncProps_Init(&props);
-
-    props.dictSize = 1 << dictionary;
-    props.lc = literalContextBits;
-    props.lp = literalPosBits;
-    props.pb = posBits;
-    props.algo = algorithm;
-    props.fb = fastBytes;
-    // props.btMode = 1;
-    // props.numHashBytes = 4;
-    // props.mc = 32;
-    props.writeEndMark = eos ? 1 : 0;
-    props.numThreads = multithreading ? 2 : 1;
-    LzmaEncProps_Normalize(&props);
-    res = LzmaEnc_SetProps(encoder, &props);
-    if (res != SZ_OK) {
-        PyErr_Format(PyExc_TypeError, "could not set encoder properties: %d", res);
+    if (pylzma_parse_progress(&progress, callback, interval) != 0) {
+        goto exit;
+    }
+
+    length = pylzma_max_compressed_size((size_t) data.len);
+    if (length > PY_SSIZE_T_MAX) {
+        PyErr_NoMemory();
         goto exit;
     }
 
+    if (length <= sizeof(buffer)) {
+        // Small messages are compressed on the stack and copied to a result
+        // of the exact size.
+        dest = buffer;
+    } else {
+        // The result is allocated for the worst case and shrinked afterwards. Pages
+        // of large buffers that are not written to don't use physical memory.
+        result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) length);
+        if (result == NULL) {
+            goto exit;
+        }
+        dest = (Byte *) PyBytes_AS_STRING(result);
+    }
+
     Py_BEGIN_ALLOW_THREADS
-    LzmaEnc_WriteProperties(encoder, header, &headerSize);
-    if (outStream.s.Write((const ISeqOutStream*) &outStream, header, headerSize) != headerSize) {
-        res = SZ_ERROR_WRITE;
+    pylzma_init_buffer_encoder(&encoder, &options, &props);
+    res = pylzma_buffer_encoder_compress(&encoder, dest, &length,
+        (const Byte *) data.buf, (size_t) data.len, progress.callback != NULL ? &progress.s : NULL);
+    pylzma_free_buffer_encoder(&encoder);
+    Py_END_ALLOW_THREADS
+    if (res != SZ_OK) {
+        DEC_AND_NULL(result);
+        if (res == SZ_ERROR_PROGRESS && progress.callback != NULL) {
+            PythonProgressSetError(&progress);
+        } else {
+            pylzma_set_compression_error(res);
+        }
+        goto exit;
+    }
+
+    if (result == NULL) {
+        result = PyBytes_FromStringAndSize((const char *) buffer, (Py_ssize_t) length);
     } else {
-        res = LzmaEnc_Encode(encoder, &outStream.s, &inStream.s, NULL, &allocator, &allocator);
+        _PyBytes_Resize(&result, (Py_ssize_t) length);
     }
+
+exit:
+    PyBuffer_Release(&data);
+    return result;
+}
+
+const char
+doc_compress_into[] = \
+    "compress_into(buffer, data, **options) -- Compress the data into the writable buffer using the same options as compress, " \
+    "returning the number of bytes written. Raises a ValueError if the buffer is too small, use compress_bound to get the required size.";
+
+PyObject *
+pylzma_compress_into(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *result = NULL;
+    CCompressionOptions options;
+    CLzmaEncProps props;
+    CBufferEncoder encoder;
+    Py_buffer buffer;
+    Py_buffer data;
+    size_t length;
+    SRes res;
+    // possible keywords for this function
+    static char *kwlist[] = {"buffer", "data", COMPRESSION_OPTIONS_KWLIST, NULL};
+
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "w*s*|" COMPRESSION_OPTIONS_FORMAT, kwlist, &buffer, &data,
+                                                                  COMPRESSION_OPTIONS_ARGS(options)))
+        return NULL;
+
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        goto exit;
+    }
+
+    length = (size_t) buffer.len;
+    Py_BEGIN_ALLOW_THREADS
+    pylzma_init_buffer_encoder(&encoder, &options, &props);
+    res = pylzma_buffer_encoder_compress(&encoder, (Byte *) buffer.buf, &length,
+        (const Byte *) data.buf, (size_t) data.len, NULL);
+    pylzma_free_buffer_encoder(&encoder);
     Py_END_ALLOW_THREADS
     if (res != SZ_OK) {
-        PyErr_Format(PyExc_TypeError, "Error during compressing: %d", res);
+        pylzma_set_compression_error(res);
         goto exit;
     }
 
-    result = PyBytes_FromStringAndSize((const char *) outStream.data, outStream.size);
+    result = PyLong_FromSize_t(length);
 
 exit:
-    if (encoder != NULL) {
-        LzmaEnc_Destroy(encoder, &allocator, &allocator);
+    PyBuffer_Release(&data);
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+const char
+doc_compress_bound[] = \
+    "compress_bound(length) -- Return the maximum size of the compressed data for length bytes of input.";
+
+PyObject *
+pylzma_compress_bound(PyObject *self, PyObject *args)
+{
+    Py_ssize_t length;
+
+    if (!PyArg_ParseTuple(args, "n", &length))
+        return NULL;
+
+    if (length < 0) {
+        PyErr_SetString(PyExc_ValueError, "length must be zero or greater");
+        return NULL;
+    }
+
+    return PyLong_FromSize_t(pylzma_max_compressed_size((size_t) length));
+}
+
+typedef struct {
+    Py_buffer input;
+    PyObject *output;
+    Byte *dest;
+    size_t length;
+} CCompressManyItem;
+
+typedef struct {
+    CBufferEncoder *encoders;
+    CCompressManyItem *items;
+} CCompressManyState;
+
+static SRes
+compress_many_item(void *param, unsigned worker, size_t index)
+{
+    CCompressManyState *state = (CCompressManyState *) param;
+    CCompressManyItem *item = &state->items[index];
+    return pylzma_buffer_encoder_compress(&state->encoders[worker], item->dest, &item->length,
+        (const Byte *) item->input.buf, (size_t) item->input.len, NULL);
+}
+
+const char
+doc_compress_many[] = \
+    "compress_many(sequence, threads=0, **options) -- Compress all items of the sequence using the same options as compress, " \
+    "returning a list with the compressed data in the same order. The items are compressed in parallel by threads worker " \
+    "threads (0 uses one thread per processor) that each reuse one encoder.";
+
+PyObject *
+pylzma_compress_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *result = NULL;
+    PyObject *sequence = NULL;
+    PyObject *seq = NULL;
+    CCompressionOptions options;
+    CLzmaEncProps props;
+    CCompressManyState state;
+    Py_ssize_t count = 0;
+    Py_ssize_t acquired = 0;
+    Py_ssize_t i;
+    unsigned threads;
+    SRes res;
+    // possible keywords for this function
+    static char *kwlist[] = {"sequence", COMPRESSION_OPTIONS_KWLIST, NULL};
+
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|" COMPRESSION_OPTIONS_FORMAT, kwlist, &sequence,
+                                                                  COMPRESSION_OPTIONS_ARGS(options)))
+        return NULL;
+
+    // "threads" is the number of worker threads, every item is compressed
+    // as a single block.
+    if (options.threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be zero or greater");
+        return NULL;
+    }
+    threads = options.threads > 0 ? (unsigned) options.threads : pylzma_cpu_count();
+    options.threads = 0;
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        return NULL;
+    }
+
+    seq = PySequence_Fast(sequence, "sequence of buffers expected");
+    if (seq == NULL) {
+        return NULL;
+    }
+
+    state.encoders = NULL;
+    count = PySequence_Fast_GET_SIZE(seq);
+    state.items = (CCompressManyItem *) PyMem_Malloc(sizeof(CCompressManyItem) * (count > 0 ? count : 1));
+    CHECK_NULL(state.items);
+    for (i = 0; i < count; i++) {
+        CCompressManyItem *item = &state.items[i];
+        item->output = NULL;
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i), &item->input, PyBUF_SIMPLE) != 0) {
+            goto exit;
+        }
+        acquired++;
+
+        item->length = pylzma_max_compressed_size((size_t) item->input.len);
+        if (item->length > PY_SSIZE_T_MAX) {
+            PyErr_NoMemory();
+            goto exit;
+        }
+        item->output = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) item->length);
+        if (item->output == NULL) {
+            goto exit;
+        }
+        item->dest = (Byte *) PyBytes_AS_STRING(item->output);
     }
-    if (outStream.data != NULL) {
-        free(outStream.data);
+
+    if ((Py_ssize_t) threads > count) {
+        threads = count > 0 ? (unsigned) count : 1;
+    }
+    state.encoders = (CBufferEncoder *) PyMem_Malloc(sizeof(CBufferEncoder) * threads);
+    CHECK_NULL(state.encoders);
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < (Py_ssize_t) threads; i++) {
+        pylzma_init_buffer_encoder(&state.encoders[i], &options, &props);
+    }
+    res = pylzma_pool_run(threads, (size_t) count, compress_many_item, &state);
+    for (i = 0; i < (Py_ssize_t) threads; i++) {
+        pylzma_free_buffer_encoder(&state.encoders[i]);
+    }
+    Py_END_ALLOW_THREADS
+    if (res != SZ_OK) {
+        pylzma_set_compression_error(res);
+        goto exit;
+    }
+
+    result = PyList_New(count);
+    if (result == NULL) {
+        goto exit;
+    }
+    for (i = 0; i < count; i++) {
+        CCompressManyItem *item = &state.items[i];
+        if (_PyBytes_Resize(&item->output, (Py_ssize_t) item->length) != 0) {
+            DEC_AND_NULL(result);
+            goto exit;
+        }
+        // the list steals the reference
+        PyList_SET_ITEM(result, i, item->output);
+        item->output = NULL;
     }
 
+exit:
+    if (state.items != NULL) {
+        for (i = 0; i < acquired; i++) {
+            PyBuffer_Release(&state.items[i].input);
+            Py_XDECREF(state.items[i].output);
+        }
+        PyMem_Free(state.items);
+    }
+    if (state.encoders != NULL) {
+        PyMem_Free(state.encoders);
+    }
+    Py_DECREF(seq);
     return result;
 }
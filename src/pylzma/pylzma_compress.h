@@ -28,7 +28,98 @@
 
 #include <Python.h>
 
+#include "../sdk/C/LzmaEnc.h"
+#include "../sdk/C/Lzma2Enc.h"
+#include "../sdk/C/XzEnc.h"
+
+#include "pylzma_streams.h"
+
+// Control bytes and sizes of LZMA2 chunks that are written without Lzma2Enc
+// (see Lzma2Enc.c of the LZMA SDK).
+#define LZMA2_CONTROL_LZMA              (1 << 7)
+#define LZMA2_CONTROL_COPY_NO_RESET     2
+#define LZMA2_CONTROL_COPY_RESET_DIC    1
+#define LZMA2_CONTROL_EOF               0
+
+#define LZMA2_PACK_SIZE_MAX             (1 << 16)
+#define LZMA2_COPY_CHUNK_SIZE           LZMA2_PACK_SIZE_MAX
+#define LZMA2_UNPACK_SIZE_MAX           (1 << 21)
+
+typedef struct {
+    int dictionary;             // [0,28], default 23 (8MB)
+    int fastBytes;              // [5,273], default 128
+    int literalContextBits;     // [0,8], default 3
+    int literalPosBits;         // [0,4], default 0
+    int posBits;                // [0,4], default 2
+    int algorithm;              // [0,2], default 2
+    int eos;                    // write "end of stream" marker?
+    int multithreading;         // use multithreading if available?
+    char *matchfinder;          // matchfinder algorithm
+    int lzma2;                  // create LZMA2 stream?
+    int threads;                // total number of threads for LZMA2, 0 = single block
+    Py_ssize_t block_size;      // LZMA2 block size, 0 = automatic
+    int mc;                     // number of match finder cycles, 0 = automatic
+    int numHashOutBits;         // [0,32], size of the hash table, 0 = automatic
+    int level;                  // [0,9], derive unset parameters from level, -1 = pylzma defaults
+    int preset;                 // [0,9], xz compatible presets, -1 = not set
+    int extreme;                // use the "extreme" variant of the preset?
+    int store_if_incompressible; // store incompressible parts of LZMA2 streams uncompressed?
+    char *format;               // name of the container format, NULL = default
+    int container;              // FORMAT_* constant parsed from "format"
+    char *check;                // name of the integrity check of xz streams, NULL = crc64
+    int checkId;                // XZ_CHECK_* constant parsed from "check"
+} CCompressionOptions;
+
+// Keywords, format and arguments to parse compression options with "PyArg_ParseTupleAndKeywords".
+#define COMPRESSION_OPTIONS_KWLIST \
+    "dictionary", "fastBytes", "literalContextBits", "literalPosBits", "posBits", \
+    "algorithm", "eos", "multithreading", "matchfinder", "lzma2", "threads", "block_size", \
+    "mc", "numHashOutBits", "level", "preset", "extreme", \
+    "store_if_incompressible", "format", "check"
+#define COMPRESSION_OPTIONS_FORMAT  "iiiiiiiisiiniiiiiizz"
+#define COMPRESSION_OPTIONS_ARGS(o) \
+    &(o).dictionary, &(o).fastBytes, &(o).literalContextBits, &(o).literalPosBits, &(o).posBits, \
+    &(o).algorithm, &(o).eos, &(o).multithreading, &(o).matchfinder, &(o).lzma2, &(o).threads, &(o).block_size, \
+    &(o).mc, &(o).numHashOutBits, &(o).level, &(o).preset, &(o).extreme, \
+    &(o).store_if_incompressible, &(o).format, &(o).check
+
+void pylzma_init_compression_options(CCompressionOptions *options);
+int pylzma_parse_compression_options(CCompressionOptions *options, CLzmaEncProps *props);
+
+// Validate the "progress" and "progress_interval" arguments, "callback" may be NULL or None.
+int pylzma_parse_progress(CPythonProgress *progress, PyObject *callback, Py_ssize_t interval);
+
+// Maximum size of the compressed data (including the header) for "size" bytes of input.
+size_t pylzma_max_compressed_size(size_t size);
+// Size the tables of the encoder for "size" bytes of input.
+void pylzma_reduce_encoder_props(CLzmaEncProps *props, size_t size);
+// Set the properties of the xz encoder for "size" bytes of input ((UInt64) -1 if unknown).
+SRes pylzma_set_xz_encoder_props(CXzEncHandle xz, const CCompressionOptions *options, const CLzmaEncProps *props, UInt64 size);
+
+// Encoder to compress buffers, keeps the allocated encoder between calls.
+typedef struct {
+    CCompressionOptions options;
+    CLzmaEncProps props;
+    CLzmaEncHandle lzma;
+    CLzma2EncHandle lzma2;
+    CXzEncHandle xz;
+} CBufferEncoder;
+
+void pylzma_init_buffer_encoder(CBufferEncoder *encoder, const CCompressionOptions *options, const CLzmaEncProps *props);
+void pylzma_free_buffer_encoder(CBufferEncoder *encoder);
+// Compress "src" to "dest" including the stream header, can be called without holding the GIL.
+// "progress" is optional and called while compressing.
+SRes pylzma_buffer_encoder_compress(CBufferEncoder *encoder, Byte *dest, size_t *destLen, const Byte *src, size_t srcLen,
+    ICompressProgressPtr progress);
+void pylzma_set_compression_error(SRes res);
+
 extern const char doc_compress[];
 PyObject *pylzma_compress(PyObject *self, PyObject *args, PyObject *kwargs);
+extern const char doc_compress_into[];
+PyObject *pylzma_compress_into(PyObject *self, PyObject *args, PyObject *kwargs);
+extern const char doc_compress_bound[];
+PyObject *pylzma_compress_bound(PyObject *self, PyObject *args);
+extern const char doc_compress_many[];
+PyObject *pylzma_compress_many(PyObject *self, PyObject *args, PyObject *kwargs);
 
 #endif
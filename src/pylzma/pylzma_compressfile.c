@@ -28,6 +28,7 @@
 #include <cStringIO.h>
 #endif
 
+#include "../sdk/C/CpuArch.h"
 #include "../sdk/C/LzmaEnc.h"
 #include "../sdk/C/7zTypes.h"
 
@@ -44,17 +45,67 @@ pylzma_init_compfile(void)
 #endif
 }
 
+// Compressed data is written to the output file in blocks of this size.
+#define OUTPUT_BATCH_SIZE   (1024*1024)
+
 typedef struct {
     PyObject_HEAD
     CLzmaEncHandle encoder;
     CPythonInStream inStream;
     CMemoryOutStream outStream;
     PyObject *inFile;
+    PyObject *outFile;
+    PyObject *callback;
+    CPythonProgress progress;
+    UInt64 written;
+    int aborted;
 } CCompressionFileObject;
 
-static char
+// Write the buffered compressed data to the output file.
+static int
+pylzma_compfile_write(CCompressionFileObject *self)
+{
+    while (MemoryOutStreamAvailable(&self->outStream) > 0) {
+        size_t available = MemoryOutStreamAvailable(&self->outStream);
+        Py_ssize_t count;
+        PyObject *data;
+        PyObject *result;
+
+        data = PyBytes_FromStringAndSize((const char *) MemoryOutStreamData(&self->outStream), (Py_ssize_t) available);
+        if (data == NULL) {
+            return -1;
+        }
+        result = PyObject_CallMethod(self->outFile, "write", "O", data);
+        Py_DECREF(data);
+        if (result == NULL) {
+            return -1;
+        }
+        if (result == Py_None) {
+            // file objects of Python 2 don't return the number of bytes written
+            count = (Py_ssize_t) available;
+        } else {
+            count = PyNumber_AsSsize_t(result, PyExc_OverflowError);
+        }
+        Py_DECREF(result);
+        if (count == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (count <= 0 || (size_t) count > available) {
+            PyErr_SetString(PyExc_IOError, "could not write compressed data to output file");
+            return -1;
+        }
+        MemoryOutStreamDiscard(&self->outStream, (size_t) count);
+        self->written += count;
+    }
+    return 0;
+}
+
+static const char
 doc_compfile_read[] = \
-    "docstring is todo\n";
+    "read([bufsize]) -- Compress data from the input file and return up to bufsize bytes of compressed data.\n" \
+    "If no bufsize is given, the whole input is compressed. If an output file was passed, the compressed " \
+    "data is written to it and the number of bytes written is returned (at least bufsize unless the end of " \
+    "the stream was reached, 0 if the stream is finished).";
 
 static PyObject *
 pylzma_compfile_read(CCompressionFileObject *self, PyObject *args)
@@ -62,17 +113,47 @@ pylzma_compfile_read(CCompressionFileObject *self, PyObject *args)
     PyObject *result = NULL;
     int bufsize=0, res=SZ_OK;
     size_t length;
+    UInt64 start = self->written;
 
     if (!PyArg_ParseTuple(args, "|i", &bufsize))
         return NULL;
 
-    while (!bufsize || self->outStream.size < (size_t) bufsize)
+    if (self->aborted) {
+        PythonProgressSetError(&self->progress);
+        return NULL;
+    }
+
+    while (1)
     {
+        if (self->outFile != NULL) {
+            // write in large batches, the remaining data after the stream is finished
+            length = MemoryOutStreamAvailable(&self->outStream);
+            if (length >= OUTPUT_BATCH_SIZE || (length > 0 && LzmaEnc_IsFinished(self->encoder))) {
+                if (pylzma_compfile_write(self) != 0) {
+                    return NULL;
+                }
+            }
+            length = (size_t) (self->written - start);
+        } else {
+            length = MemoryOutStreamAvailable(&self->outStream);
+        }
+        if (LzmaEnc_IsFinished(self->encoder) || (bufsize && length >= (size_t) bufsize)) {
+            break;
+        }
+
         Py_BEGIN_ALLOW_THREADS
         res = LzmaEnc_CodeOneBlock(self->encoder, 0, 0);
         Py_END_ALLOW_THREADS
-        if (res != SZ_OK || LzmaEnc_IsFinished(self->encoder)) {
-            break;
+        if (res != SZ_OK) {
+            pylzma_set_compression_error(res);
+            return NULL;
+        }
+        if (self->callback != NULL && LzmaEnc_GetNumProcessed(self->encoder) >= self->progress.next) {
+            if (PythonProgressCall(&self->progress, LzmaEnc_GetNumProcessed(self->encoder), self->written + MemoryOutStreamAvailable(&self->outStream)) != SZ_OK) {
+                self->aborted = 1;
+                PythonProgressSetError(&self->progress);
+                return NULL;
+            }
         }
     }
 
@@ -80,18 +161,22 @@ pylzma_compfile_read(CCompressionFileObject *self, PyObject *args)
         LzmaEnc_Finish(self->encoder);
     }
 
+    if (self->outFile != NULL) {
+        return PyLong_FromUnsignedLongLong(self->written - start);
+    }
+
+    length = MemoryOutStreamAvailable(&self->outStream);
     if (bufsize)
-        length = min((size_t) bufsize, self->outStream.size);
-    else
-        length = self->outStream.size;
+        length = min((size_t) bufsize, length);
 
-    result = PyBytes_FromStringAndSize((const char *)self->outStream.data, (Py_ssize_t)length);
+    result = PyBytes_FromStringAndSize((const char *) MemoryOutStreamData(&self->outStream), (Py_ssize_t)length);
     if (result == NULL) {
         PyErr_NoMemory();
         goto exit;
     }
 
     MemoryOutStreamDiscard(&self->outStream, length);
+    self->written += length;
 
 exit:
 
@@ -100,17 +185,24 @@ exit:
 
 static PyMethodDef
 pylzma_compfile_methods[] = {
-    {"read",   (PyCFunction)pylzma_compfile_read, METH_VARARGS, doc_compfile_read},
+    {"read",   (PyCFunction)pylzma_compfile_read, METH_VARARGS, (char *)&doc_compfile_read},
     {NULL, NULL},
 };
 
 static void
 pylzma_compfile_dealloc(CCompressionFileObject *self)
 {
-    DEC_AND_NULL(self->inFile);
     if (self->encoder != NULL) {
+        // match finder threads of an unfinished stream may wait for the GIL
+        // to read from the input file, which must still exist
+        Py_BEGIN_ALLOW_THREADS
         LzmaEnc_Destroy(self->encoder, &allocator, &allocator);
+        Py_END_ALLOW_THREADS
     }
+    DEC_AND_NULL(self->inFile);
+    DEC_AND_NULL(self->outFile);
+    DEC_AND_NULL(self->callback);
+    FreePythonInStream(&self->inStream);
     if (self->outStream.data != NULL) {
         free(self->outStream.data);
     }
@@ -121,42 +213,48 @@ static int
 pylzma_compfile_init(CCompressionFileObject *self, PyObject *args, PyObject *kwargs)
 {
     PyObject *inFile;
+    PyObject *outFile = NULL;
+    PyObject *callback = NULL;
+    Py_ssize_t interval = DEFAULT_PROGRESS_INTERVAL;
+    CCompressionOptions options;
     CLzmaEncProps props;
-    Byte header[LZMA_PROPS_SIZE];
+    Byte header[ALONE_HEADER_SIZE];
     size_t headerSize = LZMA_PROPS_SIZE;
     int result = -1;
+    int res;
 
     // possible keywords for this function
-    static char *kwlist[] = {"infile", "dictionary", "fastBytes", "literalContextBits",
-                             "literalPosBits", "posBits", "algorithm", "eos", "multithreading", "matchfinder", NULL};
-    int dictionary = 23;         // [0,28], default 23 (8MB)
-    int fastBytes = 128;         // [5,255], default 128
-    int literalContextBits = 3;  // [0,8], default 3
-    int literalPosBits = 0;      // [0,4], default 0
-    int posBits = 2;             // [0,4], default 2
-    int eos = 1;                 // write "end of stream" marker?
-    int multithreading = 1;      // use multithreading if available?
-    char *matchfinder = NULL;    // matchfinder algorithm
-    int algorithm = 2;
-    int res;
+    static char *kwlist[] = {"infile", COMPRESSION_OPTIONS_KWLIST, "progress", "progress_interval", "outfile", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iiiiiiiis", kwlist, &inFile, &dictionary, &fastBytes,
-                                                                 &literalContextBits, &literalPosBits, &posBits, &algorithm, &eos, &multithreading, &matchfinder))
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|" COMPRESSION_OPTIONS_FORMAT "OnO", kwlist, &inFile,
+                                                                 COMPRESSION_OPTIONS_ARGS(options), &callback, &interval, &outFile))
         return -1;
 
-    CHECK_RANGE(dictionary,         0,  28, "dictionary must be between 0 and 28");
-    CHECK_RANGE(fastBytes,          5, 255, "fastBytes must be between 5 and 255");
-    CHECK_RANGE(literalContextBits, 0,   8, "literalContextBits must be between 0 and 8");
-    CHECK_RANGE(literalPosBits,     0,   4, "literalPosBits must be between 0 and 4");
-    CHECK_RANGE(posBits,            0,   4, "posBits must be between 0 and 4");
-    CHECK_RANGE(algorithm,          0,   2, "algorithm must be between 0 and 2");
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        return -1;
+    }
 
-    if (matchfinder != NULL) {
-#if (PY_VERSION_HEX >= 0x02050000)
-        PyErr_WarnEx(PyExc_DeprecationWarning, "matchfinder selection is deprecated and will be ignored", 1);
-#else
-        PyErr_Warn(PyExc_DeprecationWarning, "matchfinder selection is deprecated and will be ignored");
-#endif
+    if (pylzma_parse_progress(&self->progress, callback, interval) != 0) {
+        return -1;
+    }
+
+    if (options.lzma2 || options.container == FORMAT_XZ) {
+        PyErr_SetString(PyExc_ValueError, "lzma2 and format 'xz' are not supported for compressing files, use compress_file instead");
+        return -1;
+    }
+
+    if (options.container == FORMAT_ALONE && !options.eos) {
+        PyErr_SetString(PyExc_ValueError, "format 'alone' requires eos if the size is not known");
+        return -1;
+    }
+
+    if (outFile == Py_None) {
+        outFile = NULL;
+    }
+    if (outFile != NULL && !PyObject_HasAttrString(outFile, "write")) {
+        PyErr_SetString(PyExc_TypeError, "outfile must be a file-like object");
+        return -1;
     }
 
     if (PyBytes_Check(inFile)) {
@@ -187,20 +285,6 @@ pylzma_compfile_init(CCompressionFileObject *self, PyObject *args, PyObject *kwa
         return -1;
     }
 
-    LzmaEncProps_Init(&props);
-
-    props.dictSize = 1 << dictionary;
-    props.lc = literalContextBits;
-    props.lp = literalPosBits;
-    props.pb = posBits;
-    props.algo = algorithm;
-    props.fb = fastBytes;
-    // props.btMode = 1;
-    // props.numHashBytes = 4;
-    // props.mc = 32;
-    props.writeEndMark = eos ? 1 : 0;
-    props.numThreads = multithreading ? 2 : 1;
-    LzmaEncProps_Normalize(&props);
     res = LzmaEnc_SetProps(self->encoder, &props);
     if (res != SZ_OK) {
         Py_DECREF(inFile);
@@ -209,10 +293,21 @@ pylzma_compfile_init(CCompressionFileObject *self, PyObject *args, PyObject *kwa
     }
 
     self->inFile = inFile;
+    self->outFile = outFile;
+    Py_XINCREF(outFile);
+    self->callback = self->progress.callback;
+    Py_XINCREF(self->callback);
+    self->written = 0;
+    self->aborted = 0;
     CreatePythonInStream(&self->inStream, inFile);
     CreateMemoryOutStream(&self->outStream);
 
     LzmaEnc_WriteProperties(self->encoder, header, &headerSize);
+    if (options.container == FORMAT_ALONE) {
+        // the size of the input is not known in advance
+        SetUi64(header + headerSize, ALONE_UNKNOWN_SIZE);
+        headerSize += 8;
+    }
     if (self->outStream.s.Write((const ISeqOutStream*) &self->outStream, header, headerSize) != headerSize) {
         PyErr_SetString(PyExc_TypeError, "could not generate stream header");
         goto exit;
@@ -25,152 +25,456 @@
 
 #include <Python.h>
 
-#include "../sdk/LzmaEnc.h"
+#include "../sdk/C/CpuArch.h"
+#include "../sdk/C/LzmaEnc.h"
+#include "../sdk/C/7zCrc.h"
+#include "../sdk/C/7zTypes.h"
+#include "../sdk/C/Xz.h"
 
 #include "pylzma.h"
 #include "pylzma_streams.h"
+#include "pylzma_compress.h"
+#include "pylzma_compressobj.h"
+
+// Internal functions of the LZMA encoder that are used to create LZMA2 chunks
+// (see Lzma2Enc.c).
+SRes LzmaEnc_PrepareForLzma2(CLzmaEncHandle p, ISeqInStreamPtr inStream, UInt32 keepWindowSize,
+    ISzAllocPtr alloc, ISzAllocPtr allocBig);
+SRes LzmaEnc_CodeOneMemBlock(CLzmaEncHandle p, BoolInt reInit,
+    Byte *dest, size_t *destLen, UInt32 desiredPackSize, UInt32 *unpackSize);
+const Byte *LzmaEnc_GetCurBuf(CLzmaEncHandle p);
+void LzmaEnc_SaveState(CLzmaEncHandle p);
+void LzmaEnc_RestoreState(CLzmaEncHandle p);
+
+#define LZMA2_LCLP_MAX                  4
+#define LZMA2_DIC_SIZE_FROM_PROP(p)     (((UInt32)2 | ((p) & 1)) << ((p) / 2 + 11))
+
+#define LZMA2_KEEP_WINDOW_SIZE          LZMA2_UNPACK_SIZE_MAX
+#define LZMA2_CHUNK_SIZE_COMPRESSED_MAX ((1 << 16) + 16)
+
+// The match finder must not run out of input while a block is encoded, as it
+// would treat this as the end of the stream. Blocks are only encoded if at
+// least this many bytes are pending, the remaining input is encoded when the
+// object is flushed.
+#define LOOKAHEAD_SIZE                  (16 * 1024)
+#define LZMA_BLOCK_INPUT                ((1 << 17) + LOOKAHEAD_SIZE)
+#define LZMA2_BLOCK_INPUT               (LZMA2_UNPACK_SIZE_MAX + LOOKAHEAD_SIZE)
 
 typedef struct {
     PyObject_HEAD
     CLzmaEncHandle encoder;
     CMemoryInOutStream inStream;
     CMemoryOutStream outStream;
+    UInt64 total_in;
+    int lzma2;
+    // buffer for LZMA2 chunks
+    Byte *chunk;
+    Byte propsByte;
+    int needInitState;
+    int needInitProp;
+    // the input stream has reported its end during the last flush
+    int resume;
+    int finished;
+    // xz streams contain the LZMA2 chunks in a single block
+    int xz;
+    CXzCheck check;
+    UInt64 written;
+    UInt64 blockStart;
+    // the encoder and its buffers are used without holding the GIL
+    int busy;
 } CCompressionObject;
 
-static char
+static SRes
+pylzma_comp_write(CCompressionObject *self, const Byte *data, size_t size)
+{
+    if (self->outStream.s.Write((const ISeqOutStream*) &self->outStream, data, size) != size) {
+        return SZ_ERROR_MEM;
+    }
+    self->written += size;
+    return SZ_OK;
+}
+
+// Size of the block header of xz streams with only the LZMA2 filter.
+#define XZ_BLOCK_HEADER_SIZE    12
+// Size of the largest check (SHA-256).
+#define XZ_CHECK_SIZE_MAX       32
+
+// Write the stream header and the header of the block, the sizes of the
+// block are not known in advance (see XzEnc.c of the LZMA SDK).
+static SRes
+pylzma_comp_write_xz_header(CCompressionObject *self, Byte propsByte)
+{
+    Byte header[XZ_STREAM_HEADER_SIZE + XZ_BLOCK_HEADER_SIZE];
+    Byte *block = header + XZ_STREAM_HEADER_SIZE;
+
+    memcpy(header, XZ_SIG, XZ_SIG_SIZE);
+    header[XZ_SIG_SIZE] = 0;
+    header[XZ_SIG_SIZE + 1] = (Byte) self->check.mode;
+    SetUi32(header + XZ_SIG_SIZE + XZ_STREAM_FLAGS_SIZE, CrcCalc(header + XZ_SIG_SIZE, XZ_STREAM_FLAGS_SIZE))
+
+    memset(block, 0, XZ_BLOCK_HEADER_SIZE);
+    block[0] = (XZ_BLOCK_HEADER_SIZE - 4) / 4;
+    block[2] = XZ_ID_LZMA2;
+    block[3] = 1;
+    block[4] = propsByte;
+    SetUi32(block + XZ_BLOCK_HEADER_SIZE - 4, CrcCalc(block, XZ_BLOCK_HEADER_SIZE - 4))
+
+    RINOK(pylzma_comp_write(self, header, sizeof(header)))
+    self->blockStart = self->written;
+    return SZ_OK;
+}
+
+// Finish the block with padding and the check of the uncompressed data and
+// write the index and stream footer.
+static SRes
+pylzma_comp_write_xz_footer(CCompressionObject *self)
+{
+    Byte buffer[3 + XZ_CHECK_SIZE_MAX];
+    Byte index[4 + 2 * 9 + 4 + 4];
+    Byte footer[XZ_STREAM_FOOTER_SIZE];
+    UInt64 packSize = self->written - self->blockStart;
+    unsigned checkSize = XzFlags_GetCheckSize((CXzStreamFlags) self->check.mode);
+    unsigned size = 0;
+    unsigned indexSize = 0;
+
+    while (((packSize + size) & 3) != 0) {
+        buffer[size++] = 0;
+    }
+    XzCheck_Final(&self->check, buffer + size);
+    RINOK(pylzma_comp_write(self, buffer, size + checkSize))
+
+    index[indexSize++] = 0;
+    index[indexSize++] = 1;
+    indexSize += Xz_WriteVarInt(index + indexSize, XZ_BLOCK_HEADER_SIZE + packSize + checkSize);
+    indexSize += Xz_WriteVarInt(index + indexSize, self->total_in);
+    while ((indexSize & 3) != 0) {
+        index[indexSize++] = 0;
+    }
+    SetUi32(index + indexSize, CrcCalc(index, indexSize))
+    indexSize += 4;
+    RINOK(pylzma_comp_write(self, index, indexSize))
+
+    SetUi32(footer + 4, (UInt32) (indexSize / 4 - 1))
+    footer[8] = 0;
+    footer[9] = (Byte) self->check.mode;
+    SetUi32(footer, CrcCalc(footer + 4, 6))
+    footer[10] = XZ_FOOTER_SIG_0;
+    footer[11] = XZ_FOOTER_SIG_1;
+    return pylzma_comp_write(self, footer, sizeof(footer));
+}
+
+// Encode one LZMA2 chunk, see Lzma2EncInt_EncodeSubblock of the LZMA SDK.
+static SRes
+pylzma_comp_encode_chunk(CCompressionObject *self, UInt32 *unpackSizeRes)
+{
+    Byte *outBuf = self->chunk;
+    size_t packSize = LZMA2_CHUNK_SIZE_COMPRESSED_MAX;
+    UInt32 unpackSize = LZMA2_UNPACK_SIZE_MAX;
+    unsigned lzHeaderSize = 5 + (self->needInitProp ? 1 : 0);
+    int first = (LzmaEnc_GetNumProcessed(self->encoder) == 0);
+    BoolInt useCopyBlock;
+    SRes res;
+
+    packSize -= lzHeaderSize;
+    LzmaEnc_SaveState(self->encoder);
+    res = LzmaEnc_CodeOneMemBlock(self->encoder, self->needInitState,
+        outBuf + lzHeaderSize, &packSize, LZMA2_PACK_SIZE_MAX, &unpackSize);
+    *unpackSizeRes = unpackSize;
+    if (unpackSize == 0) {
+        return res;
+    }
+
+    if (res == SZ_OK) {
+        useCopyBlock = (packSize + 2 >= unpackSize || packSize > (1 << 16));
+    } else {
+        if (res != SZ_ERROR_OUTPUT_EOF) {
+            return res;
+        }
+        res = SZ_OK;
+        useCopyBlock = True;
+    }
+
+    if (useCopyBlock) {
+        const Byte *data = LzmaEnc_GetCurBuf(self->encoder) - unpackSize;
+        while (unpackSize > 0) {
+            UInt32 u = min(unpackSize, LZMA2_COPY_CHUNK_SIZE);
+            Byte header[3];
+            header[0] = (Byte) (first ? LZMA2_CONTROL_COPY_RESET_DIC : LZMA2_CONTROL_COPY_NO_RESET);
+            header[1] = (Byte) ((u - 1) >> 8);
+            header[2] = (Byte) (u - 1);
+            RINOK(pylzma_comp_write(self, header, 3))
+            RINOK(pylzma_comp_write(self, data, u))
+            data += u;
+            unpackSize -= u;
+            first = 0;
+        }
+        // the state of the decoder is not changed by uncompressed chunks
+        LzmaEnc_RestoreState(self->encoder);
+        return SZ_OK;
+    }
+
+    {
+        size_t destPos = 0;
+        UInt32 u = unpackSize - 1;
+        UInt32 pm = (UInt32) (packSize - 1);
+        unsigned mode = first ? 3 : (self->needInitState ? (self->needInitProp ? 2 : 1) : 0);
+
+        outBuf[destPos++] = (Byte) (LZMA2_CONTROL_LZMA | (mode << 5) | ((u >> 16) & 0x1F));
+        outBuf[destPos++] = (Byte) (u >> 8);
+        outBuf[destPos++] = (Byte) u;
+        outBuf[destPos++] = (Byte) (pm >> 8);
+        outBuf[destPos++] = (Byte) pm;
+        if (self->needInitProp) {
+            outBuf[destPos++] = self->propsByte;
+        }
+        self->needInitProp = 0;
+        self->needInitState = 0;
+        return pylzma_comp_write(self, outBuf, destPos + packSize);
+    }
+}
+
+// Encode the pending input, must be called without the GIL.
+static SRes
+pylzma_comp_encode(CCompressionObject *self, int flush)
+{
+    UInt64 blockInput = self->lzma2 ? LZMA2_BLOCK_INPUT : LZMA_BLOCK_INPUT;
+    UInt64 pending;
+    UInt32 unpackSize;
+    int encoded = 0;
+    SRes res = SZ_OK;
+
+    while (1) {
+        pending = self->total_in - LzmaEnc_GetNumProcessed(self->encoder);
+        if (pending == 0 || (!flush && pending < blockInput)) {
+            break;
+        }
+
+        if (self->resume) {
+            LzmaEnc_ResumeStream(self->encoder);
+            self->resume = 0;
+        }
+        if (self->lzma2) {
+            res = pylzma_comp_encode_chunk(self, &unpackSize);
+            if (res == SZ_OK && unpackSize == 0) {
+                res = SZ_ERROR_FAIL;
+            }
+        } else {
+            res = LzmaEnc_CodeOneBlock(self->encoder, 0, 0);
+        }
+        if (res != SZ_OK) {
+            break;
+        }
+        encoded = 1;
+    }
+
+    if (res == SZ_OK && flush && encoded && self->lzma2) {
+        // the match finder has seen the end of the available input
+        self->resume = 1;
+    }
+
+    if (res == SZ_OK && flush == FLUSH_FINISH) {
+        if (self->lzma2) {
+            Byte eof = LZMA2_CONTROL_EOF;
+            res = pylzma_comp_write(self, &eof, 1);
+            if (res == SZ_OK && self->xz) {
+                res = pylzma_comp_write_xz_footer(self);
+            }
+        } else {
+            // writes the end marker if enabled
+            while (res == SZ_OK && !LzmaEnc_IsFinished(self->encoder)) {
+                res = LzmaEnc_CodeOneBlock(self->encoder, 0, 0);
+            }
+        }
+        LzmaEnc_Finish(self->encoder);
+        self->finished = 1;
+    }
+    if (res == SZ_ERROR_WRITE) {
+        // the output stream only fails if no more memory is available
+        res = SZ_ERROR_MEM;
+    }
+    return res;
+}
+
+static PyObject *
+pylzma_comp_output(CCompressionObject *self)
+{
+    PyObject *result;
+
+    result = PyBytes_FromStringAndSize((const char *) MemoryOutStreamData(&self->outStream), MemoryOutStreamAvailable(&self->outStream));
+    if (result != NULL) {
+        MemoryOutStreamDiscard(&self->outStream, MemoryOutStreamAvailable(&self->outStream));
+    }
+    return result;
+}
+
+static const char
 doc_comp_compress[] = \
-    "docstring is todo\n";
+    "compress(data) -- Compress data, returning compressed data that is available so far.\n" \
+    "Some input may be kept internally and is returned from later calls to compress or flush.";
 
 static PyObject *
 pylzma_comp_compress(CCompressionObject *self, PyObject *args)
 {
     PyObject *result = NULL;
-    char *data;
-    PARSE_LENGTH_TYPE length;
-    Py_ssize_t bufsize=BLOCK_SIZE;
-    int res;
-    size_t before;
+    Py_buffer data;
+    SRes res;
 
-    if (!PyArg_ParseTuple(args, "s#|n", &data, &length, &bufsize))
+    if (!PyArg_ParseTuple(args, "s*", &data))
         return NULL;
 
-    if (!MemoryInOutStreamAppend(&self->inStream, (Byte *) data, length)) {
-        return PyErr_NoMemory();
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "compressobj is used by another thread");
+        goto exit;
     }
 
+    if (self->finished) {
+        PyErr_SetString(PyExc_ValueError, "compressobj has already been finished");
+        goto exit;
+    }
+
+    if (!MemoryInOutStreamAppend(&self->inStream, (const Byte *) data.buf, data.len)) {
+        PyErr_NoMemory();
+        goto exit;
+    }
+    self->total_in += data.len;
+
+    self->busy = 1;
     Py_BEGIN_ALLOW_THREADS
-    while (1) {
-        before = self->inStream.avail;
-        res = LzmaEnc_CodeOneBlock(self->encoder, False, 0, 0);
-        if (res != SZ_OK || self->outStream.size >= bufsize || self->inStream.avail == before) {
-            break;
-        }
+    if (self->xz) {
+        XzCheck_Update(&self->check, data.buf, (size_t) data.len);
     }
+    res = pylzma_comp_encode(self, 0);
     Py_END_ALLOW_THREADS
+    self->busy = 0;
     if (res != SZ_OK) {
-        PyErr_Format(PyExc_TypeError, "Error during compressing: %d", res);
-        return NULL;
+        pylzma_set_compression_error(res);
+        goto exit;
     }
 
-    length = min(self->outStream.size, (size_t)bufsize);
-    result = PyString_FromStringAndSize((const char *)self->outStream.data, length);
-    if (result != NULL) {
-        MemoryOutStreamDiscard(&self->outStream, length);
-    }
+    result = pylzma_comp_output(self);
 
+exit:
+    PyBuffer_Release(&data);
     return result;
 }
 
-static char
+static const char
 doc_comp_flush[] = \
-    "flush() -- Finishes the compression and returns any remaining compressed data.";
+    "flush(mode=FLUSH_FINISH) -- Compress the pending input and return the remaining compressed data.\n" \
+    "FLUSH_FINISH finishes the stream, FLUSH_SYNC (only for lzma2) ends the current chunk so the receiver " \
+    "can decompress all data passed so far and allows compressing more data afterwards.";
 
 static PyObject *
 pylzma_comp_flush(CCompressionObject *self, PyObject *args)
 {
-    PyObject *result;
-    int res;
+    int mode = FLUSH_FINISH;
+    SRes res;
 
-    Py_BEGIN_ALLOW_THREADS
-    while (1) {
-        res = LzmaEnc_CodeOneBlock(self->encoder, False, 0, 0);
-        if (res != SZ_OK || LzmaEnc_IsFinished(self->encoder)) {
-            break;
-        }
+    if (!PyArg_ParseTuple(args, "|i", &mode))
+        return NULL;
+
+    if (mode != FLUSH_SYNC && mode != FLUSH_FINISH) {
+        PyErr_SetString(PyExc_ValueError, "mode must be FLUSH_SYNC or FLUSH_FINISH");
+        return NULL;
     }
-    Py_END_ALLOW_THREADS
-    if (res != SZ_OK) {
-        PyErr_Format(PyExc_TypeError, "Error during compressing: %d", res);
+
+    if (mode == FLUSH_SYNC && !self->lzma2) {
+        // LZMA streams can't be flushed without ending them
+        PyErr_SetString(PyExc_ValueError, "FLUSH_SYNC is only supported for lzma2 and format 'xz'");
         return NULL;
     }
 
-    LzmaEnc_Finish(self->encoder);
-    result = PyString_FromStringAndSize((const char *) self->outStream.data, self->outStream.size);
-    if (result != NULL) {
-        MemoryOutStreamDiscard(&self->outStream, self->outStream.size);
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "compressobj is used by another thread");
+        return NULL;
     }
 
-    return result;
+    if (self->finished) {
+        PyErr_SetString(PyExc_ValueError, "compressobj has already been finished");
+        return NULL;
+    }
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    res = pylzma_comp_encode(self, mode);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+    if (res != SZ_OK) {
+        pylzma_set_compression_error(res);
+        return NULL;
+    }
+
+    return pylzma_comp_output(self);
 }
 
-PyMethodDef
+static PyMethodDef
 pylzma_comp_methods[] = {
-    {"compress",   (PyCFunction)pylzma_comp_compress, METH_VARARGS, doc_comp_compress},
-    {"flush",      (PyCFunction)pylzma_comp_flush,    METH_NOARGS,  doc_comp_flush},
+    {"compress",   (PyCFunction)pylzma_comp_compress, METH_VARARGS, (char *)&doc_comp_compress},
+    {"flush",      (PyCFunction)pylzma_comp_flush,    METH_VARARGS, (char *)&doc_comp_flush},
     {NULL, NULL},
 };
 
 static void
 pylzma_comp_dealloc(CCompressionObject *self)
 {
-    LzmaEnc_Destroy(self->encoder, &allocator, &allocator);
+    if (self->encoder != NULL) {
+        LzmaEnc_Destroy(self->encoder, &allocator, &allocator);
+    }
     if (self->outStream.data != NULL) {
         free(self->outStream.data);
     }
-    if (self->inStream.data != NULL) {
-        free(self->inStream.data);
-    }
-    self->ob_type->tp_free((PyObject*)self);
+    FreeMemoryInOutStream(&self->inStream);
+    FREE_AND_NULL(self->chunk);
+    Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
-int
+static int
 pylzma_comp_init(CCompressionObject *self, PyObject *args, PyObject *kwargs)
 {
+    CCompressionOptions options;
     CLzmaEncProps props;
-    Byte header[LZMA_PROPS_SIZE];
+    Byte header[ALONE_HEADER_SIZE];
     size_t headerSize = LZMA_PROPS_SIZE;
-    int result=-1;
+    int res;
 
     // possible keywords for this function
-    static char *kwlist[] = {"dictionary", "fastBytes", "literalContextBits",
-                             "literalPosBits", "posBits", "algorithm", "eos", "multithreading", "matchfinder", NULL};
-    int dictionary = 23;         // [0,28], default 23 (8MB)
-    int fastBytes = 128;         // [5,255], default 128
-    int literalContextBits = 3;  // [0,8], default 3
-    int literalPosBits = 0;      // [0,4], default 0
-    int posBits = 2;             // [0,4], default 2
-    int eos = 1;                 // write "end of stream" marker?
-    int multithreading = 1;      // use multithreading if available?
-    char *matchfinder = NULL;    // matchfinder algorithm
-    int algorithm = 2;
-    int res;
+    static char *kwlist[] = {COMPRESSION_OPTIONS_KWLIST, NULL};
+
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "compressobj is used by another thread");
+        return -1;
+    }
+
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|" COMPRESSION_OPTIONS_FORMAT, kwlist,
+                                                                 COMPRESSION_OPTIONS_ARGS(options)))
+        return -1;
+
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        return -1;
+    }
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iiiiiiiis", kwlist, &dictionary, &fastBytes,
-                                                                 &literalContextBits, &literalPosBits, &posBits, &algorithm, &eos, &multithreading, &matchfinder))
+    if (options.threads > 1 || options.block_size > 0) {
+        PyErr_SetString(PyExc_ValueError, "threads and block_size are not supported for compressobj");
         return -1;
+    }
 
-    CHECK_RANGE(dictionary,         0,  28, "dictionary must be between 0 and 28");
-    CHECK_RANGE(fastBytes,          5, 255, "fastBytes must be between 5 and 255");
-    CHECK_RANGE(literalContextBits, 0,   8, "literalContextBits must be between 0 and 8");
-    CHECK_RANGE(literalPosBits,     0,   4, "literalPosBits must be between 0 and 4");
-    CHECK_RANGE(posBits,            0,   4, "posBits must be between 0 and 4");
+    if (options.container == FORMAT_ALONE && !options.eos) {
+        PyErr_SetString(PyExc_ValueError, "format 'alone' requires eos if the size is not known");
+        return -1;
+    }
 
-    if (matchfinder != NULL) {
-#if (PY_VERSION_HEX >= 0x02050000)
-        PyErr_WarnEx(PyExc_DeprecationWarning, "matchfinder selection is deprecated and will be ignored", 1);
-#else
-        PyErr_Warn(PyExc_DeprecationWarning, "matchfinder selection is deprecated and will be ignored");
-#endif
+    if ((options.lzma2 || options.container == FORMAT_XZ) && props.lc + props.lp > LZMA2_LCLP_MAX) {
+        PyErr_SetString(PyExc_ValueError, "literalContextBits + literalPosBits must not be greater than 4 for lzma2");
+        return -1;
+    }
+
+    // the match finder thread would read ahead of the available input
+    props.numThreads = 1;
+
+    if (self->encoder != NULL) {
+        PyErr_SetString(PyExc_TypeError, "compressobj has already been initialized");
+        return -1;
     }
 
     self->encoder = LzmaEnc_Create(&allocator);
@@ -179,47 +483,77 @@ pylzma_comp_init(CCompressionObject *self, PyObject *args, PyObject *kwargs)
         return -1;
     }
 
-    LzmaEncProps_Init(&props);
-
-    props.dictSize = 1 << dictionary;
-    props.lc = literalContextBits;
-    props.lp = literalPosBits;
-    props.pb = posBits;
-    props.algo = algorithm;
-    props.fb = fastBytes;
-    // props.btMode = 1;
-    // props.numHashBytes = 4;
-    // props.mc = 32;
-    props.writeEndMark = eos ? 1 : 0;
-    props.numThreads = multithreading ? 2 : 1;
-    LzmaEncProps_Normalize(&props);
     res = LzmaEnc_SetProps(self->encoder, &props);
     if (res != SZ_OK) {
-        PyErr_Format(PyExc_TypeError, "could not set encoder properties: %d", res);
+        pylzma_set_compression_error(res);
         return -1;
     }
 
     CreateMemoryInOutStream(&self->inStream);
     CreateMemoryOutStream(&self->outStream);
+    if (self->outStream.data == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->total_in = 0;
+    self->lzma2 = options.lzma2 || options.container == FORMAT_XZ;
+    self->resume = 0;
+    self->finished = 0;
+    self->xz = options.container == FORMAT_XZ;
+    XzCheck_Init(&self->check, (unsigned) options.checkId);
+    self->written = 0;
 
     LzmaEnc_WriteProperties(self->encoder, header, &headerSize);
-    if (self->outStream.s.Write(&self->outStream, header, headerSize) != headerSize) {
-        PyErr_SetString(PyExc_TypeError, "could not generate stream header");
-        goto exit;
+    if (options.container == FORMAT_ALONE) {
+        // the size of the input is not known in advance
+        SetUi64(header + headerSize, ALONE_UNKNOWN_SIZE);
+        headerSize += 8;
     }
+    if (self->lzma2) {
+        UInt32 dictSize = LzmaEncProps_GetDictSize(&props);
+        Byte prop;
 
-    LzmaEnc_Prepare(self->encoder, &self->inStream.s, &self->outStream.s, &allocator, &allocator);
-    result = 0;
+        for (prop = 0; prop < 40; prop++) {
+            if (dictSize <= LZMA2_DIC_SIZE_FROM_PROP(prop)) {
+                break;
+            }
+        }
 
-exit:
-    return result;
+        self->chunk = (Byte *) malloc(LZMA2_CHUNK_SIZE_COMPRESSED_MAX);
+        if (self->chunk == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->propsByte = header[0];
+        self->needInitState = 1;
+        self->needInitProp = 1;
+        if (self->xz) {
+            res = pylzma_comp_write_xz_header(self, prop);
+        } else {
+            res = pylzma_comp_write(self, &prop, 1);
+        }
+        if (res == SZ_OK) {
+            res = LzmaEnc_PrepareForLzma2(self->encoder, &self->inStream.s, LZMA2_KEEP_WINDOW_SIZE, &allocator, &allocator);
+        }
+        // chunks may be ended at any position by FLUSH_SYNC
+        LzmaEnc_SetResumable(self->encoder);
+    } else {
+        res = pylzma_comp_write(self, header, headerSize);
+        if (res == SZ_OK) {
+            res = LzmaEnc_Prepare(self->encoder, &self->outStream.s, &self->inStream.s, &allocator, &allocator);
+        }
+    }
+    if (res != SZ_OK) {
+        pylzma_set_compression_error(res);
+        return -1;
+    }
+
+    return 0;
 }
 
 PyTypeObject
 CCompressionObject_Type = {
-    //PyObject_HEAD_INIT(&PyType_Type)
-    PyObject_HEAD_INIT(NULL)
-    0,
+    PyVarObject_HEAD_INIT(NULL, 0)
     "pylzma.compressobj",                /* char *tp_name; */
     sizeof(CCompressionObject),          /* int tp_basicsize; */
     0,                                   /* int tp_itemsize;       // not used much */
@@ -239,7 +573,7 @@ CCompressionObject_Type = {
     0,                                   /* tp_setattro*/
     0,                                   /* tp_as_buffer*/
     Py_TPFLAGS_DEFAULT,  /*tp_flags*/
-    "Compression class",                 /* tp_doc */
+    "Streaming compression class",       /* tp_doc */
     0,                                   /* tp_traverse */
     0,                                   /* tp_clear */
     0,                                   /* tp_richcompare */
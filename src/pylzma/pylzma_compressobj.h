@@ -26,10 +26,12 @@
 #ifndef ___PYLZMA_COMPRESSOBJ__H___
 #define ___PYLZMA_COMPRESSOBJ__H___
 
+// Values of the "mode" parameter of compressobj.flush, same as in zlib.
+#define FLUSH_SYNC      2
+#define FLUSH_FINISH    4
+
 extern PyTypeObject CCompressionObject_Type;
 
 #define CompressionObject_Check(v)   ((v)->ob_type == &CCompressionObject_Type)
 
-PyObject *pylzma_compressobj(PyObject *self, PyObject *args);
-
 #endif
@@ -0,0 +1,175 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+#include <Python.h>
+
+#include "pylzma.h"
+#include "pylzma_compress.h"
+#include "pylzma_compressor.h"
+
+static int
+pylzma_compressor_init(CCompressorObject *self, PyObject *args, PyObject *kwargs)
+{
+    CCompressionOptions options;
+    CLzmaEncProps props;
+    // possible keywords for this function
+    static char *kwlist[] = {COMPRESSION_OPTIONS_KWLIST, NULL};
+
+    if (self->busy) {
+        // the encoder is used without holding the GIL
+        PyErr_SetString(PyExc_RuntimeError, "compressor is used by another thread");
+        return -1;
+    }
+
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|" COMPRESSION_OPTIONS_FORMAT, kwlist,
+                                                       COMPRESSION_OPTIONS_ARGS(options)))
+        return -1;
+
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        return -1;
+    }
+
+    if (self->initialized) {
+        pylzma_free_buffer_encoder(&self->encoder);
+    }
+    pylzma_init_buffer_encoder(&self->encoder, &options, &props);
+    self->initialized = 1;
+    return 0;
+}
+
+static const char
+doc_compressor_compress[] = \
+    "compress(data) -- Compress the data, returning a string containing the compressed data.\n" \
+    "Every call creates a complete stream that can be decompressed on its own.";
+
+static PyObject *
+pylzma_compressor_compress(CCompressorObject *self, PyObject *args)
+{
+    PyObject *result = NULL;
+    Py_buffer data;
+    size_t length;
+    SRes res;
+
+    if (!PyArg_ParseTuple(args, "s*", &data))
+        return NULL;
+
+    if (!self->initialized) {
+        PyErr_SetString(PyExc_RuntimeError, "compressor is not initialized");
+        goto exit;
+    }
+
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "compressor is used by another thread");
+        goto exit;
+    }
+
+    length = pylzma_max_compressed_size((size_t) data.len);
+    if (length > PY_SSIZE_T_MAX) {
+        PyErr_NoMemory();
+        goto exit;
+    }
+
+    result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) length);
+    if (result == NULL) {
+        goto exit;
+    }
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    res = pylzma_buffer_encoder_compress(&self->encoder, (Byte *) PyBytes_AS_STRING(result), &length,
+        (const Byte *) data.buf, (size_t) data.len, NULL);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+    if (res != SZ_OK) {
+        DEC_AND_NULL(result);
+        pylzma_set_compression_error(res);
+        goto exit;
+    }
+
+    _PyBytes_Resize(&result, (Py_ssize_t) length);
+
+exit:
+    PyBuffer_Release(&data);
+    return result;
+}
+
+static PyMethodDef
+pylzma_compressor_methods[] = {
+    {"compress",   (PyCFunction)pylzma_compressor_compress, METH_VARARGS, (char *)&doc_compressor_compress},
+    {NULL},
+};
+
+static void
+pylzma_compressor_dealloc(CCompressorObject *self)
+{
+    if (self->initialized) {
+        pylzma_free_buffer_encoder(&self->encoder);
+    }
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+PyTypeObject
+CCompressorObject_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pylzma.Compressor",                 /* char *tp_name; */
+    sizeof(CCompressorObject),           /* int tp_basicsize; */
+    0,                                   /* int tp_itemsize;       // not used much */
+    (destructor)pylzma_compressor_dealloc, /* destructor tp_dealloc; */
+    PYLZMA_TP_PRINT,                     /* printfunc  tp_print;   */
+    NULL,                                /* getattrfunc  tp_getattr; // __getattr__ */
+    NULL,                                /* setattrfunc  tp_setattr;  // __setattr__ */
+    NULL,                                /* cmpfunc  tp_compare;  // __cmp__ */
+    NULL,                                /* reprfunc  tp_repr;    // __repr__ */
+    NULL,                                /* PyNumberMethods *tp_as_number; */
+    NULL,                                /* PySequenceMethods *tp_as_sequence; */
+    NULL,                                /* PyMappingMethods *tp_as_mapping; */
+    NULL,                                /* hashfunc tp_hash;     // __hash__ */
+    NULL,                                /* ternaryfunc tp_call;  // __call__ */
+    NULL,                                /* reprfunc tp_str;      // __str__ */
+    0,                                   /* tp_getattro*/
+    0,                                   /* tp_setattro*/
+    0,                                   /* tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                  /*tp_flags*/
+    "Compressor(**options) -- Compress independent messages with the same options, reusing the memory of the encoder.\n" \
+    "Takes the same options as compress. Instances are not thread-safe and must not be used from multiple threads concurrently.", /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    pylzma_compressor_methods,           /* tp_methods */
+    0,                                   /* tp_members */
+    0,                                   /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)pylzma_compressor_init,    /* tp_init */
+    0,                                   /* tp_alloc */
+    0,                                   /* tp_new */
+};
@@ -25,98 +25,527 @@
 
 #include <Python.h>
 
+#include "../sdk/C/7zCrc.h"
+#include "../sdk/C/CpuArch.h"
 #include "../sdk/C/LzmaDec.h"
 #include "../sdk/C/Lzma2Dec.h"
+#include "../sdk/C/Lzma2DecMt.h"
+#include "../sdk/C/Xz.h"
 
 #include "pylzma.h"
+#include "pylzma_decompress.h"
+#include "pylzma_pool.h"
 #include "pylzma_streams.h"
 
+// Guess the size of the decompressed data from the size of the input.
+static size_t
+pylzma_guess_output_size(size_t srcLen)
+{
+    if (srcLen < BLOCK_SIZE / 4) {
+        return BLOCK_SIZE / 16;
+    }
+    return srcLen <= (size_t) PY_SSIZE_T_MAX / 4 ? srcLen * 4 : (size_t) PY_SSIZE_T_MAX;
+}
+
+static SRes
+pylzma_buffer_decoder_start(CBufferDecoder *decoder, const Byte **src, size_t *srcLen)
+{
+    size_t propertiesLength = decoder->lzma2 ? 1 : LZMA_PROPS_SIZE;
+    SRes res;
+
+    if (*srcLen < propertiesLength) {
+        return SZ_ERROR_INPUT_EOF;
+    }
+
+    // dictionary and probabilities are only reallocated if the properties change
+    if (decoder->lzma2) {
+        res = Lzma2Dec_Allocate(&decoder->state.lzma2, (*src)[0], &allocator);
+    } else {
+        res = LzmaDec_Allocate(&decoder->state.lzma, *src, (unsigned) propertiesLength, &allocator);
+    }
+    if (res != SZ_OK) {
+        return res;
+    }
+
+    *src += propertiesLength;
+    *srcLen -= propertiesLength;
+    if (decoder->lzma2) {
+        Lzma2Dec_Init(&decoder->state.lzma2);
+    } else {
+        LzmaDec_Init(&decoder->state.lzma);
+    }
+    return SZ_OK;
+}
+
+// Decompress until "capacity" bytes are in "dest" or the stream ended, which
+// sets "finished". Can be called without holding the GIL.
+static SRes
+pylzma_buffer_decoder_fill(CBufferDecoder *decoder, Byte *dest, size_t *destLen, size_t capacity, const Byte **src, size_t *srcLen, int *finished)
+{
+    size_t inSize, outSize;
+    ELzmaStatus status;
+    SRes res = SZ_OK;
+
+    *finished = 0;
+    while (*destLen < capacity) {
+        inSize = *srcLen;
+        outSize = capacity - *destLen;
+        if (decoder->lzma2) {
+            res = Lzma2Dec_DecodeToBuf(&decoder->state.lzma2, dest + *destLen, &outSize, *src, &inSize, LZMA_FINISH_ANY, &status);
+        } else {
+            res = LzmaDec_DecodeToBuf(&decoder->state.lzma, dest + *destLen, &outSize, *src, &inSize, LZMA_FINISH_ANY, &status);
+        }
+        *src += inSize;
+        *srcLen -= inSize;
+        *destLen += outSize;
+        if (res != SZ_OK || status == LZMA_STATUS_FINISHED_WITH_MARK) {
+            *finished = 1;
+            break;
+        }
+        if (status == LZMA_STATUS_NEEDS_MORE_INPUT) {
+            res = SZ_ERROR_INPUT_EOF;
+            *finished = 1;
+            break;
+        }
+        if (*srcLen == 0 && outSize == 0) {
+            // stream without end marker
+            *finished = 1;
+            break;
+        }
+    }
+    return res;
+}
+
+// Output of the multithreaded decoders, written directly to the result string.
+// If the size is not known, the string grows geometrically while holding the
+// GIL as the data is written by the worker threads.
+typedef struct {
+    ISeqOutStream s;
+    PyObject *result;
+    size_t pos;
+    size_t size;
+    int grow;
+    int overflow;
+} CDecoderOutput;
+
+static int
+pylzma_decoder_output_grow(CDecoderOutput *output, size_t size)
+{
+    size_t capacity = output->size;
+    PyGILState_STATE state;
+    int res;
+
+    if (size > (size_t) PY_SSIZE_T_MAX - output->pos) {
+        return 0;
+    }
+    while (capacity < output->pos + size) {
+        capacity = capacity > (size_t) PY_SSIZE_T_MAX / 2 ? (size_t) PY_SSIZE_T_MAX : capacity * 2;
+    }
+
+    state = PyGILState_Ensure();
+    res = _PyBytes_Resize(&output->result, (Py_ssize_t) capacity);
+    if (res != 0) {
+        // reported as SZ_ERROR_MEM by the decoder
+        PyErr_Clear();
+    }
+    PyGILState_Release(state);
+    if (res != 0) {
+        return 0;
+    }
+    output->size = capacity;
+    return 1;
+}
+
+static size_t
+DecoderOutput_Write(const ISeqOutStream *p, const void *buf, size_t size)
+{
+    CDecoderOutput *self = (CDecoderOutput *) p;
+    if (size > self->size - self->pos) {
+        if (!self->grow) {
+            self->overflow = 1;
+            size = self->size - self->pos;
+        } else if (!pylzma_decoder_output_grow(self, size)) {
+            return 0;
+        }
+    }
+    memcpy(PyBytes_AS_STRING(self->result) + self->pos, buf, size);
+    self->pos += size;
+    return size;
+}
+
+// The result string is allocated with "size" or guessed from "srcLen" if the
+// size is (UInt64) -1.
+static ISeqOutStreamPtr
+pylzma_decoder_output_init(CDecoderOutput *output, UInt64 size, size_t srcLen)
+{
+    output->s.Write = DecoderOutput_Write;
+    output->pos = 0;
+    output->overflow = 0;
+    output->grow = size == (UInt64) -1;
+    if (output->grow) {
+        size = pylzma_guess_output_size(srcLen);
+    } else if (size > (UInt64) PY_SSIZE_T_MAX) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    output->size = (size_t) size;
+    output->result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) size);
+    if (output->result == NULL) {
+        return NULL;
+    }
+    return &output->s;
+}
+
+// Return the decompressed data or set the exception for "res". If "exact" is
+// set, the data must have the size passed to "pylzma_decoder_output_init".
+static PyObject *
+pylzma_decoder_output_finish(CDecoderOutput *output, SRes res, int exact)
+{
+    PyObject *result = output->result;
+
+    if (res == SZ_ERROR_WRITE) {
+        // the output didn't fit into the expected size or the result string
+        // couldn't grow
+        res = result != NULL ? SZ_ERROR_ARCHIVE : SZ_ERROR_MEM;
+    }
+    if (res == SZ_OK && (output->overflow || (exact && output->pos < output->size))) {
+        res = SZ_ERROR_ARCHIVE;
+    }
+    if (res != SZ_OK) {
+        Py_XDECREF(result);
+        pylzma_set_decompression_error(res);
+        return NULL;
+    }
+    if (output->pos < output->size) {
+        _PyBytes_Resize(&result, (Py_ssize_t) output->pos);
+    }
+    return result;
+}
+
+// Decompress xz streams, the output is allocated with the size from the index
+// at the end of the streams if it can be read.
+static PyObject *
+pylzma_decompress_xz(Byte *data, size_t length, Py_ssize_t maxlength, unsigned threads, UInt64 memlimit)
+{
+    CMemoryLookInStream lookStream;
+    CMemoryInStream inStream;
+    CDecoderOutput output;
+    ISeqOutStreamPtr outStream;
+    CXzs xzs;
+    CXzStatInfo stat;
+    Int64 offset;
+    UInt64 size, outSize;
+    int isMT;
+    SRes res;
+
+    Xzs_Construct(&xzs);
+    CreateMemoryLookInStream(&lookStream, data, length);
+    Py_BEGIN_ALLOW_THREADS
+    res = Xzs_ReadBackward(&xzs, &lookStream.s, &offset, NULL, &allocator);
+    Py_END_ALLOW_THREADS
+    // garbage or padding that is not a multiple of 4 bytes after the streams
+    // hide the index, the data is then decoded until it is no longer valid
+    size = res == SZ_OK ? Xzs_GetUnpackSize(&xzs) : (UInt64) -1;
+    Xzs_Free(&xzs, &allocator);
+
+    outSize = maxlength != -1 ? (UInt64) maxlength : (UInt64) -1;
+    outStream = pylzma_decoder_output_init(&output, size < outSize ? size : outSize, length);
+    if (outStream == NULL) {
+        return NULL;
+    }
+
+    CreateMemoryInStream(&inStream, data, length);
+    Py_BEGIN_ALLOW_THREADS
+    res = pylzma_xz_decode(&inStream.s, outStream, maxlength != -1 ? &outSize : NULL, threads, memlimit, &stat, &isMT);
+    Py_END_ALLOW_THREADS
+    return pylzma_decoder_output_finish(&output, res, size != (UInt64) -1);
+}
+
+// Decompress a LZMA2 stream using multiple threads, the output is allocated
+// with "maxlength" if given.
+static PyObject *
+pylzma_decompress_lzma2_mt(Byte *data, size_t length, Py_ssize_t maxlength, unsigned threads, UInt64 memlimit)
+{
+    CMemoryInStream inStream;
+    CDecoderOutput output;
+    ISeqOutStreamPtr outStream;
+    UInt64 outSize = (UInt64) maxlength;
+    int isMT;
+    SRes res;
+
+    outStream = pylzma_decoder_output_init(&output, maxlength != -1 ? outSize : (UInt64) -1, length - 1);
+    if (outStream == NULL) {
+        return NULL;
+    }
+
+    CreateMemoryInStream(&inStream, data + 1, length - 1);
+    Py_BEGIN_ALLOW_THREADS
+    res = pylzma_lzma2_decode(data[0], &inStream.s, outStream, maxlength != -1 ? &outSize : NULL, threads, memlimit, &isMT);
+    Py_END_ALLOW_THREADS
+    return pylzma_decoder_output_finish(&output, res, 0);
+}
+
 const char
 doc_decompress[] = \
-    "decompress(data[, maxlength]) -- Decompress the data, returning a string containing the decompressed data. "\
+    "decompress(data[, maxlength][, lzma2][, format][, threads][, memlimit]) -- Decompress the data, returning a string containing the decompressed data. "\
+    "If the string has been compressed without an EOS marker, you must provide the maximum length as keyword parameter.\n" \
+    "decompress(data, bufsize[, maxlength]) -- Decompress the data using an initial output buffer of size bufsize "\
+    "(by default guessed from the size of the compressed data), the buffer grows as needed. "\
     "If the string has been compressed without an EOS marker, you must provide the maximum length as keyword parameter.\n" \
-    "decompress(data, bufsize[, maxlength]) -- Decompress the data using an initial output buffer of size bufsize. "\
-    "If the string has been compressed without an EOS marker, you must provide the maximum length as keyword parameter.\n";
+    "If format is 'alone', the data must start with the header of .lzma files. If the header contains the size of the "\
+    "decompressed data, it is used instead of maxlength.\n" \
+    "If format is 'xz', the data may contain concatenated .xz streams. Blocks that store their sizes in the block " \
+    "header are decoded in parallel by up to threads threads (0 uses one thread per processor) that buffer at most " \
+    "memlimit bytes, other streams are decoded by a single thread.\n" \
+    "If lzma2 is set, threads decode the blocks of streams compressed with threads or block_size in parallel.\n";
 
 PyObject *
 pylzma_decompress(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+    Py_buffer buffer;
     unsigned char *data;
     Byte *tmp;
     Py_ssize_t length;
-    int bufsize=BLOCK_SIZE;
+    int bufsize=0;
     Py_ssize_t totallength=-1;
     int lzma2 = 0;
-    Py_ssize_t avail;
+    const char *formatName = NULL;
+    int format;
+    int exact = 0;
     PyObject *result=NULL;
-    union {
-        CLzmaDec lzma;
-        CLzma2Dec lzma2;
-    } state;
+    CBufferDecoder decoder;
+    const Byte *src;
     ELzmaStatus status;
-    size_t srcLen, destLen;
+    size_t srcLen, destLen, capacity;
+    int finished;
     int res;
-    CMemoryOutStream outStream;
     int propertiesLength;
+    int headerLength;
+    int threads = 1;
+    PY_LONG_LONG memlimit = 0;
     // possible keywords for this function
-    static char *kwlist[] = {"data", "bufsize", "maxlength", "lzma2", NULL};
+    static char *kwlist[] = {"data", "bufsize", "maxlength", "lzma2", "format", "threads", "memlimit", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|iniziL", kwlist, &buffer, &bufsize, &totallength, &lzma2, &formatName, &threads, &memlimit))
+        return NULL;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|ini", kwlist, &data, &length, &bufsize, &totallength, &lzma2))
+    format = pylzma_parse_format(formatName, lzma2);
+    if (format < 0 || pylzma_parse_decoder_threads(&threads, memlimit, format, lzma2) != 0) {
+        PyBuffer_Release(&buffer);
         return NULL;
+    }
 
+    if (format == FORMAT_XZ) {
+        result = pylzma_decompress_xz((Byte *) buffer.buf, (size_t) buffer.len, totallength, (unsigned) threads, (UInt64) memlimit);
+        PyBuffer_Release(&buffer);
+        return result;
+    }
+
+    data = (unsigned char *) buffer.buf;
+    length = buffer.len;
     propertiesLength = lzma2 ? 1 : LZMA_PROPS_SIZE;
+    headerLength = format == FORMAT_ALONE ? ALONE_HEADER_SIZE : propertiesLength;
+    if (length < headerLength) {
+        pylzma_set_decompression_error(SZ_ERROR_INPUT_EOF);
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    if (lzma2 && threads > 1) {
+        result = pylzma_decompress_lzma2_mt(data, (size_t) length, totallength, (unsigned) threads, (UInt64) memlimit);
+        PyBuffer_Release(&buffer);
+        return result;
+    }
+
+    if (format == FORMAT_ALONE) {
+        UInt64 size = GetUi64(data + LZMA_PROPS_SIZE);
+        if (size != ALONE_UNKNOWN_SIZE) {
+            if (size > (UInt64) PY_SSIZE_T_MAX) {
+                PyBuffer_Release(&buffer);
+                return PyErr_NoMemory();
+            }
+            // the stream must contain the size from the header
+            if (totallength == -1 || (UInt64) totallength >= size) {
+                totallength = (Py_ssize_t) size;
+                exact = 1;
+            }
+        }
+    }
 
     if (totallength != -1) {
         // We know the decompressed size, run simple case
         result = PyBytes_FromStringAndSize(NULL, totallength);
         if (result == NULL) {
+            PyBuffer_Release(&buffer);
             return NULL;
         }
 
         tmp = (Byte *) PyBytes_AS_STRING(result);
-        srcLen = length - propertiesLength;
+        srcLen = length - headerLength;
         destLen = (size_t)totallength;
         Py_BEGIN_ALLOW_THREADS
         if (lzma2) {
-            res = Lzma2Decode(tmp, &destLen, (Byte *) (data + propertiesLength), &srcLen, data[0], LZMA_FINISH_ANY, &status, &allocator);
+            res = Lzma2Decode(tmp, &destLen, (Byte *) (data + headerLength), &srcLen, data[0], LZMA_FINISH_ANY, &status, &allocator);
         } else {
-            res = LzmaDecode(tmp, &destLen, (Byte *) (data + propertiesLength), &srcLen, data, propertiesLength, LZMA_FINISH_ANY, &status, &allocator);
+            res = LzmaDecode(tmp, &destLen, (Byte *) (data + headerLength), &srcLen, data, propertiesLength, LZMA_FINISH_ANY, &status, &allocator);
         }
         Py_END_ALLOW_THREADS
+        if (res == SZ_OK && exact && destLen < (size_t) totallength) {
+            res = SZ_ERROR_INPUT_EOF;
+        }
         if (res != SZ_OK) {
             Py_DECREF(result);
             result = NULL;
-            PyErr_Format(PyExc_TypeError, "Error while decompressing: %d", res);
+            if (exact) {
+                pylzma_set_decompression_error(res);
+            } else {
+                PyErr_Format(PyExc_TypeError, "Error while decompressing: %d", res);
+            }
         } else if (destLen < (size_t) totallength) {
             _PyBytes_Resize(&result, destLen);
         }
+        PyBuffer_Release(&buffer);
         return result;
     }
 
-    CreateMemoryOutStream(&outStream);
-    tmp = (Byte *) malloc(bufsize);
-    if (tmp == NULL) {
-        return PyErr_NoMemory();
+    // The size is unknown, decompress into a string that grows geometrically,
+    // starting with a guess based on the compressed size.
+    pylzma_init_buffer_decoder(&decoder, lzma2);
+    src = data;
+    srcLen = (size_t) propertiesLength;
+    res = pylzma_buffer_decoder_start(&decoder, &src, &srcLen);
+    if (res != SZ_OK) {
+        pylzma_set_decompression_error(res);
+        goto exit;
     }
+    src = data + headerLength;
+    srcLen = (size_t) (length - headerLength);
 
-    if (lzma2) {
-        Lzma2Dec_Construct(&state.lzma2);
-        res = Lzma2Dec_Allocate(&state.lzma2, data[0], &allocator);
-        if (res != SZ_OK) {
-            PyErr_SetString(PyExc_TypeError, "Incorrect stream properties");
+    capacity = bufsize > 0 ? (size_t) bufsize : pylzma_guess_output_size(srcLen);
+    result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) capacity);
+    if (result == NULL) {
+        goto exit;
+    }
+
+    destLen = 0;
+    for (;;) {
+        Py_BEGIN_ALLOW_THREADS
+        res = pylzma_buffer_decoder_fill(&decoder, (Byte *) PyBytes_AS_STRING(result), &destLen, capacity, &src, &srcLen, &finished);
+        Py_END_ALLOW_THREADS
+        if (res != SZ_OK || finished) {
+            break;
+        }
+
+        if (capacity > (size_t) PY_SSIZE_T_MAX / 2) {
+            if (capacity == (size_t) PY_SSIZE_T_MAX) {
+                res = SZ_ERROR_MEM;
+                break;
+            }
+            capacity = (size_t) PY_SSIZE_T_MAX;
+        } else {
+            capacity *= 2;
+        }
+        if (_PyBytes_Resize(&result, (Py_ssize_t) capacity) != 0) {
             goto exit;
         }
-    } else {
-        LzmaDec_Construct(&state.lzma);
-        res = LzmaDec_Allocate(&state.lzma, data, propertiesLength, &allocator);
-        if (res != SZ_OK) {
-            PyErr_SetString(PyExc_TypeError, "Incorrect stream properties");
+    }
+
+    if (res != SZ_OK) {
+        DEC_AND_NULL(result);
+        pylzma_set_decompression_error(res);
+    } else if (destLen < capacity) {
+        _PyBytes_Resize(&result, (Py_ssize_t) destLen);
+    }
+
+exit:
+    pylzma_free_buffer_decoder(&decoder);
+    PyBuffer_Release(&buffer);
+
+    return result;
+}
+
+const char
+doc_verify[] = \
+    "verify(data[, maxlength][, lzma2][, crc32]) -- Decompress the data without keeping the output, returning the size " \
+    "of the decompressed data. If crc32 is given, the CRC32 of the decompressed data is compared to it.\n" \
+    "If the string has been compressed without an EOS marker, you must provide the maximum length as keyword parameter.";
+
+PyObject *
+pylzma_verify(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    Py_buffer buffer;
+    const Byte *data;
+    size_t length;
+    Py_ssize_t totallength=-1;
+    int lzma2 = 0;
+    PyObject *expected = Py_None;
+    UInt32 expectedCrc = 0;
+    UInt32 crc = CRC_INIT_VAL;
+    PyObject *result=NULL;
+    union {
+        CLzmaDec lzma;
+        CLzma2Dec lzma2;
+    } state;
+    CLzmaDec *decoder;
+    ELzmaStatus status;
+    UInt32 dictionarySize;
+    size_t propertiesLength;
+    size_t pos, limit, inSize, outSize, total = 0;
+    SRes res;
+    // possible keywords for this function
+    static char *kwlist[] = {"data", "maxlength", "lzma2", "crc32", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|niO", kwlist, &buffer, &totallength, &lzma2, &expected))
+        return NULL;
+
+    if (totallength < -1) {
+        PyErr_SetString(PyExc_ValueError, "the decompressed size must be zero or greater");
+        goto exit;
+    }
+    if (expected != Py_None) {
+        expectedCrc = (UInt32) PyLong_AsUnsignedLongMask(expected);
+        if (PyErr_Occurred()) {
             goto exit;
         }
     }
 
+    data = (const Byte *) buffer.buf;
+    length = (size_t) buffer.len;
+    propertiesLength = lzma2 ? 1 : LZMA_PROPS_SIZE;
+    if (length < propertiesLength) {
+        pylzma_set_decompression_error(SZ_ERROR_INPUT_EOF);
+        goto exit;
+    }
+
+    // Only the probabilities are allocated by the SDK, the dictionary is
+    // not larger than the output if its size is known.
+    if (lzma2) {
+        Lzma2Dec_Construct(&state.lzma2);
+        res = Lzma2Dec_AllocateProbs(&state.lzma2, data[0], &allocator);
+        decoder = &state.lzma2.decoder;
+    } else {
+        LzmaDec_Construct(&state.lzma);
+        res = LzmaDec_AllocateProbs(&state.lzma, data, (unsigned) propertiesLength, &allocator);
+        decoder = &state.lzma;
+    }
+    if (res != SZ_OK) {
+        pylzma_set_decompression_error(res);
+        goto exit;
+    }
+
+    dictionarySize = decoder->prop.dicSize < (1 << 12) ? (1 << 12) : decoder->prop.dicSize;
+    decoder->dicBufSize = dictionarySize;
+    if (totallength != -1 && (size_t) totallength < decoder->dicBufSize) {
+        decoder->dicBufSize = totallength > 0 ? (size_t) totallength : 1;
+    }
+    decoder->dic = (Byte *) malloc(decoder->dicBufSize);
+    if (decoder->dic == NULL) {
+        PyErr_NoMemory();
+        goto free_probs;
+    }
+
     data += propertiesLength;
-    avail = length - propertiesLength;
+    length -= propertiesLength;
     Py_BEGIN_ALLOW_THREADS
     if (lzma2) {
         Lzma2Dec_Init(&state.lzma2);
@@ -124,44 +553,439 @@ pylzma_decompress(PyObject *self, PyObject *args, PyObject *kwargs)
         LzmaDec_Init(&state.lzma);
     }
     for (;;) {
-        srcLen = avail;
-        destLen = bufsize;
-
+        if (decoder->dicPos == decoder->dicBufSize) {
+            decoder->dicPos = 0;
+        }
+        pos = decoder->dicPos;
+        limit = decoder->dicBufSize;
+        if (totallength != -1 && (size_t) totallength - total < limit - pos) {
+            limit = pos + ((size_t) totallength - total);
+        }
+        inSize = length;
         if (lzma2) {
-            res = Lzma2Dec_DecodeToBuf(&state.lzma2, tmp, &destLen, data, &srcLen, LZMA_FINISH_ANY, &status);
+            res = Lzma2Dec_DecodeToDic(&state.lzma2, limit, data, &inSize, LZMA_FINISH_ANY, &status);
         } else {
-            res = LzmaDec_DecodeToBuf(&state.lzma, tmp, &destLen, data, &srcLen, LZMA_FINISH_ANY, &status);
+            res = LzmaDec_DecodeToDic(&state.lzma, limit, data, &inSize, LZMA_FINISH_ANY, &status);
         }
-        data += srcLen;
-        avail -= srcLen;
-        if (res == SZ_OK && destLen > 0 && outStream.s.Write((const ISeqOutStream*) &outStream, tmp, destLen) != destLen) {
-            res = SZ_ERROR_WRITE;
+        data += inSize;
+        length -= inSize;
+        outSize = decoder->dicPos - pos;
+        if (expected != Py_None) {
+            crc = CrcUpdate(crc, decoder->dic + pos, outSize);
         }
-        if (res != SZ_OK || status == LZMA_STATUS_FINISHED_WITH_MARK || status == LZMA_STATUS_NEEDS_MORE_INPUT) {
+        total += outSize;
+        if (res != SZ_OK || status == LZMA_STATUS_FINISHED_WITH_MARK ||
+            (totallength != -1 && total == (size_t) totallength)) {
+            break;
+        }
+        if (status == LZMA_STATUS_NEEDS_MORE_INPUT) {
+            res = SZ_ERROR_INPUT_EOF;
+            break;
+        }
+        if (length == 0 && outSize == 0) {
+            // stream without end marker
             break;
         }
-
     }
     Py_END_ALLOW_THREADS
 
-    if (status == LZMA_STATUS_NEEDS_MORE_INPUT) {
-        PyErr_SetString(PyExc_ValueError, "data error during decompression");
-    } else if (res != SZ_OK) {
-        PyErr_Format(PyExc_TypeError, "Error while decompressing: %d", res);
+    if (res != SZ_OK) {
+        pylzma_set_decompression_error(res);
+    } else if (expected != Py_None && CRC_GET_DIGEST(crc) != expectedCrc) {
+        PyErr_SetString(PyExc_ValueError, "CRC check failed");
     } else {
-        result = PyBytes_FromStringAndSize((const char *) outStream.data, outStream.size);
+        result = PyLong_FromSize_t(total);
     }
 
-exit:
-    if (outStream.data != NULL) {
-        free(outStream.data);
+    free(decoder->dic);
+    decoder->dic = NULL;
+free_probs:
+    if (lzma2) {
+        Lzma2Dec_FreeProbs(&state.lzma2, &allocator);
+    } else {
+        LzmaDec_FreeProbs(&state.lzma, &allocator);
     }
+exit:
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+void
+pylzma_init_buffer_decoder(CBufferDecoder *decoder, int lzma2)
+{
+    decoder->lzma2 = lzma2;
     if (lzma2) {
-        Lzma2Dec_Free(&state.lzma2, &allocator);
+        Lzma2Dec_Construct(&decoder->state.lzma2);
     } else {
-        LzmaDec_Free(&state.lzma, &allocator);
+        LzmaDec_Construct(&decoder->state.lzma);
     }
-    free(tmp);
+}
 
+void
+pylzma_free_buffer_decoder(CBufferDecoder *decoder)
+{
+    if (decoder->lzma2) {
+        Lzma2Dec_Free(&decoder->state.lzma2, &allocator);
+    } else {
+        LzmaDec_Free(&decoder->state.lzma, &allocator);
+    }
+}
+
+SRes
+pylzma_buffer_decoder_decompress(CBufferDecoder *decoder, Byte **dest, size_t *destLen, const Byte *src, size_t srcLen)
+{
+    size_t capacity;
+    Byte *output = NULL;
+    Byte *tmp;
+    int finished;
+    SRes res;
+
+    *dest = NULL;
+    *destLen = 0;
+    res = pylzma_buffer_decoder_start(decoder, &src, &srcLen);
+    if (res != SZ_OK) {
+        return res;
+    }
+
+    // the output grows geometrically, starting with a guess based on the input
+    capacity = pylzma_guess_output_size(srcLen);
+    for (;;) {
+        tmp = (Byte *) realloc(output, capacity);
+        if (tmp == NULL) {
+            res = SZ_ERROR_MEM;
+            break;
+        }
+        output = tmp;
+
+        res = pylzma_buffer_decoder_fill(decoder, output, destLen, capacity, &src, &srcLen, &finished);
+        if (res != SZ_OK || finished) {
+            break;
+        }
+        capacity *= 2;
+    }
+
+    if (res != SZ_OK) {
+        free(output);
+        *destLen = 0;
+        return res;
+    }
+
+    *dest = output;
+    return SZ_OK;
+}
+
+void
+pylzma_set_decompression_error(SRes res)
+{
+    switch (res) {
+    case SZ_ERROR_MEM:
+        PyErr_NoMemory();
+        break;
+    case SZ_ERROR_UNSUPPORTED:
+        PyErr_SetString(PyExc_TypeError, "Incorrect stream properties");
+        break;
+    case SZ_ERROR_INPUT_EOF:
+    case SZ_ERROR_ARCHIVE:
+    case SZ_ERROR_NO_ARCHIVE:
+        PyErr_SetString(PyExc_ValueError, "data error during decompression");
+        break;
+    case SZ_ERROR_CRC:
+        PyErr_SetString(PyExc_ValueError, "CRC check failed");
+        break;
+    default:
+        PyErr_Format(PyExc_TypeError, "Error while decompressing: %d", res);
+        break;
+    }
+}
+
+int
+pylzma_parse_decoder_threads(int *threads, PY_LONG_LONG memlimit, int format, int lzma2)
+{
+    if (*threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be zero or greater");
+        return -1;
+    }
+    if (memlimit < 0) {
+        PyErr_SetString(PyExc_ValueError, "memlimit must be zero or greater");
+        return -1;
+    }
+    if (format != FORMAT_XZ && !lzma2 && (*threads != 1 || memlimit != 0)) {
+        PyErr_SetString(PyExc_ValueError, "threads and memlimit are only supported for lzma2 and format 'xz'");
+        return -1;
+    }
+    if (*threads == 0) {
+        *threads = (int) pylzma_cpu_count();
+    }
+    return 0;
+}
+
+// Counts the bytes written by the xz decoder, which only reports the output
+// size when decoding with multiple threads.
+typedef struct {
+    ISeqOutStream s;
+    ISeqOutStreamPtr stream;
+    UInt64 size;
+} CCountingOutStream;
+
+static size_t
+CountingOutStream_Write(const ISeqOutStream *p, const void *buf, size_t size)
+{
+    CCountingOutStream *self = (CCountingOutStream *) p;
+    size = ISeqOutStream_Write(self->stream, buf, size);
+    self->size += size;
+    return size;
+}
+
+SRes
+pylzma_xz_decode(ISeqInStreamPtr inStream, ISeqOutStreamPtr outStream, const UInt64 *outSize, unsigned threads, UInt64 memlimit, CXzStatInfo *stat, int *isMT)
+{
+    CXzDecMtHandle decoder;
+    CXzDecMtProps props;
+    CCountingOutStream countingStream;
+    SRes res;
+
+    decoder = XzDecMt_Create(&allocator, &allocator);
+    if (decoder == NULL) {
+        return SZ_ERROR_MEM;
+    }
+
+    XzDecMtProps_Init(&props);
+#ifndef Z7_ST
+    // the decoder falls back to a single thread if a block doesn't store its
+    // sizes or needs more memory than allowed
+    props.numThreads = threads;
+    if (memlimit > 0) {
+        props.memUseMax = memlimit < (UInt64) (size_t) -1 ? (size_t) memlimit : (size_t) -1;
+    }
+#endif
+    countingStream.s.Write = CountingOutStream_Write;
+    countingStream.stream = outStream;
+    countingStream.size = 0;
+    res = XzDecMt_Decode(decoder, &props, outSize, outSize == NULL, &countingStream.s, inStream, stat, isMT, NULL);
+    XzDecMt_Destroy(decoder);
+    stat->OutSize = countingStream.size;
+    if (res == SZ_ERROR_DATA && outSize != NULL && countingStream.size == *outSize) {
+        // decoding stopped after the given size inside of a stream
+        res = SZ_OK;
+    }
+    return res;
+}
+
+typedef struct {
+    Py_buffer input;
+    Byte *output;
+    size_t length;
+} CDecompressManyItem;
+
+typedef struct {
+    CBufferDecoder *decoders;
+    CDecompressManyItem *items;
+} CDecompressManyState;
+
+static SRes
+decompress_many_item(void *param, unsigned worker, size_t index)
+{
+    CDecompressManyState *state = (CDecompressManyState *) param;
+    CDecompressManyItem *item = &state->items[index];
+    return pylzma_buffer_decoder_decompress(&state->decoders[worker], &item->output, &item->length,
+        (const Byte *) item->input.buf, (size_t) item->input.len);
+}
+
+const char
+doc_decompress_many[] = \
+    "decompress_many(sequence, threads=0, lzma2=0) -- Decompress all items of the sequence, returning a list with the " \
+    "decompressed data in the same order. The items are decompressed in parallel by threads worker threads (0 uses one " \
+    "thread per processor) that each reuse one decoder.";
+
+PyObject *
+pylzma_decompress_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *result = NULL;
+    PyObject *sequence = NULL;
+    PyObject *seq = NULL;
+    CDecompressManyState state;
+    Py_ssize_t count = 0;
+    Py_ssize_t acquired = 0;
+    Py_ssize_t i;
+    int threads = 0;
+    int lzma2 = 0;
+    SRes res;
+    // possible keywords for this function
+    static char *kwlist[] = {"sequence", "threads", "lzma2", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ii", kwlist, &sequence, &threads, &lzma2))
+        return NULL;
+
+    if (threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be zero or greater");
+        return NULL;
+    }
+    if (threads == 0) {
+        threads = (int) pylzma_cpu_count();
+    }
+
+    seq = PySequence_Fast(sequence, "sequence of buffers expected");
+    if (seq == NULL) {
+        return NULL;
+    }
+
+    state.decoders = NULL;
+    count = PySequence_Fast_GET_SIZE(seq);
+    state.items = (CDecompressManyItem *) PyMem_Malloc(sizeof(CDecompressManyItem) * (count > 0 ? count : 1));
+    CHECK_NULL(state.items);
+    for (i = 0; i < count; i++) {
+        CDecompressManyItem *item = &state.items[i];
+        item->output = NULL;
+        item->length = 0;
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i), &item->input, PyBUF_SIMPLE) != 0) {
+            goto exit;
+        }
+        acquired++;
+    }
+
+    if (threads > count) {
+        threads = count > 0 ? (int) count : 1;
+    }
+    state.decoders = (CBufferDecoder *) PyMem_Malloc(sizeof(CBufferDecoder) * threads);
+    CHECK_NULL(state.decoders);
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < threads; i++) {
+        pylzma_init_buffer_decoder(&state.decoders[i], lzma2);
+    }
+    res = pylzma_pool_run((unsigned) threads, (size_t) count, decompress_many_item, &state);
+    for (i = 0; i < threads; i++) {
+        pylzma_free_buffer_decoder(&state.decoders[i]);
+    }
+    Py_END_ALLOW_THREADS
+    if (res != SZ_OK) {
+        pylzma_set_decompression_error(res);
+        goto exit;
+    }
+
+    result = PyList_New(count);
+    if (result == NULL) {
+        goto exit;
+    }
+    for (i = 0; i < count; i++) {
+        CDecompressManyItem *item = &state.items[i];
+        PyObject *data = PyBytes_FromStringAndSize((const char *) item->output, (Py_ssize_t) item->length);
+        if (data == NULL) {
+            DEC_AND_NULL(result);
+            goto exit;
+        }
+        // the list steals the reference
+        PyList_SET_ITEM(result, i, data);
+    }
+
+exit:
+    if (state.items != NULL) {
+        for (i = 0; i < acquired; i++) {
+            PyBuffer_Release(&state.items[i].input);
+            free(state.items[i].output);
+        }
+        PyMem_Free(state.items);
+    }
+    if (state.decoders != NULL) {
+        PyMem_Free(state.decoders);
+    }
+    Py_DECREF(seq);
     return result;
 }
+
+// Follows the chunk headers of a LZMA2 stream while it is read to detect the
+// end marker, the multithreaded decoder doesn't report streams truncated
+// inside of the last block.
+typedef struct {
+    ISeqInStream s;
+    ISeqInStreamPtr stream;
+    Byte header[6];
+    unsigned headerPos;
+    unsigned headerSize;
+    UInt32 skip;
+    int finished;
+} CChunkCheckInStream;
+
+static void
+ChunkCheckInStream_Update(CChunkCheckInStream *self, const Byte *data, size_t size)
+{
+    while (size > 0 && !self->finished) {
+        Byte control;
+        if (self->skip > 0) {
+            size_t count = size < self->skip ? size : self->skip;
+            self->skip -= (UInt32) count;
+            data += count;
+            size -= count;
+            continue;
+        }
+
+        self->header[self->headerPos++] = *data++;
+        size--;
+        control = self->header[0];
+        if (self->headerPos == 1) {
+            if (control == 0 || (control > 2 && control < 0x80)) {
+                // invalid control bytes are reported by the decoder
+                self->finished = 1;
+            } else if (control < 0x80) {
+                self->headerSize = 3;
+            } else {
+                self->headerSize = ((control >> 5) & 3) >= 2 ? 6 : 5;
+            }
+        }
+        if (self->headerPos < self->headerSize) {
+            continue;
+        }
+
+        if (control < 0x80) {
+            self->skip = ((UInt32) self->header[1] << 8 | self->header[2]) + 1;
+        } else {
+            self->skip = ((UInt32) self->header[3] << 8 | self->header[4]) + 1;
+        }
+        self->headerPos = 0;
+    }
+}
+
+static SRes
+ChunkCheckInStream_Read(ISeqInStreamPtr p, void *buf, size_t *size)
+{
+    CChunkCheckInStream *self = (CChunkCheckInStream *) p;
+    SRes res = ISeqInStream_Read(self->stream, buf, size);
+    ChunkCheckInStream_Update(self, (const Byte *) buf, *size);
+    return res;
+}
+
+SRes
+pylzma_lzma2_decode(Byte prop, ISeqInStreamPtr inStream, ISeqOutStreamPtr outStream, const UInt64 *outSize, unsigned threads, UInt64 memlimit, int *isMT)
+{
+    CLzma2DecMtHandle decoder;
+    CLzma2DecMtProps props;
+    CChunkCheckInStream checkStream;
+    UInt64 inProcessed;
+    SRes res;
+
+    decoder = Lzma2DecMt_Create(&allocator, &allocator);
+    if (decoder == NULL) {
+        return SZ_ERROR_MEM;
+    }
+
+    Lzma2DecMtProps_Init(&props);
+#ifndef Z7_ST
+    // every thread buffers the compressed and decompressed data of a block,
+    // larger blocks are decoded by a single thread
+    props.numThreads = threads;
+    if (memlimit > 0 && memlimit / threads < (UInt64) props.outBlockMax) {
+        props.outBlockMax = (size_t) (memlimit / threads);
+        props.inBlockMax = props.outBlockMax + props.outBlockMax / 16;
+    }
+#endif
+    memset(&checkStream, 0, sizeof(checkStream));
+    checkStream.s.Read = ChunkCheckInStream_Read;
+    checkStream.stream = inStream;
+    // a truncated output is allowed if the size is given
+    res = Lzma2DecMt_Decode(decoder, prop, &props, outStream, outSize, outSize == NULL, &checkStream.s, &inProcessed, isMT, NULL);
+    Lzma2DecMt_Destroy(decoder);
+    if (res == SZ_OK && *isMT && outSize == NULL && !checkStream.finished) {
+        res = SZ_ERROR_INPUT_EOF;
+    }
+    return res;
+}
@@ -28,7 +28,48 @@
 
 #include <Python.h>
 
+#include "../sdk/C/LzmaDec.h"
+#include "../sdk/C/Lzma2Dec.h"
+#include "../sdk/C/Xz.h"
+
 extern const char doc_decompress[];
 PyObject *pylzma_decompress(PyObject *self, PyObject *args, PyObject *kwargs);
+extern const char doc_decompress_many[];
+PyObject *pylzma_decompress_many(PyObject *self, PyObject *args, PyObject *kwargs);
+extern const char doc_verify[];
+PyObject *pylzma_verify(PyObject *self, PyObject *args, PyObject *kwargs);
+
+// Decoder to decompress buffers, keeps the allocated decoder between calls.
+typedef struct {
+    int lzma2;
+    union {
+        CLzmaDec lzma;
+        CLzma2Dec lzma2;
+    } state;
+} CBufferDecoder;
+
+void pylzma_init_buffer_decoder(CBufferDecoder *decoder, int lzma2);
+void pylzma_free_buffer_decoder(CBufferDecoder *decoder);
+// Decompress "src" (including the stream header) to a buffer allocated with
+// "malloc" that is returned in "dest", can be called without holding the GIL.
+SRes pylzma_buffer_decoder_decompress(CBufferDecoder *decoder, Byte **dest, size_t *destLen, const Byte *src, size_t srcLen);
+void pylzma_set_decompression_error(SRes res);
+
+// Check the "threads" and "memlimit" arguments of the decompression functions
+// for the given format, a value of 0 for "threads" is replaced with the number
+// of processors.
+int pylzma_parse_decoder_threads(int *threads, PY_LONG_LONG memlimit, int format, int lzma2);
+// Decode a LZMA2 stream with the properties byte "prop", chunks that start by
+// resetting the dictionary are decoded in parallel by up to "threads" threads
+// that buffer at most "memlimit" bytes together (0 uses the default). If
+// "outSize" is not NULL, decoding stops after that many bytes. Can be called
+// without holding the GIL.
+SRes pylzma_lzma2_decode(Byte prop, ISeqInStreamPtr inStream, ISeqOutStreamPtr outStream, const UInt64 *outSize, unsigned threads, UInt64 memlimit, int *isMT);
+// Decode xz streams, blocks that store their sizes in the block header are
+// decoded in parallel by up to "threads" threads that buffer at most "memlimit"
+// bytes (0 uses the default), other streams are decoded by the calling thread.
+// If "outSize" is not NULL, decoding stops after that many bytes. Can be called
+// without holding the GIL.
+SRes pylzma_xz_decode(ISeqInStreamPtr inStream, ISeqOutStreamPtr outStream, const UInt64 *outSize, unsigned threads, UInt64 memlimit, CXzStatInfo *stat, int *isMT);
 
 #endif
@@ -45,18 +45,18 @@ const char doc_decompress_compat[] = \
 
 PyObject *pylzma_decompress_compat(PyObject *self, PyObject *args)
 {
-    char *data;
-    Py_ssize_t length;
+    Py_buffer data;
     Py_ssize_t blocksize=BLOCK_SIZE;
     PyObject *result = NULL;
     lzma_stream stream;
     int res;
     char *output;
 
-    if (!PyArg_ParseTuple(args, "s#|n", &data, &length, &blocksize))
+    if (!PyArg_ParseTuple(args, "s*|n", &data, &blocksize))
         return NULL;
 
     if (blocksize <= 0) {
+        PyBuffer_Release(&data);
         PyErr_SetString(PyExc_ValueError, "bufsize must be greater than zero");
         return NULL;
     }
@@ -69,8 +69,8 @@ PyObject *pylzma_decompress_compat(PyObject *self, PyObject *args)
     }
 
     lzmaCompatInit(&stream);
-    stream.next_in = (Byte *)data;
-    stream.avail_in = (UInt32)length;
+    stream.next_in = (Byte *)data.buf;
+    stream.avail_in = (UInt32)data.len;
     stream.next_out = (Byte *)output;
     stream.avail_out = (UInt32)blocksize;
 
@@ -116,6 +116,7 @@ exit:
     free_lzma_stream(&stream);
     if (output != NULL)
         free(output);
+    PyBuffer_Release(&data);
 
     return result;
 }
@@ -24,194 +24,771 @@
  */
 
 #include <Python.h>
+#include <structmember.h>
+
+#include "../sdk/C/CpuArch.h"
 
 #include "pylzma.h"
 #include "pylzma_decompressobj.h"
+#include "pylzma_streams.h"
+
+// Construct the decoder, xz streams store the properties in the block headers
+// so decoding can start immediately.
+static void
+pylzma_decomp_construct(CDecompressionObject *self)
+{
+    if (self->format == FORMAT_XZ) {
+        XzUnpacker_Construct(&self->state.xz, &allocator);
+    } else if (self->lzma2) {
+        Lzma2Dec_Construct(&self->state.lzma2);
+    } else {
+        LzmaDec_Construct(&self->state.lzma);
+    }
+    self->need_properties = self->format != FORMAT_XZ;
+}
 
 static int
 pylzma_decomp_init(CDecompressionObject *self, PyObject *args, PyObject *kwargs)
 {
     PY_LONG_LONG max_length = -1;
     int lzma2 = 0;
+    const char *format = NULL;
 
     // possible keywords for this function
-    static char *kwlist[] = {"maxlength", "lzma2", NULL};
+    static char *kwlist[] = {"maxlength", "lzma2", "format", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Li", kwlist, &max_length, &lzma2))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Liz", kwlist, &max_length, &lzma2, &format))
         return -1;
 
+    self->format = pylzma_parse_format(format, lzma2);
+    if (self->format < 0) {
+        return -1;
+    }
+
     if (max_length == 0 || max_length < -1) {
         PyErr_SetString(PyExc_ValueError, "the decompressed size must be greater than zero");
         return -1;
     }
 
-    self->unconsumed_tail = NULL;
-    self->unconsumed_length = 0;
-    self->need_properties = 1;
+    CreateMemoryInOutStream(&self->unconsumed);
+    DEC_AND_NULL(self->unused_data);
+    self->unused_data = PyBytes_FromString("");
+    if (self->unused_data == NULL) {
+        return -1;
+    }
+    self->eof = 0;
+    self->needs_input = 1;
     self->max_length = max_length;
     self->total_out = 0;
     self->lzma2 = lzma2;
-    if (lzma2) {
-        Lzma2Dec_Construct(&self->state.lzma2);
+    pylzma_decomp_construct(self);
+    return 0;
+}
+
+static void
+pylzma_decomp_free(CDecompressionObject *self)
+{
+    if (self->format == FORMAT_XZ) {
+        XzUnpacker_Free(&self->state.xz);
+    } else if (self->output != NULL) {
+        // the dictionary is the result string
+        if (self->lzma2) {
+            Lzma2Dec_FreeProbs(&self->state.lzma2, &allocator);
+        } else {
+            LzmaDec_FreeProbs(&self->state.lzma, &allocator);
+        }
+        DEC_AND_NULL(self->output);
+    } else if (self->lzma2) {
+        Lzma2Dec_Free(&self->state.lzma2, &allocator);
     } else {
-        LzmaDec_Construct(&self->state.lzma);
+        LzmaDec_Free(&self->state.lzma, &allocator);
+    }
+}
+
+// Size of the buffer the output of xz streams is decoded to while skipping.
+#define XZ_SKIP_SIZE    (16 * 1024)
+
+// Number of bytes of "size" that may be passed to the unpacker without reading
+// past the end of the current xz stream. Blocks are decoded one at a time, the
+// first byte after a block is passed alone to find the index, which is limited
+// to its remaining size with the footer.
+static SizeT
+pylzma_decomp_xz_input(CXzUnpacker *p, SizeT size)
+{
+    UInt64 remaining;
+
+    p->decodeOnlyOneBlock = 0;
+    switch (p->state) {
+    case XZ_STATE_STREAM_HEADER:
+        remaining = XZ_STREAM_HEADER_SIZE - p->pos + 1;
+        break;
+    case XZ_STATE_BLOCK_HEADER:
+        if (p->pos == 0) {
+            remaining = 1;
+            break;
+        }
+        // fall through
+    case XZ_STATE_BLOCK:
+    case XZ_STATE_BLOCK_FOOTER:
+        p->decodeOnlyOneBlock = 1;
+        return size;
+    case XZ_STATE_STREAM_INDEX:
+        remaining = (p->pos < p->indexPreSize ? p->indexPreSize - p->pos : 0) + (p->indexSize - p->indexPos) +
+            ((4 - (unsigned) (p->indexSize & 3)) & 3) + 4 + XZ_STREAM_FOOTER_SIZE;
+        break;
+    case XZ_STATE_STREAM_INDEX_CRC:
+        remaining = 4 - p->pos + XZ_STREAM_FOOTER_SIZE;
+        break;
+    case XZ_STATE_STREAM_FOOTER:
+        remaining = XZ_STREAM_FOOTER_SIZE - p->pos;
+        break;
+    default:
+        return size;
+    }
+    return remaining < size ? (SizeT) remaining : size;
+}
+
+// Decode the first xz stream, reaching its end is reported as
+// LZMA_STATUS_FINISHED_WITH_MARK. The output is decoded to a temporary
+// buffer if "dest" is NULL.
+static SRes
+pylzma_decomp_decode_xz(CDecompressionObject *self, Byte *dest, SizeT *destLen, const Byte *src, SizeT *srcLen, ELzmaStatus *status)
+{
+    CXzUnpacker *unpacker = &self->state.xz;
+    Byte skipped[XZ_SKIP_SIZE];
+    SizeT outSize = *destLen, inSize = *srcLen;
+    SizeT inProcessed, outProcessed;
+    ECoderStatus coderStatus;
+    SRes res;
+
+    *destLen = *srcLen = 0;
+    *status = LZMA_STATUS_NOT_FINISHED;
+    for (;;) {
+        outProcessed = dest != NULL ? outSize : min(outSize, XZ_SKIP_SIZE);
+        inProcessed = pylzma_decomp_xz_input(unpacker, inSize);
+        res = XzUnpacker_Code(unpacker, dest != NULL ? dest : skipped, &outProcessed, src, &inProcessed, 0, CODER_FINISH_ANY, &coderStatus);
+        src += inProcessed;
+        inSize -= inProcessed;
+        *srcLen += inProcessed;
+        if (dest != NULL) {
+            dest += outProcessed;
+        }
+        outSize -= outProcessed;
+        *destLen += outProcessed;
+        if (res != SZ_OK) {
+            return res;
+        }
+        if (unpacker->numFinishedStreams > 0) {
+            *status = LZMA_STATUS_FINISHED_WITH_MARK;
+            return SZ_OK;
+        }
+        if (coderStatus == CODER_STATUS_NEEDS_MORE_INPUT) {
+            *status = LZMA_STATUS_NEEDS_MORE_INPUT;
+        }
+        if (outSize == 0 || (inProcessed == 0 && outProcessed == 0)) {
+            return SZ_OK;
+        }
+    }
+}
+
+// Decode into the dictionary, which is the result string if the size of the
+// output is known. The data is copied to "dest" unless it already points to
+// the decoded data or is NULL to skip the output.
+static SRes
+pylzma_decomp_decode(CDecompressionObject *self, Byte *dest, SizeT *destLen, const Byte *src, SizeT *srcLen, ELzmaStatus *status)
+{
+    CLzmaDec *decoder = self->lzma2 ? &self->state.lzma2.decoder : &self->state.lzma;
+    SizeT outSize = *destLen, inSize = *srcLen;
+    SizeT pos, limit, inProcessed, outProcessed;
+    SRes res;
+
+    if (self->format == FORMAT_XZ) {
+        return pylzma_decomp_decode_xz(self, dest, destLen, src, srcLen, status);
+    }
+
+    *destLen = *srcLen = 0;
+    for (;;) {
+        if (decoder->dicPos == decoder->dicBufSize && self->output == NULL) {
+            decoder->dicPos = 0;
+        }
+        pos = decoder->dicPos;
+        limit = decoder->dicBufSize - pos < outSize ? decoder->dicBufSize : pos + outSize;
+        inProcessed = inSize;
+        if (self->lzma2) {
+            res = Lzma2Dec_DecodeToDic(&self->state.lzma2, limit, src, &inProcessed, LZMA_FINISH_ANY, status);
+        } else {
+            res = LzmaDec_DecodeToDic(&self->state.lzma, limit, src, &inProcessed, LZMA_FINISH_ANY, status);
+        }
+        src += inProcessed;
+        inSize -= inProcessed;
+        *srcLen += inProcessed;
+        outProcessed = decoder->dicPos - pos;
+        if (dest != NULL) {
+            if (outProcessed > 0 && dest != decoder->dic + pos) {
+                memcpy(dest, decoder->dic + pos, outProcessed);
+            }
+            dest += outProcessed;
+        }
+        outSize -= outProcessed;
+        *destLen += outProcessed;
+        if (res != SZ_OK || outProcessed == 0 || outSize == 0) {
+            return res;
+        }
+    }
+}
+
+// Decode the pending input in place, chunk by chunk. Can be called without
+// holding the GIL.
+static SRes
+pylzma_decomp_decode_pending(CDecompressionObject *self, Byte *dest, SizeT *destLen, ELzmaStatus *status)
+{
+    SizeT written = 0;
+    SizeT inProcessed, outProcessed;
+    size_t avail;
+    const Byte *src;
+    SRes res;
+
+    for (;;) {
+        src = MemoryInOutStreamPeek(&self->unconsumed, &avail);
+        inProcessed = avail;
+        outProcessed = *destLen - written;
+        res = pylzma_decomp_decode(self, dest != NULL ? dest + written : NULL, &outProcessed,
+            src != NULL ? src : (const Byte *) "", &inProcessed, status);
+        MemoryInOutStreamSkip(&self->unconsumed, inProcessed);
+        written += outProcessed;
+        if (res != SZ_OK || *status == LZMA_STATUS_FINISHED_WITH_MARK || written == *destLen ||
+            avail == 0 || (inProcessed == 0 && outProcessed == 0)) {
+            break;
+        }
+    }
+    *destLen = written;
+    return res;
+}
+
+// Read the stream properties from the pending input and "data". Returns 1 if
+// the decoder was initialized, 0 if more data is needed (all data has been
+// added to the pending input) and -1 on errors.
+static int
+pylzma_decomp_read_properties(CDecompressionObject *self, const Byte **data, Py_ssize_t *length)
+{
+    Byte properties[ALONE_HEADER_SIZE];
+    size_t propertiesLength = self->lzma2 ? 1 : LZMA_PROPS_SIZE;
+    size_t headerLength = self->format == FORMAT_ALONE ? ALONE_HEADER_SIZE : propertiesLength;
+    size_t pending = self->unconsumed.size;
+    CLzmaDec *decoder;
+    UInt32 dictionarySize;
+    SRes res;
+
+    if (pending + (size_t) *length < headerLength) {
+        // we need enough bytes to read the properties
+        if (!MemoryInOutStreamAppend(&self->unconsumed, *data, (size_t) *length)) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        *data += *length;
+        *length = 0;
+        return 0;
+    }
+
+    // the properties may start in the pending data
+    self->unconsumed.s.Read(&self->unconsumed.s, properties, &pending);
+    memcpy(properties + pending, *data, headerLength - pending);
+    *data += headerLength - pending;
+    *length -= (Py_ssize_t) (headerLength - pending);
+    if (self->format == FORMAT_ALONE) {
+        // the size from the header limits the output like maxlength
+        UInt64 size = GetUi64(properties + LZMA_PROPS_SIZE);
+        if (size != ALONE_UNKNOWN_SIZE && size <= (UInt64) PY_LLONG_MAX &&
+            (self->max_length == -1 || size < (UInt64) self->max_length)) {
+            self->max_length = (PY_LONG_LONG) size;
+        }
     }
+    // If the output is not larger than the dictionary, the result string is
+    // used as dictionary and only the probabilities are allocated.
+    if (self->lzma2) {
+        res = Lzma2Dec_AllocateProbs(&self->state.lzma2, properties[0], &allocator);
+        decoder = &self->state.lzma2.decoder;
+    } else {
+        res = LzmaDec_AllocateProbs(&self->state.lzma, properties, (unsigned) propertiesLength, &allocator);
+        decoder = &self->state.lzma;
+    }
+    dictionarySize = decoder->prop.dicSize < (1 << 12) ? (1 << 12) : decoder->prop.dicSize;
+    if (res == SZ_OK && self->max_length > 0 && self->max_length <= PY_SSIZE_T_MAX &&
+        (unsigned PY_LONG_LONG) self->max_length <= dictionarySize) {
+        self->output = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) self->max_length);
+        if (self->output == NULL) {
+            return -1;
+        }
+        decoder->dic = (Byte *) PyBytes_AS_STRING(self->output);
+        decoder->dicBufSize = (SizeT) self->max_length;
+    } else if (res == SZ_OK) {
+        if (self->lzma2) {
+            res = Lzma2Dec_Allocate(&self->state.lzma2, properties[0], &allocator);
+        } else {
+            res = LzmaDec_Allocate(&self->state.lzma, properties, (unsigned) propertiesLength, &allocator);
+        }
+    }
+    if (res != SZ_OK) {
+        PyErr_SetString(PyExc_TypeError, "Incorrect stream properties");
+        return -1;
+    }
+
+    self->need_properties = 0;
+    if (self->lzma2) {
+        Lzma2Dec_Init(&self->state.lzma2);
+    } else {
+        LzmaDec_Init(&self->state.lzma);
+    }
+    return 1;
+}
+
+// Decode the pending input and then "data" directly, until the output is full,
+// the end of the stream was reached or all input was consumed. The output is
+// skipped if "dest" is NULL. Can be called without holding the GIL.
+static SRes
+pylzma_decomp_run(CDecompressionObject *self, Byte *dest, SizeT *destLen, const Byte **data, SizeT *length, ELzmaStatus *status)
+{
+    SizeT written = 0;
+    SizeT inSize, outSize;
+    SRes res = SZ_OK;
+
+    *status = LZMA_STATUS_NOT_SPECIFIED;
+    if (self->unconsumed.size > 0 || *length == 0) {
+        written = *destLen;
+        res = pylzma_decomp_decode_pending(self, dest, &written, status);
+    }
+    if (res == SZ_OK && self->unconsumed.size == 0 && *length > 0 && written < *destLen &&
+        *status != LZMA_STATUS_FINISHED_WITH_MARK) {
+        inSize = *length;
+        outSize = *destLen - written;
+        res = pylzma_decomp_decode(self, dest != NULL ? dest + written : NULL, &outSize, *data, &inSize, status);
+        *data += inSize;
+        *length -= inSize;
+        written += outSize;
+    }
+    *destLen = written;
+    return res;
+}
+
+// Maximum number of bytes that may still be decompressed.
+static SizeT
+pylzma_decomp_remaining(CDecompressionObject *self, SizeT limit)
+{
+    if (self->max_length != -1 && (unsigned PY_LONG_LONG) (self->max_length - self->total_out) < (unsigned PY_LONG_LONG) limit) {
+        return (SizeT) (self->max_length - self->total_out);
+    }
+    return limit;
+}
+
+// Consume an optional end marker after the output reached "max_length" from
+// the pending input and "data". The status is LZMA_STATUS_NEEDS_MORE_INPUT if
+// the marker isn't complete yet.
+static void
+pylzma_decomp_finish(CDecompressionObject *self, const Byte **data, SizeT *length, ELzmaStatus *status)
+{
+    CLzmaDec *decoder = self->lzma2 ? &self->state.lzma2.decoder : &self->state.lzma;
+    const Byte *src;
+    size_t avail;
+    SizeT inProcessed;
+    int pending;
+    SRes res;
+
+    if (self->format == FORMAT_XZ || *status == LZMA_STATUS_FINISHED_WITH_MARK ||
+        self->max_length == -1 || self->total_out < self->max_length) {
+        return;
+    }
+
+    for (;;) {
+        pending = self->unconsumed.size > 0;
+        if (pending) {
+            src = MemoryInOutStreamPeek(&self->unconsumed, &avail);
+        } else {
+            src = *length > 0 ? *data : (const Byte *) "";
+            avail = *length;
+        }
+        inProcessed = avail;
+        if (self->lzma2) {
+            res = Lzma2Dec_DecodeToDic(&self->state.lzma2, decoder->dicPos, src, &inProcessed, LZMA_FINISH_END, status);
+        } else {
+            res = LzmaDec_DecodeToDic(&self->state.lzma, decoder->dicPos, src, &inProcessed, LZMA_FINISH_END, status);
+        }
+        if (res != SZ_OK) {
+            // the data after the size doesn't start with an end marker
+            *status = LZMA_STATUS_NOT_FINISHED;
+            return;
+        }
+        if (pending) {
+            MemoryInOutStreamSkip(&self->unconsumed, inProcessed);
+        } else {
+            *data += inProcessed;
+            *length -= inProcessed;
+        }
+        if (*status != LZMA_STATUS_NEEDS_MORE_INPUT || !pending) {
+            return;
+        }
+    }
+}
+
+// Update the state after data has been decompressed. Once the end of the
+// stream was reached, the pending input and "data" are unused.
+static int
+pylzma_decomp_update(CDecompressionObject *self, ELzmaStatus status, const Byte *data, SizeT length, int outputFull)
+{
+    PyObject *unused;
+    Byte *dest;
+    size_t pending;
+
+    if (!self->eof && (status == LZMA_STATUS_FINISHED_WITH_MARK ||
+        (self->max_length != -1 && self->total_out >= self->max_length && status != LZMA_STATUS_NEEDS_MORE_INPUT))) {
+        self->eof = 1;
+    }
+    if (!self->eof) {
+        // the output is also full while waiting for the end marker
+        self->needs_input = self->unconsumed.size == 0 && length == 0 &&
+            (!outputFull || status == LZMA_STATUS_NEEDS_MORE_INPUT);
+        return 0;
+    }
+
+    self->needs_input = 0;
+    pending = self->unconsumed.size;
+    if (pending == 0 && length == 0) {
+        return 0;
+    }
+    unused = PyBytes_FromStringAndSize(NULL, PyBytes_GET_SIZE(self->unused_data) + (Py_ssize_t) (pending + length));
+    if (unused == NULL) {
+        return -1;
+    }
+    dest = (Byte *) PyBytes_AS_STRING(unused);
+    memcpy(dest, PyBytes_AS_STRING(self->unused_data), PyBytes_GET_SIZE(self->unused_data));
+    dest += PyBytes_GET_SIZE(self->unused_data);
+    self->unconsumed.s.Read(&self->unconsumed.s, dest, &pending);
+    if (length > 0) {
+        memcpy(dest + pending, data, length);
+    }
+    Py_DECREF(self->unused_data);
+    self->unused_data = unused;
     return 0;
 }
 
+// Return "length" bytes of the result string starting at "start". The string
+// itself is returned if it has been decompressed completely by one call.
+static PyObject *
+pylzma_decomp_output(CDecompressionObject *self, SizeT start, SizeT length)
+{
+    if (start == 0 && length == (SizeT) PyBytes_GET_SIZE(self->output)) {
+        Py_INCREF(self->output);
+        return self->output;
+    }
+    return PyBytes_FromStringAndSize(PyBytes_AS_STRING(self->output) + start, (Py_ssize_t) length);
+}
+
 static const char
 doc_decomp_decompress[] = \
-    "decompress(data[, bufsize]) -- Returns a string containing the up to bufsize decompressed bytes of the data.\n" \
-    "After calling, some of the input data may be available in internal buffers for later processing.";
+    "decompress(data[, bufsize][, max_length]) -- Returns a string containing the up to bufsize decompressed bytes of the data.\n" \
+    "After calling, some of the input data may be available in internal buffers for later processing.\n" \
+    "If max_length is given, it is used instead of bufsize. A max_length of -1 decompresses all available input.\n" \
+    "Data after the end of the stream is stored in the attribute unused_data.";
 
 static PyObject *
-pylzma_decomp_decompress(CDecompressionObject *self, PyObject *args)
+pylzma_decomp_decompress(CDecompressionObject *self, PyObject *args, PyObject *kwargs)
 {
     PyObject *result=NULL;
-    unsigned char *data;
-    Byte *next_in, *next_out;
-    Py_ssize_t length;
-    int res;
+    Py_buffer buffer;
+    const Byte *data;
+    Byte *output = NULL;
+    Byte *tmp;
+    SizeT length;
+    int res = SZ_OK;
     Py_ssize_t bufsize=BLOCK_SIZE;
-    SizeT avail_in;
-    SizeT inProcessed, outProcessed;
-    ELzmaStatus status;
+    Py_ssize_t max_length=PY_SSIZE_T_MIN;
+    SizeT limit, capacity, outProcessed, start = 0, written = 0;
+    ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+    // possible keywords for this function
+    static char *kwlist[] = {"data", "bufsize", "max_length", NULL};
 
-    if (!PyArg_ParseTuple(args, "s#|n", &data, &length, &bufsize)){
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|nn", kwlist, &buffer, &bufsize, &max_length)){
         return NULL;
     }
 
+    data = (const Byte *) buffer.buf;
+    length = (SizeT) buffer.len;
     if (bufsize <= 0) {
         PyErr_SetString(PyExc_ValueError, "bufsize must be greater than zero");
-        return NULL;
+        goto exit;
+    }
+    if (max_length == 0 || (max_length < -1 && max_length != PY_SSIZE_T_MIN)) {
+        PyErr_SetString(PyExc_ValueError, "max_length must be -1 or greater than zero");
+        goto exit;
     }
 
-    if (self->unconsumed_length > 0) {
-        self->unconsumed_tail = (unsigned char *) realloc(self->unconsumed_tail, self->unconsumed_length + length);
-        next_in = (unsigned char *) self->unconsumed_tail;
-        memcpy(next_in + self->unconsumed_length, data, length);
-    } else {
-        next_in = data;
+    if (self->eof) {
+        if (pylzma_decomp_update(self, status, data, length, 0) == 0) {
+            result = PyBytes_FromString("");
+        }
+        goto exit;
     }
 
     if (self->need_properties) {
-        SizeT propertiesLength = self->lzma2 ? 1 : LZMA_PROPS_SIZE;
-        if ((self->unconsumed_length + length) < propertiesLength) {
-            // we need enough bytes to read the properties
-            self->unconsumed_tail = (unsigned char *) realloc(self->unconsumed_tail, self->unconsumed_length + length);
-            if (self->unconsumed_tail == NULL) {
-                PyErr_NoMemory();
-                return NULL;
-            }
-            memcpy(self->unconsumed_tail + self->unconsumed_length, data, length);
-            self->unconsumed_length += length;
-            return PyBytes_FromString("");
+        Py_ssize_t remaining = (Py_ssize_t) length;
+        int ready = pylzma_decomp_read_properties(self, &data, &remaining);
+        length = (SizeT) remaining;
+        if (ready == -1) {
+            goto exit;
+        } else if (ready == 0) {
+            result = PyBytes_FromString("");
+            goto exit;
         }
+    }
 
-        self->unconsumed_length += length;
-        if (self->lzma2) {
-            res = Lzma2Dec_Allocate(&self->state.lzma2, next_in[0], &allocator);
-        } else {
-            res = LzmaDec_Allocate(&self->state.lzma, next_in, (unsigned)propertiesLength, &allocator);
-        }
-        if (res != SZ_OK) {
-            PyErr_SetString(PyExc_TypeError, "Incorrect stream properties");
-            return NULL;
+    if (self->unconsumed.size == 0 && length == 0) {
+        // no more bytes to decompress
+        self->needs_input = 1;
+        result = PyBytes_FromString("");
+        goto exit;
+    }
+
+    if (max_length == -1) {
+        limit = pylzma_decomp_remaining(self, (SizeT) PY_SSIZE_T_MAX);
+    } else {
+        limit = pylzma_decomp_remaining(self, (SizeT) (max_length > 0 ? max_length : bufsize));
+    }
+
+    if (self->output != NULL) {
+        // decode into the result string, the returned data is copied from it
+        start = (SizeT) self->total_out;
+        written = limit;
+        Py_BEGIN_ALLOW_THREADS
+        res = pylzma_decomp_run(self, (Byte *) PyBytes_AS_STRING(self->output) + start, &written, &data, &length, &status);
+        Py_END_ALLOW_THREADS
+    } else if (max_length != -1) {
+        result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) limit);
+        if (result == NULL) {
+            goto exit;
         }
 
-        next_in += propertiesLength;
-        self->unconsumed_length -= propertiesLength;
-        if (self->unconsumed_length > 0) {
-            if (self->unconsumed_tail == NULL) {
-                // No remaining data yet
-                self->unconsumed_tail = (unsigned char *) malloc(self->unconsumed_length);
-                if (self->unconsumed_tail == NULL) {
-                    PyErr_NoMemory();
-                    return NULL;
-                }
-                memcpy(self->unconsumed_tail, next_in, self->unconsumed_length);
-                next_in = self->unconsumed_tail;
-            } else {
-                // Skip properties in remaining data
-                memmove(self->unconsumed_tail, self->unconsumed_tail+propertiesLength, self->unconsumed_length);
-                self->unconsumed_tail = next_in = (unsigned char *) realloc(self->unconsumed_tail, self->unconsumed_length);
-                if (self->unconsumed_tail == NULL) {
-                    PyErr_NoMemory();
-                    return NULL;
-                }
+        // Not all of the compressed data may fit into the output buffer of
+        // specified size, the rest is kept for the next call.
+        written = limit;
+        Py_BEGIN_ALLOW_THREADS
+        res = pylzma_decomp_run(self, (Byte *) PyBytes_AS_STRING(result), &written, &data, &length, &status);
+        Py_END_ALLOW_THREADS
+    } else {
+        // all available input is decompressed, the output grows geometrically
+        capacity = self->unconsumed.size + length;
+        capacity = capacity < BLOCK_SIZE / 4 ? BLOCK_SIZE / 16 : capacity * 4;
+        capacity = min(capacity, limit);
+        Py_BEGIN_ALLOW_THREADS
+        output = (Byte *) malloc(capacity > 0 ? capacity : 1);
+        while (output != NULL) {
+            outProcessed = capacity - written;
+            res = pylzma_decomp_run(self, output + written, &outProcessed, &data, &length, &status);
+            written += outProcessed;
+            if (res != SZ_OK || status == LZMA_STATUS_FINISHED_WITH_MARK || written < capacity || capacity == limit) {
+                break;
             }
-        } else {
-            FREE_AND_NULL(self->unconsumed_tail);
+
+            capacity = limit / 2 < capacity ? limit : capacity * 2;
+            tmp = (Byte *) realloc(output, capacity);
+            if (tmp == NULL) {
+                res = SZ_ERROR_MEM;
+                break;
+            }
+            output = tmp;
+        }
+        Py_END_ALLOW_THREADS
+        if (output == NULL) {
+            PyErr_NoMemory();
+            goto exit;
         }
+    }
+    self->total_out += written;
 
-        self->need_properties = 0;
-        if (self->lzma2) {
-            Lzma2Dec_Init(&self->state.lzma2);
+    if (res != SZ_OK) {
+        DEC_AND_NULL(result);
+        if (res == SZ_ERROR_MEM) {
+            PyErr_NoMemory();
         } else {
-            LzmaDec_Init(&self->state.lzma);
+            PyErr_SetString(PyExc_ValueError, "data error during decompression");
         }
-    } else {
-        self->unconsumed_length += length;
-    }
-    avail_in = self->unconsumed_length;
-    if (avail_in == 0) {
-        // no more bytes to decompress
-        return PyBytes_FromString("");
+        goto exit;
     }
 
-    result = PyBytes_FromStringAndSize(NULL, bufsize);
-    if (result == NULL) {
+    pylzma_decomp_finish(self, &data, &length, &status);
+    if (pylzma_decomp_update(self, status, data, length, written == limit) != 0) {
+        DEC_AND_NULL(result);
+        goto exit;
+    }
+    if (!self->eof && length > 0 && !MemoryInOutStreamAppend(&self->unconsumed, data, length)) {
+        DEC_AND_NULL(result);
         PyErr_NoMemory();
         goto exit;
     }
 
-    next_out = (unsigned char *) PyBytes_AS_STRING(result);
-    Py_BEGIN_ALLOW_THREADS
-    // Decompress until EOS marker is reached
-    inProcessed = avail_in;
-    outProcessed = bufsize;
-    if (self->lzma2) {
-        res = Lzma2Dec_DecodeToBuf(&self->state.lzma2, next_out, &outProcessed,
-                        next_in, &inProcessed, LZMA_FINISH_ANY, &status);
+    if (self->output != NULL) {
+        result = pylzma_decomp_output(self, start, written);
+    } else if (result == NULL) {
+        result = PyBytes_FromStringAndSize((const char *) output, (Py_ssize_t) written);
     } else {
-        res = LzmaDec_DecodeToBuf(&self->state.lzma, next_out, &outProcessed,
-                        next_in, &inProcessed, LZMA_FINISH_ANY, &status);
+        _PyBytes_Resize(&result, (Py_ssize_t) written);
     }
+
+exit:
+    free(output);
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+static const char
+doc_decomp_decompress_into[] = \
+    "decompress_into(data, buffer) -- Decompress data into the writable buffer, returning a tuple (bytes_written, input_consumed).\n" \
+    "Input that was not consumed is not kept and must be passed again in the next call. Input kept by previous calls of " \
+    "decompress is decompressed first, pass empty data to get the remaining output. Data after the end of the stream " \
+    "is consumed and stored in the attribute unused_data.";
+
+static PyObject *
+pylzma_decomp_decompress_into(CDecompressionObject *self, PyObject *args)
+{
+    PyObject *result=NULL;
+    Py_buffer buffer;
+    Py_buffer output;
+    const Byte *data;
+    SizeT length;
+    int res = SZ_OK;
+    SizeT limit, outProcessed = 0;
+    ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+
+    if (!PyArg_ParseTuple(args, "s*w*", &buffer, &output)) {
+        return NULL;
+    }
+
+    data = (const Byte *) buffer.buf;
+    length = (SizeT) buffer.len;
+    if (self->eof) {
+        if (pylzma_decomp_update(self, status, data, length, 0) == 0) {
+            result = Py_BuildValue("(nn)", (Py_ssize_t) 0, buffer.len);
+        }
+        goto exit;
+    }
+
+    if (self->need_properties) {
+        Py_ssize_t remaining = (Py_ssize_t) length;
+        int ready = pylzma_decomp_read_properties(self, &data, &remaining);
+        length = (SizeT) remaining;
+        if (ready == -1) {
+            goto exit;
+        } else if (ready == 0) {
+            result = Py_BuildValue("(nn)", (Py_ssize_t) 0, buffer.len);
+            goto exit;
+        }
+    }
+
+    limit = pylzma_decomp_remaining(self, (SizeT) output.len);
+    outProcessed = limit;
+    Py_BEGIN_ALLOW_THREADS
+    res = pylzma_decomp_run(self, (Byte *) output.buf, &outProcessed, &data, &length, &status);
     Py_END_ALLOW_THREADS
     self->total_out += outProcessed;
-    next_in += inProcessed;
-    avail_in -= inProcessed;
 
     if (res != SZ_OK) {
-        DEC_AND_NULL(result);
         PyErr_SetString(PyExc_ValueError, "data error during decompression");
         goto exit;
     }
 
-    // Not all of the compressed data could be accomodated in the output buffer
-    // of specified size. Return the unconsumed tail in an attribute.
-    if (avail_in > 0) {
-        if (self->unconsumed_tail == NULL) {
-            // data are in "data"
-            self->unconsumed_tail = (unsigned char *) malloc(avail_in);
-            if (self->unconsumed_tail == NULL) {
-                Py_DECREF(result);
-                PyErr_NoMemory();
-                goto exit;
-            }
-            memcpy(self->unconsumed_tail, next_in, avail_in);
-        } else {
-            memmove(self->unconsumed_tail, next_in, avail_in);
-            self->unconsumed_tail = (unsigned char *) realloc(self->unconsumed_tail, avail_in);
+    pylzma_decomp_finish(self, &data, &length, &status);
+    if (pylzma_decomp_update(self, status, data, length, outProcessed == limit) != 0) {
+        goto exit;
+    }
+    if (self->eof) {
+        // trailing data was moved to "unused_data"
+        data += length;
+    }
+
+    result = Py_BuildValue("(nn)", (Py_ssize_t) outProcessed, (Py_ssize_t) (data - (const Byte *) buffer.buf));
+
+exit:
+    PyBuffer_Release(&output);
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+static const char
+doc_decomp_skip[] = \
+    "skip(size[, data]) -- Decompress up to size bytes without returning them, returning the number of bytes skipped.\n" \
+    "The optional data is added to the input, input that was not consumed is kept for later calls.";
+
+static PyObject *
+pylzma_decomp_skip(CDecompressionObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *result=NULL;
+    Py_buffer buffer;
+    const Byte *data;
+    SizeT length;
+    int res = SZ_OK;
+    Py_ssize_t size;
+    SizeT limit, skipped = 0;
+    ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+    // possible keywords for this function
+    static char *kwlist[] = {"size", "data", NULL};
+
+    buffer.buf = NULL;
+    buffer.len = 0;
+    buffer.obj = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|s*", kwlist, &size, &buffer)) {
+        return NULL;
+    }
+
+    data = (const Byte *) buffer.buf;
+    length = (SizeT) buffer.len;
+    if (size < 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be zero or greater");
+        goto exit;
+    }
+
+    if (self->eof) {
+        if (pylzma_decomp_update(self, status, data, length, 0) == 0) {
+            result = PyLong_FromSsize_t(0);
         }
-    } else {
-        FREE_AND_NULL(self->unconsumed_tail);
+        goto exit;
     }
 
-    self->unconsumed_length = avail_in;
-    _PyBytes_Resize(&result, outProcessed);
+    if (self->need_properties) {
+        Py_ssize_t remaining = (Py_ssize_t) length;
+        int ready = pylzma_decomp_read_properties(self, &data, &remaining);
+        length = (SizeT) remaining;
+        if (ready == -1) {
+            goto exit;
+        } else if (ready == 0) {
+            result = PyLong_FromSsize_t(0);
+            goto exit;
+        }
+    }
+
+    // the data is only decoded to the dictionary
+    limit = pylzma_decomp_remaining(self, (SizeT) size);
+    skipped = limit;
+    Py_BEGIN_ALLOW_THREADS
+    res = pylzma_decomp_run(self, NULL, &skipped, &data, &length, &status);
+    Py_END_ALLOW_THREADS
+    self->total_out += skipped;
+
+    if (res != SZ_OK) {
+        PyErr_SetString(PyExc_ValueError, "data error during decompression");
+        goto exit;
+    }
+
+    pylzma_decomp_finish(self, &data, &length, &status);
+    if (pylzma_decomp_update(self, status, data, length, skipped == limit) != 0) {
+        goto exit;
+    }
+    if (!self->eof && length > 0 && !MemoryInOutStreamAppend(&self->unconsumed, data, length)) {
+        PyErr_NoMemory();
+        goto exit;
+    }
+
+    result = PyLong_FromSsize_t((Py_ssize_t) skipped);
 
 exit:
+    PyBuffer_Release(&buffer);
     return result;
 }
 
@@ -227,8 +804,10 @@ pylzma_decomp_flush(CDecompressionObject *self, PyObject *args)
     SizeT avail_out;
     Py_ssize_t outsize;
     unsigned char *tmp;
-    SizeT inProcessed, outProcessed;
+    SizeT outProcessed, start;
     ELzmaStatus status;
+    const Byte *data = NULL;
+    SizeT length = 0;
 
     if (self->max_length != -1) {
         PY_LONG_LONG available = self->max_length - self->total_out;
@@ -242,11 +821,32 @@ pylzma_decomp_flush(CDecompressionObject *self, PyObject *args)
         avail_out = BLOCK_SIZE;
     }
 
-    if (avail_out == 0) {
+    if (avail_out == 0 || self->eof) {
         // no more remaining data
         return PyBytes_FromString("");
     }
 
+    if (self->output != NULL) {
+        // decode into the result string, the returned data is copied from it
+        start = (SizeT) self->total_out;
+        outProcessed = avail_out;
+        Py_BEGIN_ALLOW_THREADS
+        res = pylzma_decomp_decode_pending(self, (Byte *) PyBytes_AS_STRING(self->output) + start, &outProcessed, &status);
+        Py_END_ALLOW_THREADS
+        if (res != SZ_OK || !outProcessed) {
+            PyErr_SetString(PyExc_ValueError, "data error during decompression");
+            return NULL;
+        }
+
+        self->total_out += outProcessed;
+        pylzma_decomp_finish(self, &data, &length, &status);
+        result = pylzma_decomp_output(self, start, outProcessed);
+        if (result != NULL && pylzma_decomp_update(self, status, NULL, 0, 0) != 0) {
+            DEC_AND_NULL(result);
+        }
+        return result;
+    }
+
     result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)avail_out);
     if (result == NULL) {
         return NULL;
@@ -255,35 +855,9 @@ pylzma_decomp_flush(CDecompressionObject *self, PyObject *args)
     tmp = (unsigned char *) PyBytes_AS_STRING(result);
     outsize = 0;
     while (1) {
+        outProcessed = avail_out;
         Py_BEGIN_ALLOW_THREADS
-        if (self->unconsumed_length == 0) {
-            // No remaining data
-            inProcessed = 0;
-            outProcessed = avail_out;
-            if (self->lzma2) {
-                res = Lzma2Dec_DecodeToBuf(&self->state.lzma2, tmp, &outProcessed,
-                                (Byte *) "", &inProcessed, LZMA_FINISH_ANY, &status);
-            } else {
-                res = LzmaDec_DecodeToBuf(&self->state.lzma, tmp, &outProcessed,
-                                (Byte *) "", &inProcessed, LZMA_FINISH_ANY, &status);
-            }
-        } else {
-            // Decompress remaining data
-            inProcessed = self->unconsumed_length;
-            outProcessed = avail_out;
-            if (self->lzma2) {
-                res = Lzma2Dec_DecodeToBuf(&self->state.lzma2, tmp, &outProcessed,
-                                self->unconsumed_tail, &inProcessed, LZMA_FINISH_ANY, &status);
-            } else {
-                res = LzmaDec_DecodeToBuf(&self->state.lzma, tmp, &outProcessed,
-                                self->unconsumed_tail, &inProcessed, LZMA_FINISH_ANY, &status);
-            }
-            self->unconsumed_length -= inProcessed;
-            if (self->unconsumed_length > 0)
-                memmove(self->unconsumed_tail, self->unconsumed_tail + inProcessed, self->unconsumed_length);
-            else
-                FREE_AND_NULL(self->unconsumed_tail);
-        }
+        res = pylzma_decomp_decode_pending(self, tmp, &outProcessed, &status);
         Py_END_ALLOW_THREADS
 
         if (res != SZ_OK) {
@@ -325,6 +899,11 @@ pylzma_decomp_flush(CDecompressionObject *self, PyObject *args)
         _PyBytes_Resize(&result, outsize);
     }
 
+    pylzma_decomp_finish(self, &data, &length, &status);
+    if (pylzma_decomp_update(self, status, NULL, 0, 0) != 0) {
+        DEC_AND_NULL(result);
+    }
+
 exit:
     return result;
 }
@@ -344,16 +923,19 @@ pylzma_decomp_reset(CDecompressionObject *self, PyObject *args, PyObject *kwargs
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|L", kwlist, &max_length))
         return NULL;
 
-    if (self->lzma2) {
-        Lzma2Dec_Free(&self->state.lzma2, &allocator);
-        Lzma2Dec_Construct(&self->state.lzma2);
-    } else {
-        LzmaDec_Free(&self->state.lzma, &allocator);
-        LzmaDec_Construct(&self->state.lzma);
+    pylzma_decomp_free(self);
+    pylzma_decomp_construct(self);
+    FreeMemoryInOutStream(&self->unconsumed);
+    if (PyBytes_GET_SIZE(self->unused_data) > 0) {
+        PyObject *unused = PyBytes_FromString("");
+        if (unused == NULL) {
+            return NULL;
+        }
+        Py_DECREF(self->unused_data);
+        self->unused_data = unused;
     }
-    FREE_AND_NULL(self->unconsumed_tail);
-    self->unconsumed_length = 0;
-    self->need_properties = 1;
+    self->eof = 0;
+    self->needs_input = 1;
     self->total_out = 0;
     self->max_length = max_length;
 
@@ -364,7 +946,9 @@ pylzma_decomp_reset(CDecompressionObject *self, PyObject *args, PyObject *kwargs
 
 static PyMethodDef
 pylzma_decomp_methods[] = {
-    {"decompress", (PyCFunction)pylzma_decomp_decompress, METH_VARARGS, (char *)&doc_decomp_decompress},
+    {"decompress", (PyCFunction)pylzma_decomp_decompress, METH_VARARGS | METH_KEYWORDS, (char *)&doc_decomp_decompress},
+    {"decompress_into", (PyCFunction)pylzma_decomp_decompress_into, METH_VARARGS, (char *)&doc_decomp_decompress_into},
+    {"skip",       (PyCFunction)pylzma_decomp_skip,       METH_VARARGS | METH_KEYWORDS, (char *)&doc_decomp_skip},
     {"flush",      (PyCFunction)pylzma_decomp_flush,      METH_NOARGS,  (char *)&doc_decomp_flush},
     {"reset",      (PyCFunction)pylzma_decomp_reset,      METH_VARARGS | METH_KEYWORDS, (char *)&doc_decomp_reset},
     {NULL},
@@ -373,15 +957,23 @@ pylzma_decomp_methods[] = {
 static void
 pylzma_decomp_dealloc(CDecompressionObject *self)
 {
-    if (self->lzma2) {
-        Lzma2Dec_Free(&self->state.lzma2, &allocator);
-    } else {
-        LzmaDec_Free(&self->state.lzma, &allocator);
-    }
-    FREE_AND_NULL(self->unconsumed_tail);
+    pylzma_decomp_free(self);
+    FreeMemoryInOutStream(&self->unconsumed);
+    DEC_AND_NULL(self->unused_data);
     Py_TYPE(self)->tp_free((PyObject*) self);
 }
 
+static PyMemberDef
+pylzma_decomp_members[] = {
+    {"unused_data", T_OBJECT_EX, offsetof(CDecompressionObject, unused_data), READONLY,
+        "Data found after the end of the compressed stream."},
+    {"eof", T_BOOL, offsetof(CDecompressionObject, eof), READONLY,
+        "True if the end of the compressed stream has been reached."},
+    {"needs_input", T_BOOL, offsetof(CDecompressionObject, needs_input), READONLY,
+        "False if decompress can return more data without new input."},
+    {NULL},
+};
+
 PyTypeObject
 CDecompressionObject_Type = {
     PyVarObject_HEAD_INIT(NULL, 0)
@@ -412,7 +1004,7 @@ CDecompressionObject_Type = {
     0,                                   /* tp_iter */
     0,                                   /* tp_iternext */
     pylzma_decomp_methods,               /* tp_methods */
-    0,                                   /* tp_members */
+    pylzma_decomp_members,               /* tp_members */
     0,                                   /* tp_getset */
     0,                                   /* tp_base */
     0,                                   /* tp_dict */
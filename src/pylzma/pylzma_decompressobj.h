@@ -30,20 +30,31 @@
 
 #include "../sdk/C/LzmaDec.h"
 #include "../sdk/C/Lzma2Dec.h"
+#include "../sdk/C/Xz.h"
+
+#include "pylzma_streams.h"
 
 typedef struct {
     PyObject_HEAD
     int lzma2;
+    int format;
     union {
       CLzmaDec lzma;
       CLzma2Dec lzma2;
+      CXzUnpacker xz;
     } state;
     ELzmaStatus status;
     PY_LONG_LONG max_length;
     PY_LONG_LONG total_out;
-    unsigned char *unconsumed_tail;
-    SizeT unconsumed_length;
+    // input that has not been decompressed yet
+    CMemoryInOutStream unconsumed;
     int need_properties;
+    char eof;
+    char needs_input;
+    // data found after the end of the stream
+    PyObject *unused_data;
+    // result string used as dictionary if the size of the output is known
+    PyObject *output;
 } CDecompressionObject;
 
 extern PyTypeObject CDecompressionObject_Type;
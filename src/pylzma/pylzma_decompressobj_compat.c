@@ -37,19 +37,22 @@ static const char doc_decomp_decompress[] = \
 static PyObject *pylzma_decomp_decompress(CCompatDecompressionObject *self, PyObject *args)
 {
     PyObject *result=NULL;
+    Py_buffer buffer;
     char *data;
     Py_ssize_t length, old_length;
     UInt32 start_total_out;
     int res;
     Py_ssize_t max_length=BLOCK_SIZE;
 
-    if (!PyArg_ParseTuple(args, "s#|n", &data, &length, &max_length))
+    if (!PyArg_ParseTuple(args, "s*|n", &buffer, &max_length))
         return NULL;
 
+    data = (char *) buffer.buf;
+    length = buffer.len;
     if (max_length < 0)
     {
         PyErr_SetString(PyExc_ValueError, "bufsize must be greater than zero");
-        return NULL;
+        goto exit;
     }
 
     start_total_out = self->stream.totalOut;
@@ -66,7 +69,7 @@ static PyObject *pylzma_decomp_decompress(CCompatDecompressionObject *self, PyOb
         length = max_length;
 
     if (!(result = PyBytes_FromStringAndSize(NULL, length)))
-        return NULL;
+        goto exit;
 
     self->stream.next_out = (Byte *) PyBytes_AS_STRING(result);
     self->stream.avail_out = (UInt32)length;
@@ -149,6 +152,7 @@ static PyObject *pylzma_decomp_decompress(CCompatDecompressionObject *self, PyOb
     _PyBytes_Resize(&result, self->stream.totalOut - start_total_out);
 
 exit:
+    PyBuffer_Release(&buffer);
     return result;
 }
 
@@ -0,0 +1,149 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ * $Id$
+ *
+ */
+
+#include <Python.h>
+#include <math.h>
+
+#include "pylzma.h"
+#include "pylzma_estimate.h"
+
+// Size of the blocks that are probed.
+#define PROBE_BLOCK_SIZE    4096
+// Number of entries in the hash table of the match probe.
+#define PROBE_HASH_BITS     12
+// Minimum length of a match.
+#define PROBE_MIN_MATCH     4
+// Estimated number of bytes to encode a match.
+#define PROBE_MATCH_COST    3
+
+#define PROBE_HASH(p) \
+    ((((UInt32) (p)[0] | ((UInt32) (p)[1] << 8) | ((UInt32) (p)[2] << 16) | ((UInt32) (p)[3] << 24)) \
+        * 2654435761U) >> (32 - PROBE_HASH_BITS))
+
+// Find matches in a block with a single entry hash table, returns the number
+// of matches and adds the bytes that can't be matched to the histogram.
+static size_t
+probe_block(const Byte *data, size_t size, UInt32 *literals)
+{
+    UInt16 table[1 << PROBE_HASH_BITS];
+    size_t matches = 0;
+    size_t pos = 0;
+
+    memset(table, 0xff, sizeof(table));
+    while (pos + PROBE_MIN_MATCH <= size) {
+        UInt32 hash = PROBE_HASH(data + pos);
+        size_t candidate = table[hash];
+        table[hash] = (UInt16) pos;
+        if (candidate < pos && memcmp(data + candidate, data + pos, PROBE_MIN_MATCH) == 0) {
+            size_t length = PROBE_MIN_MATCH;
+            while (pos + length < size && data[candidate + length] == data[pos + length]) {
+                length++;
+            }
+            matches++;
+            pos += length;
+        } else {
+            literals[data[pos]]++;
+            pos++;
+        }
+    }
+    while (pos < size) {
+        literals[data[pos++]]++;
+    }
+    return matches;
+}
+
+double
+pylzma_estimate_ratio(const Byte *data, size_t size, size_t sample)
+{
+    UInt32 literals[256];
+    size_t blocks, total, step, count = 0, matches = 0, probed = 0;
+    double bits = 0.0;
+    size_t i;
+
+    if (size == 0) {
+        return 1.0;
+    }
+
+    // probe evenly distributed blocks
+    total = (size + PROBE_BLOCK_SIZE - 1) / PROBE_BLOCK_SIZE;
+    blocks = (sample + PROBE_BLOCK_SIZE - 1) / PROBE_BLOCK_SIZE;
+    if (blocks == 0) {
+        blocks = 1;
+    } else if (blocks > total) {
+        blocks = total;
+    }
+    step = total / blocks;
+
+    memset(literals, 0, sizeof(literals));
+    for (i = 0; i < blocks; i++) {
+        size_t offset = i * step * PROBE_BLOCK_SIZE;
+        size_t length = min(size - offset, (size_t) PROBE_BLOCK_SIZE);
+        matches += probe_block(data + offset, length, literals);
+        probed += length;
+    }
+
+    // literals are encoded with their order-0 entropy
+    for (i = 0; i < 256; i++) {
+        count += literals[i];
+    }
+    for (i = 0; i < 256; i++) {
+        if (literals[i] > 0) {
+            bits -= literals[i] * log((double) literals[i] / count);
+        }
+    }
+    bits /= log(2.0);
+
+    return (bits / 8 + (double) matches * PROBE_MATCH_COST) / probed;
+}
+
+const char
+doc_estimate_ratio[] = \
+    "estimate_ratio(data, sample=65536) -- Estimate the size of the compressed data relative to the size of the input " \
+    "by probing sample bytes of the data. Values close to or above 1.0 mean that the data can't be compressed.";
+
+PyObject *
+pylzma_py_estimate_ratio(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    Py_buffer data;
+    Py_ssize_t sample = 65536;
+    double ratio;
+    // possible keywords for this function
+    static char *kwlist[] = {"data", "sample", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|n", kwlist, &data, &sample))
+        return NULL;
+
+    if (sample <= 0) {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "sample must be greater than zero");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ratio = pylzma_estimate_ratio((const Byte *) data.buf, (size_t) data.len, (size_t) sample);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
+    return PyFloat_FromDouble(ratio);
+}
@@ -0,0 +1,40 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ * $Id$
+ *
+ */
+
+#ifndef ___PYLZMA_ESTIMATE__H___
+#define ___PYLZMA_ESTIMATE__H___
+
+#include <Python.h>
+
+#include "../sdk/C/7zTypes.h"
+
+// Estimate the size of the compressed data relative to the input from
+// "sample" bytes of the data. Can be called without holding the GIL.
+double pylzma_estimate_ratio(const Byte *data, size_t size, size_t sample);
+
+extern const char doc_estimate_ratio[];
+PyObject *pylzma_py_estimate_ratio(PyObject *self, PyObject *args, PyObject *kwargs);
+
+#endif
@@ -0,0 +1,967 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+#include <Python.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "../sdk/C/CpuArch.h"
+#include "../sdk/C/LzmaEnc.h"
+#include "../sdk/C/Lzma2Enc.h"
+#include "../sdk/C/Xz.h"
+#include "../sdk/C/XzEnc.h"
+#ifdef COMPRESS_MF_MT
+#include "../sdk/C/Threads.h"
+#endif
+
+#include "pylzma.h"
+#include "pylzma_compress.h"
+#include "pylzma_decompress.h"
+#include "pylzma_file.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifdef _WIN32
+// "read" and "write" take the size as unsigned int
+#define IO_SIZE(size)   ((unsigned int) (size))
+#else
+#define IO_SIZE(size)   (size)
+#endif
+
+// Size of the buffers passed between the stages of the pipeline.
+#define PIPELINE_BUFFER_SIZE    (4*1024*1024)
+// Number of buffers between two stages, one can be filled while the other
+// one is being processed.
+#define PIPELINE_BUFFERS        2
+// The output file is extended in steps of this size to reduce fragmentation.
+#define PREALLOCATE_SIZE        (64*1024*1024)
+
+typedef struct {
+    Byte *data;
+    size_t size;
+} CPipelineBuffer;
+
+// Buffers passed from one stage to the next. If no thread could be started
+// for the I/O of the queue, it is done by the codec when a buffer is needed.
+typedef struct {
+    CPipelineBuffer buffers[PIPELINE_BUFFERS];
+    unsigned producer;
+    unsigned consumer;
+#ifdef COMPRESS_MF_MT
+    int threaded;
+    CThread thread;
+    CSemaphore empty;
+    CSemaphore filled;
+#endif
+} CPipelineQueue;
+
+typedef struct {
+    int inFd;
+    int outFd;
+    CPipelineQueue input;
+    CPipelineQueue output;
+    // buffers currently used by the codec
+    CPipelineBuffer *in;
+    size_t inPos;
+    int inEof;
+    CPipelineBuffer *out;
+    // the codec has stopped, the reader doesn't need to read any further
+    volatile int cancelled;
+    int readErrno;
+    volatile int writeErrno;
+    UInt64 bytesRead;
+    UInt64 bytesWritten;
+    UInt64 allocated;
+    int preallocateFailed;
+    // time spent waiting for the other stages
+    double readerStall;
+    double codecInputStall;
+    double codecOutputStall;
+    double writerStall;
+} CPipeline;
+
+static double
+pipeline_clock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+static void
+pipeline_read(CPipeline *p, CPipelineBuffer *buffer)
+{
+    buffer->size = 0;
+    while (buffer->size < PIPELINE_BUFFER_SIZE) {
+        Py_ssize_t count = read(p->inFd, buffer->data + buffer->size, IO_SIZE(PIPELINE_BUFFER_SIZE - buffer->size));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            p->readErrno = errno;
+            buffer->size = 0;
+            break;
+        } else if (count == 0) {
+            break;
+        }
+        buffer->size += (size_t) count;
+    }
+    p->bytesRead += buffer->size;
+}
+
+static void
+pipeline_write(CPipeline *p, const CPipelineBuffer *buffer)
+{
+    size_t pos = 0;
+
+    if (p->writeErrno != 0) {
+        return;
+    }
+#if defined(__linux__)
+    if (!p->preallocateFailed && p->bytesWritten + buffer->size > p->allocated) {
+        // the size of the file is not changed, unused blocks are released
+        // when the pipeline ends
+        if (fallocate(p->outFd, FALLOC_FL_KEEP_SIZE, (off_t) p->allocated, PREALLOCATE_SIZE) == 0) {
+            p->allocated += PREALLOCATE_SIZE;
+        } else {
+            p->preallocateFailed = 1;
+        }
+    }
+#endif
+    while (pos < buffer->size) {
+        Py_ssize_t count = write(p->outFd, buffer->data + pos, IO_SIZE(buffer->size - pos));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            p->writeErrno = count < 0 ? errno : EIO;
+            return;
+        }
+        pos += (size_t) count;
+        p->bytesWritten += (size_t) count;
+    }
+}
+
+static void
+pipeline_finish_output(CPipeline *p)
+{
+#if defined(__linux__)
+    if (p->allocated != 0) {
+        if (ftruncate(p->outFd, (off_t) p->bytesWritten) != 0 && p->writeErrno == 0) {
+            p->writeErrno = errno;
+        }
+    }
+#endif
+}
+
+#ifdef COMPRESS_MF_MT
+
+static void
+pipeline_wait(CSemaphore *semaphore, double *stall)
+{
+    double start = pipeline_clock();
+    Semaphore_Wait(semaphore);
+    *stall += pipeline_clock() - start;
+}
+
+static THREAD_FUNC_DECL
+pipeline_reader(void *param)
+{
+    CPipeline *p = (CPipeline *) param;
+    CPipelineQueue *queue = &p->input;
+    CPipelineBuffer *buffer;
+
+    do {
+        pipeline_wait(&queue->empty, &p->readerStall);
+        buffer = &queue->buffers[queue->producer];
+        if (p->cancelled) {
+            buffer->size = 0;
+        } else {
+            pipeline_read(p, buffer);
+        }
+        queue->producer = (queue->producer + 1) % PIPELINE_BUFFERS;
+        Semaphore_Release1(&queue->filled);
+    } while (buffer->size > 0);
+    return THREAD_FUNC_RET_ZERO;
+}
+
+static THREAD_FUNC_DECL
+pipeline_writer(void *param)
+{
+    CPipeline *p = (CPipeline *) param;
+    CPipelineQueue *queue = &p->output;
+    CPipelineBuffer *buffer;
+
+    for (;;) {
+        pipeline_wait(&queue->filled, &p->writerStall);
+        buffer = &queue->buffers[queue->consumer];
+        if (buffer->size == 0) {
+            break;
+        }
+        // after an error the buffers are still consumed so the codec can finish
+        pipeline_write(p, buffer);
+        queue->consumer = (queue->consumer + 1) % PIPELINE_BUFFERS;
+        Semaphore_Release1(&queue->empty);
+    }
+    pipeline_finish_output(p);
+    return THREAD_FUNC_RET_ZERO;
+}
+
+static void
+pipeline_start_queue(CPipelineQueue *queue, THREAD_FUNC_TYPE func, void *param)
+{
+    Semaphore_Construct(&queue->empty);
+    Semaphore_Construct(&queue->filled);
+    Thread_CONSTRUCT(&queue->thread);
+    queue->threaded = 0;
+    if (Semaphore_Create(&queue->empty, PIPELINE_BUFFERS, PIPELINE_BUFFERS) != 0 ||
+        Semaphore_Create(&queue->filled, 0, PIPELINE_BUFFERS) != 0 ||
+        Thread_Create(&queue->thread, func, param) != 0) {
+        // the I/O is done by the codec instead
+        if (Semaphore_IsCreated(&queue->empty)) {
+            Semaphore_Close(&queue->empty);
+        }
+        if (Semaphore_IsCreated(&queue->filled)) {
+            Semaphore_Close(&queue->filled);
+        }
+        return;
+    }
+    queue->threaded = 1;
+}
+
+static void
+pipeline_stop_queue(CPipelineQueue *queue)
+{
+    if (!queue->threaded) {
+        return;
+    }
+    Thread_Wait_Close(&queue->thread);
+    Semaphore_Close(&queue->empty);
+    Semaphore_Close(&queue->filled);
+}
+
+#endif
+
+static int
+pipeline_init(CPipeline *p, int inFd, int outFd)
+{
+    unsigned i;
+
+    memset(p, 0, sizeof(CPipeline));
+    p->inFd = inFd;
+    p->outFd = outFd;
+    for (i = 0; i < PIPELINE_BUFFERS; i++) {
+        p->input.buffers[i].data = (Byte *) malloc(PIPELINE_BUFFER_SIZE);
+        p->output.buffers[i].data = (Byte *) malloc(PIPELINE_BUFFER_SIZE);
+        if (p->input.buffers[i].data == NULL || p->output.buffers[i].data == NULL) {
+            return -1;
+        }
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(inFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef COMPRESS_MF_MT
+    pipeline_start_queue(&p->input, pipeline_reader, p);
+    pipeline_start_queue(&p->output, pipeline_writer, p);
+#endif
+    return 0;
+}
+
+// Release the current input buffer and get the next one.
+static SRes
+pipeline_next_input(CPipeline *p)
+{
+    CPipelineQueue *queue = &p->input;
+
+#ifdef COMPRESS_MF_MT
+    if (queue->threaded) {
+        if (p->in != NULL) {
+            queue->consumer = (queue->consumer + 1) % PIPELINE_BUFFERS;
+            Semaphore_Release1(&queue->empty);
+        }
+        pipeline_wait(&queue->filled, &p->codecInputStall);
+        p->in = &queue->buffers[queue->consumer];
+    } else
+#endif
+    {
+        p->in = &queue->buffers[0];
+        pipeline_read(p, p->in);
+    }
+    p->inPos = 0;
+    p->inEof = p->in->size == 0;
+    return p->inEof && p->readErrno != 0 ? SZ_ERROR_READ : SZ_OK;
+}
+
+static void
+pipeline_end_input(CPipeline *p)
+{
+#ifdef COMPRESS_MF_MT
+    if (p->input.threaded) {
+        // wait for the reader to stop
+        p->cancelled = 1;
+        while (!p->inEof) {
+            pipeline_next_input(p);
+        }
+    }
+    pipeline_stop_queue(&p->input);
+#endif
+}
+
+// Return the buffer to write output of the codec to.
+static CPipelineBuffer *
+pipeline_output_buffer(CPipeline *p)
+{
+    CPipelineQueue *queue = &p->output;
+
+    if (p->out != NULL) {
+        return p->out;
+    }
+#ifdef COMPRESS_MF_MT
+    if (queue->threaded) {
+        pipeline_wait(&queue->empty, &p->codecOutputStall);
+        p->out = &queue->buffers[queue->producer];
+    } else
+#endif
+    {
+        p->out = &queue->buffers[0];
+    }
+    p->out->size = 0;
+    return p->out;
+}
+
+static void
+pipeline_submit_output(CPipeline *p)
+{
+#ifdef COMPRESS_MF_MT
+    CPipelineQueue *queue = &p->output;
+
+    if (queue->threaded) {
+        queue->producer = (queue->producer + 1) % PIPELINE_BUFFERS;
+        Semaphore_Release1(&queue->filled);
+    } else
+#endif
+    {
+        pipeline_write(p, p->out);
+    }
+    p->out = NULL;
+}
+
+static void
+pipeline_end_output(CPipeline *p)
+{
+    if (p->out != NULL && p->out->size > 0) {
+        pipeline_submit_output(p);
+    }
+#ifdef COMPRESS_MF_MT
+    if (p->output.threaded) {
+        // an empty buffer stops the writer
+        pipeline_output_buffer(p)->size = 0;
+        pipeline_submit_output(p);
+        pipeline_stop_queue(&p->output);
+        return;
+    }
+#endif
+    pipeline_finish_output(p);
+}
+
+static void
+pipeline_free(CPipeline *p)
+{
+    unsigned i;
+    for (i = 0; i < PIPELINE_BUFFERS; i++) {
+        free(p->input.buffers[i].data);
+        free(p->output.buffers[i].data);
+    }
+}
+
+typedef struct {
+    ISeqInStream s;
+    CPipeline *pipeline;
+} CPipelineInStream;
+
+static SRes
+PipelineInStream_Read(const ISeqInStream *stream, void *buf, size_t *size)
+{
+    CPipeline *p = ((const CPipelineInStream *) stream)->pipeline;
+    size_t avail;
+    SRes res;
+
+    while (p->in == NULL || p->inPos == p->in->size) {
+        if (p->inEof) {
+            *size = 0;
+            return SZ_OK;
+        }
+        res = pipeline_next_input(p);
+        if (res != SZ_OK) {
+            return res;
+        }
+    }
+
+    avail = min(*size, p->in->size - p->inPos);
+    memcpy(buf, p->in->data + p->inPos, avail);
+    p->inPos += avail;
+    *size = avail;
+    return SZ_OK;
+}
+
+typedef struct {
+    ISeqOutStream s;
+    CPipeline *pipeline;
+} CPipelineOutStream;
+
+static size_t
+PipelineOutStream_Write(const ISeqOutStream *stream, const void *buf, size_t size)
+{
+    CPipeline *p = ((const CPipelineOutStream *) stream)->pipeline;
+    const Byte *data = (const Byte *) buf;
+    size_t remaining = size;
+
+    while (remaining > 0) {
+        CPipelineBuffer *out = pipeline_output_buffer(p);
+        size_t avail = min(remaining, PIPELINE_BUFFER_SIZE - out->size);
+        memcpy(out->data + out->size, data, avail);
+        out->size += avail;
+        data += avail;
+        remaining -= avail;
+        if (out->size == PIPELINE_BUFFER_SIZE) {
+            pipeline_submit_output(p);
+        }
+    }
+    // aborts the encoder if the output can't be written
+    return p->writeErrno == 0 ? size : 0;
+}
+
+static SRes
+pipeline_compress(CPipeline *p, CCompressionOptions *options, CLzmaEncProps *props, UInt64 size)
+{
+    CPipelineInStream inStream;
+    CPipelineOutStream outStream;
+    Byte header[ALONE_HEADER_SIZE];
+    size_t headerSize = LZMA_PROPS_SIZE;
+    SRes res;
+
+    inStream.s.Read = PipelineInStream_Read;
+    inStream.pipeline = p;
+    outStream.s.Write = PipelineOutStream_Write;
+    outStream.pipeline = p;
+
+    if (options->container == FORMAT_XZ) {
+        CXzEncHandle encoder;
+
+        encoder = XzEnc_Create(&allocator, &allocator);
+        if (encoder == NULL) {
+            return SZ_ERROR_MEM;
+        }
+        // the size of pipes is not known
+        res = pylzma_set_xz_encoder_props(encoder, options, props, size > 0 ? size : (UInt64) (Int64) -1);
+        if (res == SZ_OK) {
+            res = XzEnc_Encode(encoder, &outStream.s, &inStream.s, NULL);
+        }
+        XzEnc_Destroy(encoder);
+        return res;
+    }
+
+    if (size > 0) {
+        // the encoder keeps the full dictionary and match finder for pipes
+        pylzma_reduce_encoder_props(props, size > (size_t) -1 ? (size_t) -1 : (size_t) size);
+    }
+
+    if (options->lzma2) {
+        CLzma2EncHandle encoder;
+        CLzma2EncProps lzma2Props;
+
+        encoder = Lzma2Enc_Create(&allocator, &allocator);
+        if (encoder == NULL) {
+            return SZ_ERROR_MEM;
+        }
+        Lzma2EncProps_Init(&lzma2Props);
+        lzma2Props.lzmaProps = *props;
+        if (options->threads > 0) {
+            lzma2Props.numTotalThreads = options->threads;
+        }
+        if (options->block_size > 0) {
+            lzma2Props.blockSize = (UInt64) options->block_size;
+        }
+        res = Lzma2Enc_SetProps(encoder, &lzma2Props);
+        if (res == SZ_OK) {
+            if (size > 0) {
+                Lzma2Enc_SetDataSize(encoder, size);
+            }
+            header[0] = Lzma2Enc_WriteProperties(encoder);
+            if (outStream.s.Write(&outStream.s, header, 1) != 1) {
+                res = SZ_ERROR_WRITE;
+            } else {
+                res = Lzma2Enc_Encode2(encoder, &outStream.s, NULL, NULL, &inStream.s, NULL, 0, NULL);
+            }
+        }
+        Lzma2Enc_Destroy(encoder);
+    } else {
+        CLzmaEncHandle encoder;
+
+        encoder = LzmaEnc_Create(&allocator);
+        if (encoder == NULL) {
+            return SZ_ERROR_MEM;
+        }
+        if (options->container == FORMAT_ALONE && size == 0) {
+            // the size of pipes is not known, so the end must be marked
+            props->writeEndMark = 1;
+        }
+        res = LzmaEnc_SetProps(encoder, props);
+        if (res == SZ_OK) {
+            if (size > 0) {
+                LzmaEnc_SetDataSize(encoder, size);
+            }
+            res = LzmaEnc_WriteProperties(encoder, header, &headerSize);
+        }
+        if (res == SZ_OK && options->container == FORMAT_ALONE) {
+            SetUi64(header + headerSize, size > 0 ? size : ALONE_UNKNOWN_SIZE);
+            headerSize += 8;
+        }
+        if (res == SZ_OK) {
+            if (outStream.s.Write(&outStream.s, header, headerSize) != headerSize) {
+                res = SZ_ERROR_WRITE;
+            } else {
+                res = LzmaEnc_Encode(encoder, &outStream.s, &inStream.s, NULL, &allocator, &allocator);
+            }
+        }
+        LzmaEnc_Destroy(encoder, &allocator, &allocator);
+    }
+    return res;
+}
+
+static SRes
+pipeline_decompress_xz(CPipeline *p, UInt64 maxlength, unsigned threads, UInt64 memlimit, CXzStatInfo *stat, int *isMT)
+{
+    CPipelineInStream inStream;
+    CPipelineOutStream outStream;
+
+    inStream.s.Read = PipelineInStream_Read;
+    inStream.pipeline = p;
+    outStream.s.Write = PipelineOutStream_Write;
+    outStream.pipeline = p;
+
+    return pylzma_xz_decode(&inStream.s, &outStream.s, maxlength != (UInt64) -1 ? &maxlength : NULL, threads, memlimit, stat, isMT);
+}
+
+static SRes
+pipeline_decompress_lzma2_mt(CPipeline *p, UInt64 maxlength, unsigned threads, UInt64 memlimit, int *isMT)
+{
+    CPipelineInStream inStream;
+    CPipelineOutStream outStream;
+    Byte prop;
+    size_t size = 1;
+    SRes res;
+
+    inStream.s.Read = PipelineInStream_Read;
+    inStream.pipeline = p;
+    outStream.s.Write = PipelineOutStream_Write;
+    outStream.pipeline = p;
+
+    res = PipelineInStream_Read(&inStream.s, &prop, &size);
+    if (res != SZ_OK) {
+        return res;
+    }
+    if (size == 0) {
+        return SZ_ERROR_INPUT_EOF;
+    }
+    return pylzma_lzma2_decode(prop, &inStream.s, &outStream.s, maxlength != (UInt64) -1 ? &maxlength : NULL, threads, memlimit, isMT);
+}
+
+static SRes
+pipeline_decompress(CPipeline *p, int lzma2, int format, UInt64 maxlength)
+{
+    CBufferDecoder decoder;
+    size_t propertiesLength = lzma2 ? 1 : LZMA_PROPS_SIZE;
+    size_t headerLength = format == FORMAT_ALONE ? ALONE_HEADER_SIZE : propertiesLength;
+    size_t inSize, outSize;
+    UInt64 total = 0;
+    ELzmaStatus status;
+    SRes res;
+
+    res = pipeline_next_input(p);
+    if (res != SZ_OK) {
+        return res;
+    }
+    if (p->in->size < headerLength) {
+        return SZ_ERROR_INPUT_EOF;
+    }
+    if (format == FORMAT_ALONE) {
+        UInt64 size = GetUi64(p->in->data + LZMA_PROPS_SIZE);
+        if (size != ALONE_UNKNOWN_SIZE && size < maxlength) {
+            maxlength = size;
+        }
+    }
+
+    pylzma_init_buffer_decoder(&decoder, lzma2);
+    if (lzma2) {
+        res = Lzma2Dec_Allocate(&decoder.state.lzma2, p->in->data[0], &allocator);
+    } else {
+        res = LzmaDec_Allocate(&decoder.state.lzma, p->in->data, (unsigned) propertiesLength, &allocator);
+    }
+    if (res != SZ_OK) {
+        pylzma_free_buffer_decoder(&decoder);
+        return res;
+    }
+    if (lzma2) {
+        Lzma2Dec_Init(&decoder.state.lzma2);
+    } else {
+        LzmaDec_Init(&decoder.state.lzma);
+    }
+    p->inPos = headerLength;
+
+    // the data is decoded from the input buffers directly to the output buffers
+    for (;;) {
+        CPipelineBuffer *out = pipeline_output_buffer(p);
+
+        inSize = p->in->size - p->inPos;
+        outSize = PIPELINE_BUFFER_SIZE - out->size;
+        if (maxlength - total < outSize) {
+            outSize = (size_t) (maxlength - total);
+        }
+        if (lzma2) {
+            res = Lzma2Dec_DecodeToBuf(&decoder.state.lzma2, out->data + out->size, &outSize,
+                p->in->data + p->inPos, &inSize, LZMA_FINISH_ANY, &status);
+        } else {
+            res = LzmaDec_DecodeToBuf(&decoder.state.lzma, out->data + out->size, &outSize,
+                p->in->data + p->inPos, &inSize, LZMA_FINISH_ANY, &status);
+        }
+        p->inPos += inSize;
+        out->size += outSize;
+        total += outSize;
+        if (res != SZ_OK || status == LZMA_STATUS_FINISHED_WITH_MARK || total == maxlength) {
+            break;
+        }
+        if (p->writeErrno != 0) {
+            res = SZ_ERROR_WRITE;
+            break;
+        }
+        if (out->size == PIPELINE_BUFFER_SIZE) {
+            pipeline_submit_output(p);
+        }
+        if (p->inPos == p->in->size) {
+            if (!p->inEof) {
+                res = pipeline_next_input(p);
+                if (res != SZ_OK) {
+                    break;
+                }
+            } else if (outSize == 0) {
+                if (status == LZMA_STATUS_NEEDS_MORE_INPUT) {
+                    res = SZ_ERROR_INPUT_EOF;
+                }
+                // otherwise a stream without end marker
+                break;
+            }
+        }
+    }
+
+    pylzma_free_buffer_decoder(&decoder);
+    return res;
+}
+
+typedef struct {
+    // paths as passed by the caller and encoded for the file system
+    PyObject *srcName;
+    PyObject *dstName;
+    PyObject *src;
+    PyObject *dst;
+    int inFd;
+    int outFd;
+    int openErrno;
+    PyObject *openFilename;
+    int sameFile;
+    UInt64 size;
+    CPipeline pipeline;
+    double duration;
+    // statistics of multithreaded decoders
+    int threaded;
+    int isMT;
+    int xz;
+    CXzStatInfo stat;
+} CFileJob;
+
+static int
+file_job_init(CFileJob *job)
+{
+    if (!PyUnicode_FSConverter(job->srcName, &job->src) || !PyUnicode_FSConverter(job->dstName, &job->dst)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Open the files without the GIL.
+static void
+file_job_open(CFileJob *job)
+{
+    struct stat st;
+
+    job->inFd = job->outFd = -1;
+    job->inFd = open(PyBytes_AS_STRING(job->src), O_RDONLY | O_BINARY | O_CLOEXEC);
+    if (job->inFd == -1) {
+        job->openErrno = errno;
+        job->openFilename = job->srcName;
+        return;
+    }
+    job->size = 0;
+    if (fstat(job->inFd, &st) == 0) {
+#ifndef _WIN32
+        struct stat dstSt;
+
+        // opening the destination would truncate the input before it is read
+        if (stat(PyBytes_AS_STRING(job->dst), &dstSt) == 0 && dstSt.st_dev == st.st_dev && dstSt.st_ino == st.st_ino) {
+            job->sameFile = 1;
+            return;
+        }
+#endif
+        if (st.st_size > 0) {
+            job->size = (UInt64) st.st_size;
+        }
+    }
+    job->outFd = open(PyBytes_AS_STRING(job->dst), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY | O_CLOEXEC, 0666);
+    if (job->outFd == -1) {
+        job->openErrno = errno;
+        job->openFilename = job->dstName;
+    }
+}
+
+static void
+file_job_close(CFileJob *job)
+{
+    if (job->inFd != -1) {
+        close(job->inFd);
+    }
+    if (job->outFd != -1 && close(job->outFd) != 0 && job->pipeline.writeErrno == 0) {
+        job->pipeline.writeErrno = errno;
+    }
+}
+
+// Set the exception after the job failed and return the statistics otherwise.
+static PyObject *
+file_job_result(CFileJob *job, SRes res, void (*set_error)(SRes))
+{
+    CPipeline *p = &job->pipeline;
+    PyObject *result;
+    PyObject *decoder;
+
+    if (job->openErrno != 0) {
+        errno = job->openErrno;
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, job->openFilename);
+    } else if (job->sameFile) {
+        PyErr_SetString(PyExc_ValueError, "src and dst must be different files");
+        return NULL;
+    } else if (p->readErrno != 0) {
+        errno = p->readErrno;
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, job->srcName);
+    } else if (p->writeErrno != 0) {
+        errno = p->writeErrno;
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, job->dstName);
+    } else if (res != SZ_OK) {
+        set_error(res);
+        return NULL;
+    }
+
+    result = Py_BuildValue("{s:K,s:K,s:d,s:d,s:d,s:d,s:d}",
+        "bytes_read", (unsigned PY_LONG_LONG) p->bytesRead,
+        "bytes_written", (unsigned PY_LONG_LONG) p->bytesWritten,
+        "time", job->duration,
+        "reader_stall", p->readerStall,
+        "codec_input_stall", p->codecInputStall,
+        "codec_output_stall", p->codecOutputStall,
+        "writer_stall", p->writerStall);
+    if (result == NULL || !job->threaded) {
+        return result;
+    }
+
+    if (job->xz) {
+        decoder = Py_BuildValue("{s:K,s:K,s:O}",
+            "streams", (unsigned PY_LONG_LONG) job->stat.NumStreams,
+            "blocks", (unsigned PY_LONG_LONG) job->stat.NumBlocks,
+            "multithreaded", job->isMT ? Py_True : Py_False);
+    } else {
+        decoder = Py_BuildValue("{s:O}", "multithreaded", job->isMT ? Py_True : Py_False);
+    }
+    if (decoder == NULL || PyDict_Update(result, decoder) != 0) {
+        DEC_AND_NULL(result);
+    }
+    Py_XDECREF(decoder);
+    return result;
+}
+
+const char
+doc_compress_file[] = \
+    "compress_file(src, dst, **options) -- Compress the file with path src to the file with path dst using the same " \
+    "options as compress (except store_if_incompressible). The files are read and written by separate threads while " \
+    "the data is being compressed without holding the GIL. Returns a dictionary with the number of bytes_read and " \
+    "bytes_written, the wall time and the time in seconds the reader, codec (waiting for input and output) and writer " \
+    "stalled waiting for the other stages. With format='xz', blocks of the input are compressed in parallel by up to " \
+    "threads threads while the file is being read.";
+
+PyObject *
+pylzma_compress_file(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *result = NULL;
+    CCompressionOptions options;
+    CLzmaEncProps props;
+    CFileJob job;
+    SRes res = SZ_OK;
+    // possible keywords for this function
+    static char *kwlist[] = {"src", "dst", COMPRESSION_OPTIONS_KWLIST, NULL};
+
+    memset(&job, 0, sizeof(job));
+    pylzma_init_compression_options(&options);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|" COMPRESSION_OPTIONS_FORMAT, kwlist, &job.srcName, &job.dstName,
+                                                                  COMPRESSION_OPTIONS_ARGS(options)))
+        goto exit;
+
+    if (file_job_init(&job) != 0) {
+        goto exit;
+    }
+
+    if (options.store_if_incompressible) {
+        PyErr_SetString(PyExc_ValueError, "store_if_incompressible is not supported when compressing files");
+        goto exit;
+    }
+    if (pylzma_parse_compression_options(&options, &props) != 0) {
+        goto exit;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    file_job_open(&job);
+    if (job.openErrno == 0 && !job.sameFile) {
+        double start = pipeline_clock();
+        if (pipeline_init(&job.pipeline, job.inFd, job.outFd) != 0) {
+            res = SZ_ERROR_MEM;
+        } else {
+            res = pipeline_compress(&job.pipeline, &options, &props, job.size);
+        }
+        pipeline_end_output(&job.pipeline);
+        pipeline_end_input(&job.pipeline);
+        pipeline_free(&job.pipeline);
+        job.duration = pipeline_clock() - start;
+    }
+    file_job_close(&job);
+    Py_END_ALLOW_THREADS
+
+    result = file_job_result(&job, res, pylzma_set_compression_error);
+
+exit:
+    Py_XDECREF(job.src);
+    Py_XDECREF(job.dst);
+    return result;
+}
+
+const char
+doc_decompress_file[] = \
+    "decompress_file(src, dst, maxlength=-1, lzma2=0, format=None, threads=1, memlimit=0) -- Decompress the file with " \
+    "path src to the file with path dst. If the data has been compressed without an EOS marker, you must provide the " \
+    "maximum length. The files are read and written by separate threads while the data is being decompressed without " \
+    "holding the GIL. Returns a dictionary with the same statistics as compress_file. With format='xz' or lzma2 and " \
+    "threads, blocks are decoded in parallel like by decompress and the dictionary also contains if multithreaded " \
+    "decoding was used and for xz the number of streams and blocks.";
+
+PyObject *
+pylzma_decompress_file(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *result = NULL;
+    CFileJob job;
+    PY_LONG_LONG maxlength = -1;
+    int lzma2 = 0;
+    const char *formatName = NULL;
+    int format;
+    int threads = 1;
+    PY_LONG_LONG memlimit = 0;
+    SRes res = SZ_OK;
+    // possible keywords for this function
+    static char *kwlist[] = {"src", "dst", "maxlength", "lzma2", "format", "threads", "memlimit", NULL};
+
+    memset(&job, 0, sizeof(job));
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|LiziL", kwlist, &job.srcName, &job.dstName, &maxlength, &lzma2,
+                                                                  &formatName, &threads, &memlimit))
+        goto exit;
+
+    if (file_job_init(&job) != 0) {
+        goto exit;
+    }
+
+    if (maxlength < -1) {
+        PyErr_SetString(PyExc_ValueError, "maxlength must be -1 or greater");
+        goto exit;
+    }
+    format = pylzma_parse_format(formatName, lzma2);
+    if (format < 0 || pylzma_parse_decoder_threads(&threads, memlimit, format, lzma2) != 0) {
+        goto exit;
+    }
+    job.xz = format == FORMAT_XZ;
+    job.threaded = job.xz || threads > 1;
+
+    Py_BEGIN_ALLOW_THREADS
+    file_job_open(&job);
+    if (job.openErrno == 0 && !job.sameFile) {
+        double start = pipeline_clock();
+        if (pipeline_init(&job.pipeline, job.inFd, job.outFd) != 0) {
+            res = SZ_ERROR_MEM;
+        } else if (job.xz) {
+            res = pipeline_decompress_xz(&job.pipeline, (UInt64) maxlength, (unsigned) threads, (UInt64) memlimit, &job.stat, &job.isMT);
+        } else if (job.threaded) {
+            res = pipeline_decompress_lzma2_mt(&job.pipeline, (UInt64) maxlength, (unsigned) threads, (UInt64) memlimit, &job.isMT);
+        } else {
+            res = pipeline_decompress(&job.pipeline, lzma2, format, (UInt64) maxlength);
+        }
+        pipeline_end_output(&job.pipeline);
+        pipeline_end_input(&job.pipeline);
+        pipeline_free(&job.pipeline);
+        job.duration = pipeline_clock() - start;
+    }
+    file_job_close(&job);
+    Py_END_ALLOW_THREADS
+
+    result = file_job_result(&job, res, pylzma_set_decompression_error);
+
+exit:
+    Py_XDECREF(job.src);
+    Py_XDECREF(job.dst);
+    return result;
+}
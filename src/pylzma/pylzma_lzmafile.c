@@ -0,0 +1,1375 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+#include <Python.h>
+
+#include "../sdk/C/CpuArch.h"
+#include "../sdk/C/LzmaDec.h"
+#include "../sdk/C/Lzma2Dec.h"
+
+#include "pylzma.h"
+#include "pylzma_compressobj.h"
+#include "pylzma_decompress.h"
+#include "pylzma_lzmafile.h"
+
+// Compressed data is read from the file in blocks of this size.
+#define READ_SIZE       BLOCK_SIZE
+// Maximum number of bytes that are decompressed at once.
+#define DECODE_SIZE     (4 * BLOCK_SIZE)
+// Written data is passed to the compressor in blocks of this size.
+#define WRITE_SIZE      (1024 * 1024)
+
+#define MODE_CLOSED     0
+#define MODE_READ       1
+#define MODE_WRITE      2
+
+static PyObject *UnsupportedOperation = NULL;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *file;
+    int closeFile;
+    int mode;
+    // position in the uncompressed data
+    PY_LONG_LONG pos;
+    // reading
+    int lzma2;
+    int format;
+    int readinto;
+    int seekable;
+    // offset of the compressed stream in the file
+    PY_LONG_LONG start;
+    PY_LONG_LONG max_length;
+    union {
+        CLzmaDec lzma;
+        CLzma2Dec lzma2;
+    } state;
+    CLzmaDec *decoder;
+    int need_properties;
+    int eof;
+    Byte *input;
+    size_t inputPos;
+    size_t inputSize;
+    // The decompressed data is read from the dictionary, the data that has not
+    // been read yet starts at this offset and ends at the dictionary position.
+    SizeT outPos;
+    // writing
+    PyObject *compressor;
+    Byte *output;
+    size_t outputSize;
+    // the buffers and the decoder are in use while the GIL may be released
+    // by the decoder or by calls of the file and compressor objects
+    int busy;
+} CLZMAFileObject;
+
+static int
+pylzma_lzmafile_check_busy(CLZMAFileObject *self)
+{
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "LZMAFile is used by another thread");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+pylzma_lzmafile_check(CLZMAFileObject *self, int mode)
+{
+    if (pylzma_lzmafile_check_busy(self) != 0) {
+        return -1;
+    }
+    if (self->mode == MODE_CLOSED) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+        return -1;
+    }
+    if (mode != MODE_CLOSED && self->mode != mode) {
+        PyErr_SetString(UnsupportedOperation, mode == MODE_READ ? "File not open for reading" : "File not open for writing");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+pylzma_lzmafile_view(Byte *data, size_t size, int writable)
+{
+#if PY_MAJOR_VERSION >= 3
+    return PyMemoryView_FromMemory((char *) data, (Py_ssize_t) size, writable ? PyBUF_WRITE : PyBUF_READ);
+#else
+    if (writable) {
+        return PyBuffer_FromReadWriteMemory(data, (Py_ssize_t) size);
+    }
+    return PyBuffer_FromMemory(data, (Py_ssize_t) size);
+#endif
+}
+
+// Number of decompressed bytes that can be read without decoding.
+static size_t
+pylzma_lzmafile_available(CLZMAFileObject *self)
+{
+    if (self->need_properties) {
+        return 0;
+    }
+    return self->decoder->dicPos - self->outPos;
+}
+
+static void
+pylzma_lzmafile_consume(CLZMAFileObject *self, size_t size)
+{
+    self->outPos += size;
+    self->pos += size;
+}
+
+// Read compressed data from the file to the input buffer, returns the number
+// of bytes read (0 at the end of the file) or -1 on errors.
+static Py_ssize_t
+pylzma_lzmafile_fill(CLZMAFileObject *self)
+{
+    PyObject *view;
+    PyObject *data;
+    Py_ssize_t count;
+    size_t size;
+
+    if (self->inputPos > 0) {
+        memmove(self->input, self->input + self->inputPos, self->inputSize - self->inputPos);
+        self->inputSize -= self->inputPos;
+        self->inputPos = 0;
+    }
+
+    size = READ_SIZE - self->inputSize;
+    if (self->readinto) {
+        view = pylzma_lzmafile_view(self->input + self->inputSize, size, 1);
+        if (view == NULL) {
+            return -1;
+        }
+        self->busy = 1;
+        data = PyObject_CallMethod(self->file, "readinto", "O", view);
+        self->busy = 0;
+        Py_DECREF(view);
+        if (data == NULL) {
+            return -1;
+        }
+        // "None" is returned by non-blocking files without available data
+        count = data == Py_None ? 0 : PyNumber_AsSsize_t(data, PyExc_OverflowError);
+        Py_DECREF(data);
+        if (count == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (count < 0 || (size_t) count > size) {
+            PyErr_SetString(PyExc_IOError, "invalid result from readinto");
+            return -1;
+        }
+    } else {
+        self->busy = 1;
+        data = PyObject_CallMethod(self->file, "read", "n", (Py_ssize_t) size);
+        self->busy = 0;
+        if (data == NULL) {
+            return -1;
+        }
+        if (!PyBytes_Check(data)) {
+            Py_DECREF(data);
+            PyErr_SetString(PyExc_TypeError, "read() should return bytes");
+            return -1;
+        }
+        count = min(PyBytes_GET_SIZE(data), (Py_ssize_t) size);
+        memcpy(self->input + self->inputSize, PyBytes_AS_STRING(data), count);
+        Py_DECREF(data);
+    }
+    self->inputSize += count;
+    return count;
+}
+
+static int
+pylzma_lzmafile_read_properties(CLZMAFileObject *self)
+{
+    size_t propertiesLength = self->lzma2 ? 1 : LZMA_PROPS_SIZE;
+    size_t headerLength = self->format == FORMAT_ALONE ? ALONE_HEADER_SIZE : propertiesLength;
+    Py_ssize_t count;
+    SRes res;
+
+    while (self->inputSize - self->inputPos < headerLength) {
+        count = pylzma_lzmafile_fill(self);
+        if (count < 0) {
+            return -1;
+        } else if (count == 0) {
+            if (self->inputSize == self->inputPos) {
+                // empty file
+                self->eof = 1;
+                return 0;
+            }
+            PyErr_SetString(PyExc_EOFError, "Compressed file ended before the end-of-stream marker was reached");
+            return -1;
+        }
+    }
+
+    // dictionary and probabilities are only reallocated if the properties change
+    if (self->lzma2) {
+        res = Lzma2Dec_Allocate(&self->state.lzma2, self->input[self->inputPos], &allocator);
+    } else {
+        res = LzmaDec_Allocate(&self->state.lzma, self->input + self->inputPos, (unsigned) propertiesLength, &allocator);
+    }
+    if (res != SZ_OK) {
+        pylzma_set_decompression_error(res);
+        return -1;
+    }
+
+    if (self->format == FORMAT_ALONE) {
+        // the size from the header limits the output like maxlength
+        UInt64 size = GetUi64(self->input + self->inputPos + LZMA_PROPS_SIZE);
+        if (size != ALONE_UNKNOWN_SIZE && size <= (UInt64) PY_LLONG_MAX &&
+            (self->max_length == -1 || size < (UInt64) self->max_length)) {
+            self->max_length = (PY_LONG_LONG) size;
+        }
+    }
+
+    self->inputPos += headerLength;
+    if (self->lzma2) {
+        Lzma2Dec_Init(&self->state.lzma2);
+    } else {
+        LzmaDec_Init(&self->state.lzma);
+    }
+    self->outPos = 0;
+    self->need_properties = 0;
+    return 0;
+}
+
+// Decompress the next block into the dictionary, must only be called if all
+// available data has been read. Returns the number of bytes decompressed (0
+// at the end of the stream) or -1 on errors.
+static Py_ssize_t
+pylzma_lzmafile_decode(CLZMAFileObject *self)
+{
+    CLzmaDec *decoder = self->decoder;
+    ELzmaStatus status;
+    SizeT limit, inSize, outSize;
+    Py_ssize_t count;
+    SRes res;
+
+    if (self->need_properties && !self->eof && pylzma_lzmafile_read_properties(self) != 0) {
+        return -1;
+    }
+
+    while (!self->eof) {
+        if (decoder->dicPos == decoder->dicBufSize) {
+            decoder->dicPos = 0;
+        }
+        self->outPos = decoder->dicPos;
+        limit = decoder->dicBufSize - decoder->dicPos < DECODE_SIZE ? decoder->dicBufSize : decoder->dicPos + DECODE_SIZE;
+        if (self->max_length != -1 && (unsigned PY_LONG_LONG) (self->max_length - self->pos) < limit - decoder->dicPos) {
+            limit = decoder->dicPos + (SizeT) (self->max_length - self->pos);
+        }
+
+        count = 1;
+        if (self->inputPos == self->inputSize) {
+            count = pylzma_lzmafile_fill(self);
+            if (count < 0) {
+                return -1;
+            }
+        }
+
+        inSize = self->inputSize - self->inputPos;
+        self->busy = 1;
+        Py_BEGIN_ALLOW_THREADS
+        if (self->lzma2) {
+            res = Lzma2Dec_DecodeToDic(&self->state.lzma2, limit, self->input + self->inputPos, &inSize, LZMA_FINISH_ANY, &status);
+        } else {
+            res = LzmaDec_DecodeToDic(&self->state.lzma, limit, self->input + self->inputPos, &inSize, LZMA_FINISH_ANY, &status);
+        }
+        Py_END_ALLOW_THREADS
+        self->busy = 0;
+        self->inputPos += inSize;
+        outSize = decoder->dicPos - self->outPos;
+        if (res != SZ_OK) {
+            PyErr_SetString(PyExc_ValueError, "data error during decompression");
+            return -1;
+        }
+
+        if (status == LZMA_STATUS_FINISHED_WITH_MARK ||
+            (self->max_length != -1 && self->pos + (PY_LONG_LONG) outSize >= self->max_length)) {
+            self->eof = 1;
+        } else if (count == 0 && outSize == 0) {
+            // the file ended, streams without end marker are complete if
+            // the decoder is at the end of a symbol which is only reported
+            // when the output limit is reached
+            inSize = 0;
+            if (self->lzma2) {
+                res = Lzma2Dec_DecodeToDic(&self->state.lzma2, decoder->dicPos, self->input, &inSize, LZMA_FINISH_ANY, &status);
+            } else {
+                res = LzmaDec_DecodeToDic(&self->state.lzma, decoder->dicPos, self->input, &inSize, LZMA_FINISH_ANY, &status);
+            }
+            if (res != SZ_OK || status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK) {
+                PyErr_SetString(PyExc_EOFError, "Compressed file ended before the end-of-stream marker was reached");
+                return -1;
+            }
+            self->eof = 1;
+        }
+        if (outSize > 0) {
+            return (Py_ssize_t) outSize;
+        }
+    }
+    return 0;
+}
+
+// Read up to "size" bytes to "dest", decoding at most one block if "single"
+// is set. Returns the number of bytes read or -1 on errors.
+static Py_ssize_t
+pylzma_lzmafile_read_into(CLZMAFileObject *self, Byte *dest, size_t size, int single)
+{
+    size_t length = 0;
+    size_t available;
+    Py_ssize_t count;
+    int decoded = 0;
+
+    while (length < size) {
+        available = pylzma_lzmafile_available(self);
+        if (available == 0) {
+            if (single && (decoded || length > 0)) {
+                break;
+            }
+            count = pylzma_lzmafile_decode(self);
+            if (count < 0) {
+                return -1;
+            } else if (count == 0) {
+                break;
+            }
+            decoded = 1;
+            available = (size_t) count;
+        }
+
+        available = min(available, size - length);
+        memcpy(dest + length, self->decoder->dic + self->outPos, available);
+        pylzma_lzmafile_consume(self, available);
+        length += available;
+    }
+    return (Py_ssize_t) length;
+}
+
+// Skip "size" bytes of decompressed data or everything if "size" is negative.
+static int
+pylzma_lzmafile_skip(CLZMAFileObject *self, PY_LONG_LONG size)
+{
+    size_t available;
+    Py_ssize_t count;
+
+    while (size != 0) {
+        available = pylzma_lzmafile_available(self);
+        if (available == 0) {
+            count = pylzma_lzmafile_decode(self);
+            if (count < 0) {
+                return -1;
+            } else if (count == 0) {
+                break;
+            }
+            available = (size_t) count;
+        }
+
+        if (size > 0 && (unsigned PY_LONG_LONG) size < available) {
+            available = (size_t) size;
+        }
+        pylzma_lzmafile_consume(self, available);
+        if (size > 0) {
+            size -= available;
+        }
+    }
+    return 0;
+}
+
+// Start decompressing from the beginning of the stream.
+static int
+pylzma_lzmafile_rewind(CLZMAFileObject *self)
+{
+    PyObject *result;
+
+    self->busy = 1;
+    result = PyObject_CallMethod(self->file, "seek", "L", self->start);
+    self->busy = 0;
+    if (result == NULL) {
+        return -1;
+    }
+    Py_DECREF(result);
+
+    self->inputPos = self->inputSize = 0;
+    self->need_properties = 1;
+    self->eof = 0;
+    self->pos = 0;
+    self->outPos = 0;
+    return 0;
+}
+
+// Pass data to the compressor and write the compressed data to the file.
+static int
+pylzma_lzmafile_write_output(CLZMAFileObject *self, PyObject *data)
+{
+    PyObject *result;
+
+    if (data == NULL) {
+        return -1;
+    }
+    if (PyBytes_GET_SIZE(data) > 0) {
+        self->busy = 1;
+        result = PyObject_CallMethod(self->file, "write", "O", data);
+        self->busy = 0;
+        Py_DECREF(data);
+        if (result == NULL) {
+            return -1;
+        }
+        Py_DECREF(result);
+    } else {
+        Py_DECREF(data);
+    }
+    return 0;
+}
+
+static int
+pylzma_lzmafile_compress(CLZMAFileObject *self, Byte *data, size_t size)
+{
+    PyObject *view;
+    PyObject *result;
+
+    if (size == 0) {
+        return 0;
+    }
+    view = pylzma_lzmafile_view(data, size, 0);
+    if (view == NULL) {
+        return -1;
+    }
+    // the compressor reads the output buffer without holding the GIL
+    self->busy = 1;
+    result = PyObject_CallMethod(self->compressor, "compress", "O", view);
+    self->busy = 0;
+    Py_DECREF(view);
+    return pylzma_lzmafile_write_output(self, result);
+}
+
+static void
+pylzma_lzmafile_free(CLZMAFileObject *self)
+{
+    if (self->decoder != NULL) {
+        if (self->lzma2) {
+            Lzma2Dec_Free(&self->state.lzma2, &allocator);
+        } else {
+            LzmaDec_Free(&self->state.lzma, &allocator);
+        }
+        self->decoder = NULL;
+    }
+    FREE_AND_NULL(self->input);
+    FREE_AND_NULL(self->output);
+    DEC_AND_NULL(self->compressor);
+    DEC_AND_NULL(self->file);
+}
+
+static const char
+doc_lzmafile_read[] = \
+    "read([size]) -- Read up to size decompressed bytes, everything until the end of the stream if size is " \
+    "negative or omitted. Returns an empty string at the end of the stream.";
+
+static PyObject *
+pylzma_lzmafile_read(CLZMAFileObject *self, PyObject *args)
+{
+    PyObject *result;
+    Py_ssize_t size = -1;
+    size_t length = 0;
+    size_t capacity;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "|n", &size))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    // the result grows geometrically if the size is not known
+    capacity = pylzma_lzmafile_available(self);
+    if (capacity < DECODE_SIZE) {
+        capacity = DECODE_SIZE;
+    }
+    if (size >= 0 && (size_t) size < capacity) {
+        capacity = (size_t) size;
+    }
+    result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) capacity);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    for (;;) {
+        count = pylzma_lzmafile_read_into(self, (Byte *) PyBytes_AS_STRING(result) + length, capacity - length, 0);
+        if (count < 0) {
+            DEC_AND_NULL(result);
+            return NULL;
+        }
+        length += count;
+        if (length < capacity || (size >= 0 && length == (size_t) size)) {
+            break;
+        }
+
+        capacity = capacity > (size_t) PY_SSIZE_T_MAX / 2 ? (size_t) PY_SSIZE_T_MAX : capacity * 2;
+        if (size >= 0 && (size_t) size < capacity) {
+            capacity = (size_t) size;
+        }
+        if (_PyBytes_Resize(&result, (Py_ssize_t) capacity) != 0) {
+            return NULL;
+        }
+    }
+
+    if (length < capacity) {
+        _PyBytes_Resize(&result, (Py_ssize_t) length);
+    }
+    return result;
+}
+
+static const char
+doc_lzmafile_read1[] = \
+    "read1([size]) -- Read up to size decompressed bytes, decompressing at most one block. Returns an empty " \
+    "string at the end of the stream.";
+
+static PyObject *
+pylzma_lzmafile_read1(CLZMAFileObject *self, PyObject *args)
+{
+    PyObject *result;
+    Py_ssize_t size = -1;
+    size_t available;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "|n", &size))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    available = pylzma_lzmafile_available(self);
+    if (available == 0 && size != 0) {
+        count = pylzma_lzmafile_decode(self);
+        if (count < 0) {
+            return NULL;
+        }
+        available = (size_t) count;
+    }
+    if (size >= 0 && (size_t) size < available) {
+        available = (size_t) size;
+    }
+
+    result = PyBytes_FromStringAndSize(available > 0 ? (const char *) self->decoder->dic + self->outPos : NULL, (Py_ssize_t) available);
+    if (result != NULL) {
+        pylzma_lzmafile_consume(self, available);
+    }
+    return result;
+}
+
+static PyObject *
+pylzma_lzmafile_read_buffer(CLZMAFileObject *self, PyObject *args, int single)
+{
+    Py_buffer buffer;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "w*", &buffer))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    count = pylzma_lzmafile_read_into(self, (Byte *) buffer.buf, (size_t) buffer.len, single);
+    PyBuffer_Release(&buffer);
+    if (count < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(count);
+}
+
+static const char
+doc_lzmafile_readinto[] = \
+    "readinto(buffer) -- Read decompressed bytes into the writable buffer, returning the number of bytes read.";
+
+static PyObject *
+pylzma_lzmafile_readinto(CLZMAFileObject *self, PyObject *args)
+{
+    return pylzma_lzmafile_read_buffer(self, args, 0);
+}
+
+static const char
+doc_lzmafile_readinto1[] = \
+    "readinto1(buffer) -- Read decompressed bytes into the writable buffer, decompressing at most one block.";
+
+static PyObject *
+pylzma_lzmafile_readinto1(CLZMAFileObject *self, PyObject *args)
+{
+    return pylzma_lzmafile_read_buffer(self, args, 1);
+}
+
+static const char
+doc_lzmafile_peek[] = \
+    "peek([size]) -- Return buffered decompressed data without advancing the position. At least one byte is " \
+    "returned unless the end of the stream was reached, the size is ignored.";
+
+static PyObject *
+pylzma_lzmafile_peek(CLZMAFileObject *self, PyObject *args)
+{
+    Py_ssize_t size = 0;
+    size_t available;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "|n", &size))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    available = pylzma_lzmafile_available(self);
+    if (available == 0) {
+        count = pylzma_lzmafile_decode(self);
+        if (count < 0) {
+            return NULL;
+        }
+        available = (size_t) count;
+    }
+    return PyBytes_FromStringAndSize(available > 0 ? (const char *) self->decoder->dic + self->outPos : NULL, (Py_ssize_t) available);
+}
+
+// Read a line of at most "size" bytes (unlimited if negative).
+static PyObject *
+pylzma_lzmafile_read_line(CLZMAFileObject *self, Py_ssize_t size)
+{
+    PyObject *result = NULL;
+    size_t length = 0;
+    size_t available;
+    const Byte *start;
+    const Byte *end;
+    Py_ssize_t count;
+
+    while (size < 0 || length < (size_t) size) {
+        available = pylzma_lzmafile_available(self);
+        if (available == 0) {
+            count = pylzma_lzmafile_decode(self);
+            if (count < 0) {
+                DEC_AND_NULL(result);
+                return NULL;
+            } else if (count == 0) {
+                break;
+            }
+            available = (size_t) count;
+        }
+
+        if (size >= 0 && (size_t) size - length < available) {
+            available = (size_t) size - length;
+        }
+        start = self->decoder->dic + self->outPos;
+        end = (const Byte *) memchr(start, '\n', available);
+        if (end != NULL) {
+            available = (size_t) (end - start) + 1;
+        }
+
+        if (result == NULL && (end != NULL || (size >= 0 && available == (size_t) size))) {
+            // the line is contained in the decompressed block
+            result = PyBytes_FromStringAndSize((const char *) start, (Py_ssize_t) available);
+            if (result != NULL) {
+                pylzma_lzmafile_consume(self, available);
+            }
+            return result;
+        }
+
+        if (result == NULL) {
+            result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) available);
+            if (result == NULL) {
+                return NULL;
+            }
+        } else if (_PyBytes_Resize(&result, (Py_ssize_t) (length + available)) != 0) {
+            return NULL;
+        }
+        memcpy(PyBytes_AS_STRING(result) + length, start, available);
+        pylzma_lzmafile_consume(self, available);
+        length += available;
+        if (end != NULL) {
+            break;
+        }
+    }
+
+    if (result == NULL) {
+        result = PyBytes_FromString("");
+    }
+    return result;
+}
+
+static const char
+doc_lzmafile_readline[] = \
+    "readline([size]) -- Read a line of decompressed data including the newline, at most size bytes are read " \
+    "if size is given. Returns an empty string at the end of the stream.";
+
+static PyObject *
+pylzma_lzmafile_readline(CLZMAFileObject *self, PyObject *args)
+{
+    Py_ssize_t size = -1;
+
+    if (!PyArg_ParseTuple(args, "|n", &size))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    return pylzma_lzmafile_read_line(self, size);
+}
+
+static const char
+doc_lzmafile_readlines[] = \
+    "readlines([hint]) -- Return a list of all remaining lines. If hint is given, no more lines are read after " \
+    "their total size exceeded it.";
+
+static PyObject *
+pylzma_lzmafile_readlines(CLZMAFileObject *self, PyObject *args)
+{
+    PyObject *result;
+    PyObject *line;
+    Py_ssize_t hint = -1;
+    Py_ssize_t total = 0;
+
+    if (!PyArg_ParseTuple(args, "|n", &hint))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    result = PyList_New(0);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        line = pylzma_lzmafile_read_line(self, -1);
+        if (line == NULL) {
+            DEC_AND_NULL(result);
+            break;
+        } else if (PyBytes_GET_SIZE(line) == 0) {
+            Py_DECREF(line);
+            break;
+        }
+        total += PyBytes_GET_SIZE(line);
+        if (PyList_Append(result, line) != 0) {
+            Py_DECREF(line);
+            DEC_AND_NULL(result);
+            break;
+        }
+        Py_DECREF(line);
+        if (hint > 0 && total >= hint) {
+            break;
+        }
+    }
+    return result;
+}
+
+static const char
+doc_lzmafile_write[] = \
+    "write(data) -- Compress data and write it to the file, returning the number of uncompressed bytes written. " \
+    "Some data may be buffered until the file is flushed or closed.";
+
+static PyObject *
+pylzma_lzmafile_write(CLZMAFileObject *self, PyObject *args)
+{
+    PyObject *result = NULL;
+    Py_buffer data;
+
+    if (!PyArg_ParseTuple(args, "s*", &data))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_WRITE) != 0) {
+        goto exit;
+    }
+
+    if (self->outputSize + (size_t) data.len > WRITE_SIZE) {
+        if (pylzma_lzmafile_compress(self, self->output, self->outputSize) != 0) {
+            goto exit;
+        }
+        self->outputSize = 0;
+    }
+    if ((size_t) data.len >= WRITE_SIZE) {
+        // large writes don't need to go through the buffer
+        if (pylzma_lzmafile_compress(self, (Byte *) data.buf, (size_t) data.len) != 0) {
+            goto exit;
+        }
+    } else {
+        memcpy(self->output + self->outputSize, data.buf, data.len);
+        self->outputSize += data.len;
+    }
+    self->pos += data.len;
+    result = PyLong_FromSsize_t(data.len);
+
+exit:
+    PyBuffer_Release(&data);
+    return result;
+}
+
+static const char
+doc_lzmafile_seek[] = \
+    "seek(offset[, whence]) -- Change the position in the decompressed data, returning the new position.\n" \
+    "Seeking forward decompresses and discards the data, seeking backward starts decompressing from the " \
+    "beginning of the stream.";
+
+static PyObject *
+pylzma_lzmafile_seek(CLZMAFileObject *self, PyObject *args)
+{
+    PY_LONG_LONG offset;
+    PY_LONG_LONG target;
+    int whence = 0;
+
+    if (!PyArg_ParseTuple(args, "L|i", &offset, &whence))
+        return NULL;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    if (!self->seekable) {
+        PyErr_SetString(UnsupportedOperation, "The underlying file object does not support seeking");
+        return NULL;
+    }
+
+    switch (whence) {
+    case 0:
+        target = offset;
+        break;
+    case 1:
+        target = self->pos + offset;
+        break;
+    case 2:
+        // the size is only known after decompressing everything
+        if (pylzma_lzmafile_skip(self, -1) != 0) {
+            return NULL;
+        }
+        target = self->pos + offset;
+        break;
+    default:
+        PyErr_Format(PyExc_ValueError, "Invalid value for whence: %d", whence);
+        return NULL;
+    }
+
+    if (target < self->pos && pylzma_lzmafile_rewind(self) != 0) {
+        return NULL;
+    }
+    if (target > self->pos && pylzma_lzmafile_skip(self, target - self->pos) != 0) {
+        return NULL;
+    }
+    return PyLong_FromLongLong(self->pos);
+}
+
+static const char
+doc_lzmafile_tell[] = \
+    "tell() -- Return the current position in the uncompressed data.";
+
+static PyObject *
+pylzma_lzmafile_tell(CLZMAFileObject *self, PyObject *args)
+{
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+    return PyLong_FromLongLong(self->pos);
+}
+
+static const char
+doc_lzmafile_flush[] = \
+    "flush() -- Pass buffered data to the compressor and flush the underlying file. The LZMA stream is not " \
+    "ended, so some data may still be kept by the compressor.";
+
+static PyObject *
+pylzma_lzmafile_flush(CLZMAFileObject *self, PyObject *args)
+{
+    PyObject *result;
+
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+
+    if (self->mode == MODE_WRITE) {
+        if (pylzma_lzmafile_compress(self, self->output, self->outputSize) != 0) {
+            return NULL;
+        }
+        self->outputSize = 0;
+        if (PyObject_HasAttrString(self->file, "flush")) {
+            self->busy = 1;
+            result = PyObject_CallMethod(self->file, "flush", NULL);
+            self->busy = 0;
+            if (result == NULL) {
+                return NULL;
+            }
+            Py_DECREF(result);
+        }
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static const char
+doc_lzmafile_close[] = \
+    "close() -- Finish the compressed stream when writing and close the file. The underlying file object is " \
+    "only closed if the file was opened from a filename.";
+
+static PyObject *
+pylzma_lzmafile_close(CLZMAFileObject *self, PyObject *args)
+{
+    PyObject *result;
+    int res = 0;
+
+    if (pylzma_lzmafile_check_busy(self) != 0) {
+        return NULL;
+    }
+
+    if (self->mode == MODE_CLOSED) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    if (self->mode == MODE_WRITE) {
+        res = pylzma_lzmafile_compress(self, self->output, self->outputSize);
+        if (res == 0) {
+            self->busy = 1;
+            result = PyObject_CallMethod(self->compressor, "flush", NULL);
+            self->busy = 0;
+            res = pylzma_lzmafile_write_output(self, result);
+        }
+    }
+
+    self->mode = MODE_CLOSED;
+    if (self->closeFile) {
+        // the file is closed even if the stream could not be finished
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        self->busy = 1;
+        result = PyObject_CallMethod(self->file, "close", NULL);
+        self->busy = 0;
+        if (result == NULL) {
+            res = -1;
+            if (type != NULL) {
+                PyErr_Clear();
+            }
+        } else {
+            Py_DECREF(result);
+        }
+        if (type != NULL) {
+            PyErr_Restore(type, value, traceback);
+        }
+    }
+    pylzma_lzmafile_free(self);
+    if (res != 0) {
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *
+pylzma_lzmafile_readable(CLZMAFileObject *self, PyObject *args)
+{
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(self->mode == MODE_READ);
+}
+
+static PyObject *
+pylzma_lzmafile_writable(CLZMAFileObject *self, PyObject *args)
+{
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(self->mode == MODE_WRITE);
+}
+
+static PyObject *
+pylzma_lzmafile_seekable(CLZMAFileObject *self, PyObject *args)
+{
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(self->mode == MODE_READ && self->seekable);
+}
+
+static PyObject *
+pylzma_lzmafile_fileno(CLZMAFileObject *self, PyObject *args)
+{
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+    return PyObject_CallMethod(self->file, "fileno", NULL);
+}
+
+static PyObject *
+pylzma_lzmafile_enter(CLZMAFileObject *self, PyObject *args)
+{
+    if (pylzma_lzmafile_check(self, MODE_CLOSED) != 0) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+pylzma_lzmafile_exit(CLZMAFileObject *self, PyObject *args)
+{
+    return pylzma_lzmafile_close(self, NULL);
+}
+
+static PyObject *
+pylzma_lzmafile_iter(CLZMAFileObject *self)
+{
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+pylzma_lzmafile_iternext(CLZMAFileObject *self)
+{
+    PyObject *line;
+
+    if (pylzma_lzmafile_check(self, MODE_READ) != 0) {
+        return NULL;
+    }
+
+    line = pylzma_lzmafile_read_line(self, -1);
+    if (line != NULL && PyBytes_GET_SIZE(line) == 0) {
+        DEC_AND_NULL(line);
+    }
+    return line;
+}
+
+static PyObject *
+pylzma_lzmafile_get_closed(CLZMAFileObject *self, void *closure)
+{
+    return PyBool_FromLong(self->mode == MODE_CLOSED);
+}
+
+static PyMethodDef
+pylzma_lzmafile_methods[] = {
+    {"read",       (PyCFunction)pylzma_lzmafile_read,      METH_VARARGS, (char *)&doc_lzmafile_read},
+    {"read1",      (PyCFunction)pylzma_lzmafile_read1,     METH_VARARGS, (char *)&doc_lzmafile_read1},
+    {"readinto",   (PyCFunction)pylzma_lzmafile_readinto,  METH_VARARGS, (char *)&doc_lzmafile_readinto},
+    {"readinto1",  (PyCFunction)pylzma_lzmafile_readinto1, METH_VARARGS, (char *)&doc_lzmafile_readinto1},
+    {"peek",       (PyCFunction)pylzma_lzmafile_peek,      METH_VARARGS, (char *)&doc_lzmafile_peek},
+    {"readline",   (PyCFunction)pylzma_lzmafile_readline,  METH_VARARGS, (char *)&doc_lzmafile_readline},
+    {"readlines",  (PyCFunction)pylzma_lzmafile_readlines, METH_VARARGS, (char *)&doc_lzmafile_readlines},
+    {"write",      (PyCFunction)pylzma_lzmafile_write,     METH_VARARGS, (char *)&doc_lzmafile_write},
+    {"seek",       (PyCFunction)pylzma_lzmafile_seek,      METH_VARARGS, (char *)&doc_lzmafile_seek},
+    {"tell",       (PyCFunction)pylzma_lzmafile_tell,      METH_NOARGS,  (char *)&doc_lzmafile_tell},
+    {"flush",      (PyCFunction)pylzma_lzmafile_flush,     METH_NOARGS,  (char *)&doc_lzmafile_flush},
+    {"close",      (PyCFunction)pylzma_lzmafile_close,     METH_NOARGS,  (char *)&doc_lzmafile_close},
+    {"readable",   (PyCFunction)pylzma_lzmafile_readable,  METH_NOARGS,  NULL},
+    {"writable",   (PyCFunction)pylzma_lzmafile_writable,  METH_NOARGS,  NULL},
+    {"seekable",   (PyCFunction)pylzma_lzmafile_seekable,  METH_NOARGS,  NULL},
+    {"fileno",     (PyCFunction)pylzma_lzmafile_fileno,    METH_NOARGS,  NULL},
+    {"__enter__",  (PyCFunction)pylzma_lzmafile_enter,     METH_NOARGS,  NULL},
+    {"__exit__",   (PyCFunction)pylzma_lzmafile_exit,      METH_VARARGS, NULL},
+    {NULL, NULL},
+};
+
+static PyGetSetDef
+pylzma_lzmafile_getset[] = {
+    {"closed", (getter)pylzma_lzmafile_get_closed, NULL, "True if the file is closed.", NULL},
+    {NULL},
+};
+
+static void
+pylzma_lzmafile_dealloc(CLZMAFileObject *self)
+{
+    if (self->mode != MODE_CLOSED) {
+        // finish the stream of files that were not closed
+        PyObject *type, *value, *traceback;
+        PyObject *result;
+        PyErr_Fetch(&type, &value, &traceback);
+        result = pylzma_lzmafile_close(self, NULL);
+        if (result == NULL) {
+            PyErr_WriteUnraisable((PyObject *) self);
+        } else {
+            Py_DECREF(result);
+        }
+        PyErr_Restore(type, value, traceback);
+    }
+    pylzma_lzmafile_free(self);
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static int
+pylzma_lzmafile_init(CLZMAFileObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *file;
+    PyObject *known = NULL;
+    PyObject *options = NULL;
+    PyObject *value;
+    PyObject *io;
+    const char *mode = "r";
+    const char *openMode;
+    PY_LONG_LONG max_length = -1;
+    int lzma2 = 0;
+    const char *format = NULL;
+    int result = -1;
+    char **name;
+
+    // possible keywords for this function, all others are compression options
+    static char *kwlist[] = {"file", "mode", "maxlength", "lzma2", "format", NULL};
+
+    if (self->file != NULL) {
+        PyErr_SetString(PyExc_TypeError, "LZMAFile has already been initialized");
+        return -1;
+    }
+
+    known = PyDict_New();
+    options = kwargs != NULL ? PyDict_Copy(kwargs) : PyDict_New();
+    if (known == NULL || options == NULL) {
+        goto exit;
+    }
+    for (name = kwlist; *name != NULL; name++) {
+        value = PyDict_GetItemString(options, *name);
+        if (value == NULL) {
+            continue;
+        }
+        if (PyDict_SetItemString(known, *name, value) != 0) {
+            goto exit;
+        }
+        // the stream type is also passed to the compressor
+        if (strcmp(*name, "lzma2") != 0 && strcmp(*name, "format") != 0 &&
+            PyDict_DelItemString(options, *name) != 0) {
+            goto exit;
+        }
+    }
+
+    if (!PyArg_ParseTupleAndKeywords(args, known, "O|sLiz", kwlist, &file, &mode, &max_length, &lzma2, &format))
+        goto exit;
+
+    if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) {
+        openMode = "rb";
+        self->mode = MODE_READ;
+    } else if (strcmp(mode, "w") == 0 || strcmp(mode, "wb") == 0) {
+        openMode = "wb";
+        self->mode = MODE_WRITE;
+    } else if (strcmp(mode, "x") == 0 || strcmp(mode, "xb") == 0) {
+        openMode = "xb";
+        self->mode = MODE_WRITE;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid mode: %s", mode);
+        goto exit;
+    }
+
+    if (self->mode == MODE_READ) {
+        self->format = pylzma_parse_format(format, lzma2);
+        if (self->format < 0) {
+            goto exit;
+        }
+        if (self->format == FORMAT_XZ) {
+            PyErr_SetString(PyExc_ValueError, "reading format 'xz' is not supported, use decompressobj or decompress_file instead");
+            goto exit;
+        }
+        // lzma2 and format are kept in the options for the compressor
+        if (PyDict_Size(options) > (PyDict_GetItemString(options, "lzma2") != NULL) + (PyDict_GetItemString(options, "format") != NULL)) {
+            PyErr_SetString(PyExc_ValueError, "compression options can only be used for writing");
+            goto exit;
+        }
+        if (max_length < -1) {
+            PyErr_SetString(PyExc_ValueError, "the decompressed size must be zero or greater");
+            goto exit;
+        }
+    } else if (max_length != -1) {
+        PyErr_SetString(PyExc_ValueError, "maxlength can only be used for reading");
+        goto exit;
+    }
+
+    if (PyBytes_Check(file) || PyUnicode_Check(file) || PyObject_HasAttrString(file, "__fspath__")) {
+        io = PyImport_ImportModule("io");
+        if (io == NULL) {
+            goto exit;
+        }
+        self->file = PyObject_CallMethod(io, "open", "Os", file, openMode);
+        Py_DECREF(io);
+        if (self->file == NULL) {
+            goto exit;
+        }
+        self->closeFile = 1;
+    } else if (PyObject_HasAttrString(file, self->mode == MODE_READ ? "read" : "write")) {
+        Py_INCREF(file);
+        self->file = file;
+        self->closeFile = 0;
+    } else {
+        PyErr_SetString(PyExc_TypeError, "file must be a filename or a file object");
+        goto exit;
+    }
+
+    self->pos = 0;
+    if (self->mode == MODE_READ) {
+        self->lzma2 = lzma2;
+        self->max_length = max_length;
+        self->readinto = PyObject_HasAttrString(self->file, "readinto");
+        self->seekable = 0;
+        if (PyObject_HasAttrString(self->file, "seekable")) {
+            value = PyObject_CallMethod(self->file, "seekable", NULL);
+            if (value == NULL) {
+                goto exit;
+            }
+            self->seekable = PyObject_IsTrue(value);
+            Py_DECREF(value);
+        } else {
+            self->seekable = PyObject_HasAttrString(self->file, "seek");
+        }
+        if (self->seekable > 0) {
+            // seeking backward restarts at the current position of the file
+            value = PyObject_CallMethod(self->file, "tell", NULL);
+            if (value == NULL) {
+                goto exit;
+            }
+            self->start = PyLong_AsLongLong(value);
+            Py_DECREF(value);
+            if (self->start == -1 && PyErr_Occurred()) {
+                goto exit;
+            }
+        }
+
+        self->input = (Byte *) malloc(READ_SIZE);
+        if (self->input == NULL) {
+            PyErr_NoMemory();
+            goto exit;
+        }
+        self->inputPos = self->inputSize = 0;
+        if (lzma2) {
+            Lzma2Dec_Construct(&self->state.lzma2);
+            self->decoder = &self->state.lzma2.decoder;
+        } else {
+            LzmaDec_Construct(&self->state.lzma);
+            self->decoder = &self->state.lzma;
+        }
+        self->need_properties = 1;
+        self->eof = 0;
+        self->outPos = 0;
+    } else {
+        value = PyTuple_New(0);
+        if (value == NULL) {
+            goto exit;
+        }
+        // the compression options are validated by compressobj
+        self->compressor = PyObject_Call((PyObject *) &CCompressionObject_Type, value, options);
+        Py_DECREF(value);
+        if (self->compressor == NULL) {
+            goto exit;
+        }
+        self->output = (Byte *) malloc(WRITE_SIZE);
+        if (self->output == NULL) {
+            PyErr_NoMemory();
+            goto exit;
+        }
+        self->outputSize = 0;
+    }
+    result = 0;
+
+exit:
+    if (result != 0) {
+        self->mode = MODE_CLOSED;
+        if (self->closeFile && self->file != NULL) {
+            PyObject *type, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            Py_XDECREF(PyObject_CallMethod(self->file, "close", NULL));
+            PyErr_Clear();
+            PyErr_Restore(type, value, traceback);
+        }
+        pylzma_lzmafile_free(self);
+    }
+    Py_XDECREF(known);
+    Py_XDECREF(options);
+    return result;
+}
+
+int
+pylzma_init_lzmafile(void)
+{
+    PyObject *io;
+    PyObject *result;
+
+    io = PyImport_ImportModule("io");
+    if (io == NULL) {
+        return -1;
+    }
+
+    UnsupportedOperation = PyObject_GetAttrString(io, "UnsupportedOperation");
+    result = PyObject_GetAttrString(io, "BufferedIOBase");
+    Py_DECREF(io);
+    if (UnsupportedOperation == NULL || result == NULL) {
+        Py_XDECREF(result);
+        return -1;
+    }
+
+    // LZMAFile implements the interface, but can't derive from it
+    io = result;
+    result = PyObject_CallMethod(io, "register", "O", (PyObject *) &CLZMAFileObject_Type);
+    Py_DECREF(io);
+    if (result == NULL) {
+        return -1;
+    }
+    Py_DECREF(result);
+    return 0;
+}
+
+PyTypeObject
+CLZMAFileObject_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pylzma.LZMAFile",                   /* char *tp_name; */
+    sizeof(CLZMAFileObject),             /* int tp_basicsize; */
+    0,                                   /* int tp_itemsize;       // not used much */
+    (destructor)pylzma_lzmafile_dealloc, /* destructor tp_dealloc; */
+    PYLZMA_TP_PRINT,                     /* printfunc  tp_print;   */
+    NULL,                                /* getattrfunc  tp_getattr; // __getattr__ */
+    NULL,                                /* setattrfunc  tp_setattr;  // __setattr__ */
+    NULL,                                /* cmpfunc  tp_compare;  // __cmp__ */
+    NULL,                                /* reprfunc  tp_repr;    // __repr__ */
+    NULL,                                /* PyNumberMethods *tp_as_number; */
+    NULL,                                /* PySequenceMethods *tp_as_sequence; */
+    NULL,                                /* PyMappingMethods *tp_as_mapping; */
+    NULL,                                /* hashfunc tp_hash;     // __hash__ */
+    NULL,                                /* ternaryfunc tp_call;  // __call__ */
+    NULL,                                /* reprfunc tp_str;      // __str__ */
+    0,                                   /* tp_getattro*/
+    0,                                   /* tp_setattro*/
+    0,                                   /* tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,  /*tp_flags*/
+    "LZMAFile(file, mode='r', maxlength=-1, lzma2=0, format=None, **options) -- File object that reads or writes a " \
+    "compressed stream. file is a filename or a file object, mode is 'r' for reading or 'w' or 'x' for writing. " \
+    "The compression options are the same as for compressobj.", /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    (getiterfunc)pylzma_lzmafile_iter,   /* tp_iter */
+    (iternextfunc)pylzma_lzmafile_iternext, /* tp_iternext */
+    pylzma_lzmafile_methods,             /* tp_methods */
+    0,                                   /* tp_members */
+    pylzma_lzmafile_getset,              /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)pylzma_lzmafile_init,      /* tp_init */
+    0,                                   /* tp_alloc */
+    0,                                   /* tp_new */
+};
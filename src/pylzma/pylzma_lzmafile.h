@@ -0,0 +1,37 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+#ifndef ___PYLZMA_LZMAFILE__H___
+#define ___PYLZMA_LZMAFILE__H___
+
+#include <Python.h>
+
+// Must be called after the type is ready, registers it as io.BufferedIOBase.
+int pylzma_init_lzmafile(void);
+extern PyTypeObject CLZMAFileObject_Type;
+
+#define LZMAFileObject_Check(v)   ((v)->ob_type == &CLZMAFileObject_Type)
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ * $Id$
+ *
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef COMPRESS_MF_MT
+#include "../sdk/C/Threads.h"
+#endif
+
+#include "pylzma_pool.h"
+
+unsigned
+pylzma_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned) info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned) count : 1;
+#else
+    return 1;
+#endif
+}
+
+static SRes
+pool_run_sequential(size_t count, PoolItemFunc func, void *param)
+{
+    size_t index;
+    for (index = 0; index < count; index++) {
+        SRes res = func(param, 0, index);
+        if (res != SZ_OK) {
+            return res;
+        }
+    }
+    return SZ_OK;
+}
+
+#ifdef COMPRESS_MF_MT
+
+// Maximum number of threads in a pool.
+#define MAX_POOL_THREADS    64
+
+typedef struct {
+    PoolItemFunc func;
+    void *param;
+    size_t count;
+    size_t next;
+    SRes res;
+    CCriticalSection lock;
+} CPool;
+
+typedef struct {
+    CPool *pool;
+    unsigned index;
+    CThread thread;
+} CPoolWorker;
+
+static void
+pool_work(CPool *pool, unsigned worker)
+{
+    size_t index;
+    SRes res;
+
+    for (;;) {
+        CriticalSection_Enter(&pool->lock);
+        if (pool->res != SZ_OK || pool->next >= pool->count) {
+            CriticalSection_Leave(&pool->lock);
+            break;
+        }
+        index = pool->next++;
+        CriticalSection_Leave(&pool->lock);
+
+        res = pool->func(pool->param, worker, index);
+        if (res != SZ_OK) {
+            CriticalSection_Enter(&pool->lock);
+            if (pool->res == SZ_OK) {
+                pool->res = res;
+            }
+            CriticalSection_Leave(&pool->lock);
+            break;
+        }
+    }
+}
+
+static THREAD_FUNC_DECL
+pool_thread(void *param)
+{
+    CPoolWorker *worker = (CPoolWorker *) param;
+    pool_work(worker->pool, worker->index);
+    return THREAD_FUNC_RET_ZERO;
+}
+
+SRes
+pylzma_pool_run(unsigned threads, size_t count, PoolItemFunc func, void *param)
+{
+    CPool pool;
+    CPoolWorker workers[MAX_POOL_THREADS];
+    unsigned started = 0;
+    unsigned i;
+
+    if (threads > MAX_POOL_THREADS) {
+        threads = MAX_POOL_THREADS;
+    }
+    if (threads > count) {
+        threads = (unsigned) count;
+    }
+
+    pool.func = func;
+    pool.param = param;
+    pool.count = count;
+    pool.next = 0;
+    pool.res = SZ_OK;
+    if (threads <= 1 || CriticalSection_Init(&pool.lock) != 0) {
+        return pool_run_sequential(count, func, param);
+    }
+
+    // worker 0 is the calling thread, if a thread can't be started the
+    // remaining items are processed by the threads already running
+    for (i = 1; i < threads; i++) {
+        CPoolWorker *worker = &workers[started];
+        worker->pool = &pool;
+        worker->index = i;
+        Thread_CONSTRUCT(&worker->thread);
+        if (Thread_Create(&worker->thread, pool_thread, worker) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    pool_work(&pool, 0);
+    for (i = 0; i < started; i++) {
+        Thread_Wait_Close(&workers[i].thread);
+    }
+    CriticalSection_Delete(&pool.lock);
+    return pool.res;
+}
+
+#else
+
+SRes
+pylzma_pool_run(unsigned threads, size_t count, PoolItemFunc func, void *param)
+{
+    return pool_run_sequential(count, func, param);
+}
+
+#endif
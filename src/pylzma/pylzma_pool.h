@@ -0,0 +1,43 @@
+/*
+ * Python Bindings for LZMA
+ *
+ * Copyright (c) 2004-2015 by Joachim Bauch, mail@joachim-bauch.de
+ * 7-Zip Copyright (C) 1999-2010 Igor Pavlov
+ * LZMA SDK Copyright (C) 1999-2010 Igor Pavlov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ * $Id$
+ *
+ */
+
+#ifndef ___PYLZMA_POOL__H___
+#define ___PYLZMA_POOL__H___
+
+#include "../sdk/C/7zTypes.h"
+
+// Process the item with the given index, "worker" is the index of the
+// worker thread in [0, threads) and can be used to access per-thread state.
+typedef SRes (*PoolItemFunc)(void *param, unsigned worker, size_t index);
+
+// Number of processors available to the process.
+unsigned pylzma_cpu_count(void);
+
+// Call "func" for all indices in [0, count) using up to "threads" worker
+// threads, the calling thread is used as the first worker. Processing stops
+// at the first error which is returned. Can be called without holding the GIL.
+SRes pylzma_pool_run(unsigned threads, size_t count, PoolItemFunc func, void *param);
+
+#endif
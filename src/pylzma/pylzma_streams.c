@@ -26,6 +26,13 @@
 #include "pylzma.h"
 #include "pylzma_streams.h"
 
+#ifdef PYTHON_IN_STREAM_USE_PREAD
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifdef _WIN32
 // Initial size of output streams
 #define INITIAL_BLOCKSIZE   1048576
@@ -61,22 +68,40 @@ CreateMemoryInStream(CMemoryInStream *stream, Byte *data, size_t size)
     stream->avail = size;
 }
 
+// Minimum size of chunks in input queues
+#define MIN_CHUNKSIZE       65536
+
+struct CMemoryChunk
+{
+    CMemoryChunk *next;
+    size_t pos;
+    size_t size;
+    size_t avail;
+    Byte data[1];
+};
+
 static SRes
 MemoryInOutStream_Read(const ISeqInStream *p, void *buf, size_t *size)
 {
     CMemoryInOutStream *self = (CMemoryInOutStream *) p;
     size_t toread = *size;
-    if (toread > self->size) {
-        toread = self->size;
-    }
-    memcpy(buf, self->data, toread);
-    if (self->size > toread) {
-        memmove(self->data, self->data + toread, self->size - toread);
-        self->size -= toread;
-    } else {
-        self->size = 0;
+    size_t done = 0;
+    while (done < toread && self->head != NULL) {
+        CMemoryChunk *chunk = self->head;
+        size_t len = min(toread - done, chunk->size - chunk->pos);
+        memcpy((Byte *) buf + done, chunk->data + chunk->pos, len);
+        chunk->pos += len;
+        done += len;
+        if (chunk->pos == chunk->size) {
+            self->head = chunk->next;
+            if (self->head == NULL) {
+                self->tail = NULL;
+            }
+            free(chunk);
+        }
     }
-    *size = toread;
+    self->size -= done;
+    *size = done;
     return SZ_OK;
 }
 
@@ -84,70 +109,266 @@ void
 CreateMemoryInOutStream(CMemoryInOutStream *stream)
 {
     stream->s.Read = MemoryInOutStream_Read;
-    stream->data = (Byte *) malloc(INITIAL_BLOCKSIZE);
+    stream->head = stream->tail = NULL;
     stream->size = 0;
-    stream->avail = INITIAL_BLOCKSIZE;
 }
 
 BoolInt
-MemoryInOutStreamAppend(CMemoryInOutStream *stream, Byte *data, size_t size)
+MemoryInOutStreamAppend(CMemoryInOutStream *stream, const Byte *data, size_t size)
 {
+    CMemoryChunk *chunk = stream->tail;
+    size_t len;
     if (!size) {
         return 1;
     }
-    while (stream->avail - stream->size < size) {
-        stream->data = (Byte *) realloc(stream->data, stream->avail + min(stream->avail, MAX_BLOCKSIZE));
-        if (stream->data == NULL) {
-            stream->size = stream->avail = 0;
+    if (chunk != NULL) {
+        // fill up the last chunk before allocating a new one
+        len = min(size, chunk->avail - chunk->size);
+        memcpy(chunk->data + chunk->size, data, len);
+        chunk->size += len;
+        stream->size += len;
+        data += len;
+        size -= len;
+    }
+    if (size) {
+        len = size > MIN_CHUNKSIZE ? size : MIN_CHUNKSIZE;
+        chunk = (CMemoryChunk *) malloc(sizeof(CMemoryChunk) + len);
+        if (chunk == NULL) {
             return 0;
         }
-        stream->avail += min(stream->avail, MAX_BLOCKSIZE);
+        chunk->next = NULL;
+        chunk->pos = 0;
+        chunk->size = size;
+        chunk->avail = len;
+        memcpy(chunk->data, data, size);
+        if (stream->tail != NULL) {
+            stream->tail->next = chunk;
+        } else {
+            stream->head = chunk;
+        }
+        stream->tail = chunk;
+        stream->size += size;
     }
-    memcpy(stream->data + stream->size, data, size);
-    stream->size += size;
     return 1;
 }
 
+const Byte *
+MemoryInOutStreamPeek(CMemoryInOutStream *stream, size_t *size)
+{
+    CMemoryChunk *chunk = stream->head;
+    if (chunk == NULL) {
+        *size = 0;
+        return NULL;
+    }
+    *size = chunk->size - chunk->pos;
+    return chunk->data + chunk->pos;
+}
+
+void
+MemoryInOutStreamSkip(CMemoryInOutStream *stream, size_t size)
+{
+    CMemoryChunk *chunk = stream->head;
+    if (chunk == NULL || !size) {
+        return;
+    }
+    chunk->pos += size;
+    stream->size -= size;
+    if (chunk->pos == chunk->size) {
+        stream->head = chunk->next;
+        if (stream->head == NULL) {
+            stream->tail = NULL;
+        }
+        free(chunk);
+    }
+}
+
+void
+FreeMemoryInOutStream(CMemoryInOutStream *stream)
+{
+    while (stream->head != NULL) {
+        CMemoryChunk *chunk = stream->head;
+        stream->head = chunk->next;
+        free(chunk);
+    }
+    stream->tail = NULL;
+    stream->size = 0;
+}
+
+// Read from the file object into "dest", the GIL must be held.
 static SRes
-PythonInStream_Read(const ISeqInStream *p, void *buf, size_t *size)
+PythonInStream_ReadFile(CPythonInStream *self, Byte *dest, size_t size, size_t *processed)
 {
-    CPythonInStream *self = (CPythonInStream *) p;
-    size_t toread = *size;
+    PyObject *view;
     PyObject *data;
-    SRes res;
-    
-    START_BLOCK_THREADS
-    data = PyObject_CallMethod(self->file, "read", "i", toread);
+    SRes res = SZ_ERROR_READ;
+
+    if (!self->readinto) {
+        data = PyObject_CallMethod(self->file, "read", "n", (Py_ssize_t) size);
+        if (data == NULL) {
+            PyErr_Print();
+        } else if (PyBytes_Check(data)) {
+            *processed = min((size_t) PyBytes_GET_SIZE(data), size);
+            memcpy(dest, PyBytes_AS_STRING(data), *processed);
+            res = SZ_OK;
+        }
+        Py_XDECREF(data);
+        return res;
+    }
+
+#if PY_MAJOR_VERSION >= 3
+    view = PyMemoryView_FromMemory((char *) dest, (Py_ssize_t) size, PyBUF_WRITE);
+#else
+    view = PyBuffer_FromReadWriteMemory(dest, (Py_ssize_t) size);
+#endif
+    if (view == NULL) {
+        PyErr_Print();
+        return SZ_ERROR_MEM;
+    }
+    data = PyObject_CallMethod(self->file, "readinto", "O", view);
     if (data == NULL) {
         PyErr_Print();
-        res = SZ_ERROR_READ;
-    } else if (!PyBytes_Check(data)) {
-        res = SZ_ERROR_READ;
-    } else {
-        *size = PyBytes_GET_SIZE(data);
-        memcpy(buf, PyBytes_AS_STRING(data), min(*size, toread));
-        res = SZ_OK;
+    } else if (data != Py_None) {
+        // "None" is returned by non-blocking files without available data
+        Py_ssize_t count = PyNumber_AsSsize_t(data, PyExc_OverflowError);
+        if (count >= 0 && (size_t) count <= size) {
+            *processed = (size_t) count;
+            res = SZ_OK;
+        } else if (PyErr_Occurred()) {
+            PyErr_Print();
+        }
     }
-    Py_XDECREF(data);    
-    END_BLOCK_THREADS
+    Py_XDECREF(data);
+    Py_DECREF(view);
     return res;
 }
 
+#ifdef PYTHON_IN_STREAM_USE_PREAD
+static SRes
+PythonInStream_ReadDescriptor(CPythonInStream *self, void *buf, size_t *size)
+{
+    ssize_t count;
+    do {
+        count = pread(self->fd, buf, *size, (off_t) self->offset);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+        return SZ_ERROR_READ;
+    }
+
+    self->offset += count;
+    *size = (size_t) count;
+    if (count == 0) {
+        // move the file object to the end of the data that was read
+        PyObject *result;
+        START_BLOCK_THREADS
+        result = PyObject_CallMethod(self->file, "seek", "K", (unsigned PY_LONG_LONG) self->offset);
+        if (result == NULL) {
+            PyErr_Clear();
+        }
+        Py_XDECREF(result);
+        END_BLOCK_THREADS
+    }
+    return SZ_OK;
+}
+#endif
+
+static SRes
+PythonInStream_Read(const ISeqInStream *p, void *buf, size_t *size)
+{
+    CPythonInStream *self = (CPythonInStream *) p;
+    size_t toread = *size;
+    SRes res;
+
+#ifdef PYTHON_IN_STREAM_USE_PREAD
+    if (self->fd != -1) {
+        return PythonInStream_ReadDescriptor(self, buf, size);
+    }
+#endif
+
+    if (self->pos == self->size) {
+        if (self->buffer == NULL && toread < READAHEAD_SIZE) {
+            self->buffer = (Byte *) malloc(READAHEAD_SIZE);
+            if (self->buffer == NULL) {
+                return SZ_ERROR_MEM;
+            }
+        }
+
+        {
+            START_BLOCK_THREADS
+            if (toread >= READAHEAD_SIZE) {
+                // large requests don't need to go through the buffer
+                res = PythonInStream_ReadFile(self, (Byte *) buf, toread, size);
+            } else {
+                self->pos = self->size = 0;
+                res = PythonInStream_ReadFile(self, self->buffer, READAHEAD_SIZE, &self->size);
+            }
+            END_BLOCK_THREADS
+            if (res != SZ_OK || toread >= READAHEAD_SIZE) {
+                return res;
+            }
+        }
+    }
+
+    toread = min(toread, self->size - self->pos);
+    memcpy(buf, self->buffer + self->pos, toread);
+    self->pos += toread;
+    *size = toread;
+    return SZ_OK;
+}
+
 void
 CreatePythonInStream(CPythonInStream *stream, PyObject *file)
 {
     stream->s.Read = PythonInStream_Read;
     stream->file = file;
+    stream->readinto = PyObject_HasAttrString(file, "readinto");
+    stream->buffer = NULL;
+    stream->pos = stream->size = 0;
+    stream->fd = -1;
+    stream->offset = 0;
+#ifdef PYTHON_IN_STREAM_USE_PREAD
+    // Regular files are read without the GIL. Only binary files can be used
+    // (text files don't support "readinto"), reading starts at the current
+    // position of the file object which takes buffered data into account.
+    if (stream->readinto && PyObject_HasAttrString(file, "fileno") && PyObject_HasAttrString(file, "tell")) {
+        struct stat st;
+        int fd = PyObject_AsFileDescriptor(file);
+        if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            PyObject *pos = PyObject_CallMethod(file, "tell", NULL);
+            if (pos != NULL) {
+                PY_LONG_LONG offset = PyLong_AsLongLong(pos);
+                if (offset >= 0) {
+                    stream->fd = fd;
+                    stream->offset = (UInt64) offset;
+                }
+                Py_DECREF(pos);
+            }
+        }
+        PyErr_Clear();
+    }
+#endif
+}
+
+void
+FreePythonInStream(CPythonInStream *stream)
+{
+    FREE_AND_NULL(stream->buffer);
 }
 
 static size_t
 MemoryOutStream_Write(const ISeqOutStream *p, const void *buf, size_t size)
 {
     CMemoryOutStream *self = (CMemoryOutStream *) p;
+    if (self->avail - self->size < size && self->pos >= self->size - self->pos) {
+        // at least as much data was discarded as is left, moving the
+        // remaining data to the front is cheaper than growing the buffer
+        memmove(self->data, self->data + self->pos, self->size - self->pos);
+        self->size -= self->pos;
+        self->pos = 0;
+    }
     while (self->avail - self->size < size) {
         self->data = (Byte *) realloc(self->data, self->avail + min(self->avail, MAX_BLOCKSIZE));
         if (self->data == NULL) {
-            self->size = self->avail = 0;
+            self->size = self->avail = self->pos = 0;
             return 0;
         }
         self->avail += min(self->avail, MAX_BLOCKSIZE);
@@ -164,18 +385,41 @@ CreateMemoryOutStream(CMemoryOutStream *stream)
     stream->data = (Byte *) malloc(INITIAL_BLOCKSIZE);
     stream->size = 0;
     stream->avail = INITIAL_BLOCKSIZE;
+    stream->pos = 0;
 }
 
 void
 MemoryOutStreamDiscard(CMemoryOutStream *stream, size_t size)
 {
-    if (size >= stream->size) {
+    if (size >= stream->size - stream->pos) {
         // Clear stream
-        stream->size = 0;
+        stream->size = stream->pos = 0;
     } else {
-        memmove(stream->data, stream->data + size, stream->size - size);
-        stream->size -= size;
+        stream->pos += size;
+    }
+}
+
+static size_t
+BufferOutStream_Write(const ISeqOutStream *p, const void *buf, size_t size)
+{
+    CBufferOutStream *self = (CBufferOutStream *) p;
+    if (size > self->size - self->pos) {
+        self->overflow = 1;
+        size = self->size - self->pos;
     }
+    memcpy(self->data + self->pos, buf, size);
+    self->pos += size;
+    return size;
+}
+
+void
+CreateBufferOutStream(CBufferOutStream *stream, Byte *data, size_t size)
+{
+    stream->s.Write = BufferOutStream_Write;
+    stream->data = data;
+    stream->size = size;
+    stream->pos = 0;
+    stream->overflow = 0;
 }
 
 static SRes
@@ -223,8 +467,29 @@ static SRes
 MemoryLookInStream_Seek(const ILookInStream *p, Int64 *pos, ESzSeek origin)
 {
     CMemoryLookInStream *self = (CMemoryLookInStream *) p;
-    printf("XXX\n");
-    return SZ_ERROR_UNSUPPORTED;
+    size_t current = self->size - self->avail;
+    Int64 offset;
+
+    switch (origin) {
+    case SZ_SEEK_SET:
+        offset = *pos;
+        break;
+    case SZ_SEEK_CUR:
+        offset = (Int64) current + *pos;
+        break;
+    case SZ_SEEK_END:
+        offset = (Int64) self->size + *pos;
+        break;
+    default:
+        return SZ_ERROR_PARAM;
+    }
+    if (offset < 0 || (UInt64) offset > self->size) {
+        return SZ_ERROR_PARAM;
+    }
+    self->data = self->data - current + (size_t) offset;
+    self->avail = self->size - (size_t) offset;
+    *pos = offset;
+    return SZ_OK;
 }
 
 void
@@ -235,5 +500,77 @@ CreateMemoryLookInStream(CMemoryLookInStream *stream, Byte *data, size_t size)
     stream->s.Skip = MemoryLookInStream_Skip;
     stream->s.Seek = MemoryLookInStream_Seek;
     stream->data = data;
+    stream->size = size;
     stream->avail = size;
 }
+
+SRes
+PythonProgressCall(CPythonProgress *progress, UInt64 inSize, UInt64 outSize)
+{
+    PyObject *result;
+    int ok;
+
+    progress->next = inSize + progress->interval;
+    if (progress->exc_type != NULL) {
+        return SZ_ERROR_PROGRESS;
+    }
+
+    if (PyErr_CheckSignals() != 0) {
+        goto error;
+    }
+
+    result = PyObject_CallFunction(progress->callback, "KK", (unsigned PY_LONG_LONG) inSize, (unsigned PY_LONG_LONG) outSize);
+    if (result == NULL) {
+        goto error;
+    }
+
+    ok = PyObject_IsTrue(result);
+    Py_DECREF(result);
+    if (ok < 0) {
+        goto error;
+    }
+    return ok ? SZ_OK : SZ_ERROR_PROGRESS;
+
+error:
+    // the exception is raised by the thread that started the compression
+    PyErr_Fetch(&progress->exc_type, &progress->exc_value, &progress->exc_traceback);
+    return SZ_ERROR_PROGRESS;
+}
+
+static SRes
+PythonProgress_Progress(ICompressProgressPtr p, UInt64 inSize, UInt64 outSize)
+{
+    CPythonProgress *self = (CPythonProgress *) p;
+    SRes res = SZ_OK;
+
+    // only take the GIL if the function must be called
+    if (inSize >= self->next) {
+        START_BLOCK_THREADS
+        res = PythonProgressCall(self, inSize, outSize);
+        END_BLOCK_THREADS
+    }
+    return res;
+}
+
+void
+CreatePythonProgress(CPythonProgress *progress, PyObject *callback, UInt64 interval)
+{
+    progress->s.Progress = PythonProgress_Progress;
+    progress->callback = callback;
+    progress->interval = interval;
+    progress->next = interval;
+    progress->exc_type = NULL;
+    progress->exc_value = NULL;
+    progress->exc_traceback = NULL;
+}
+
+void
+PythonProgressSetError(CPythonProgress *progress)
+{
+    if (progress->exc_type != NULL) {
+        PyErr_Restore(progress->exc_type, progress->exc_value, progress->exc_traceback);
+        progress->exc_type = progress->exc_value = progress->exc_traceback = NULL;
+    } else {
+        PyErr_SetString(PyExc_RuntimeError, "compression was aborted by the progress function");
+    }
+}
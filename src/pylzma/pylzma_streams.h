@@ -40,30 +40,82 @@ typedef struct
 
 void CreateMemoryInStream(CMemoryInStream *stream, Byte *data, size_t size);
 
-typedef CMemoryInStream CMemoryInOutStream;
+// Queue of memory chunks that can be appended to while it is being read,
+// data that was already appended is never moved.
+typedef struct CMemoryChunk CMemoryChunk;
+
+typedef struct
+{
+    ISeqInStream s;
+    CMemoryChunk *head;
+    CMemoryChunk *tail;
+    size_t size;
+} CMemoryInOutStream;
 
 void CreateMemoryInOutStream(CMemoryInOutStream *stream);
-BoolInt MemoryInOutStreamAppend(CMemoryInOutStream *stream, Byte *data, size_t size);
+BoolInt MemoryInOutStreamAppend(CMemoryInOutStream *stream, const Byte *data, size_t size);
+// Return the data of the first chunk without consuming it, NULL if the
+// stream is empty.
+const Byte *MemoryInOutStreamPeek(CMemoryInOutStream *stream, size_t *size);
+// Consume "size" bytes of the data returned by "MemoryInOutStreamPeek".
+void MemoryInOutStreamSkip(CMemoryInOutStream *stream, size_t size);
+void FreeMemoryInOutStream(CMemoryInOutStream *stream);
 
+#ifndef _WIN32
+#define PYTHON_IN_STREAM_USE_PREAD
+#endif
+
+// Number of bytes to read from Python file objects at once
+#define READAHEAD_SIZE      (4*1024*1024)
+
+// Reads from a Python file object through a readahead buffer, "readinto" is
+// used if available. Regular files are read directly from the file
+// descriptor without the GIL.
 typedef struct
 {
     ISeqInStream s;
     PyObject *file;
+    int readinto;
+    Byte *buffer;
+    size_t pos;
+    size_t size;
+    int fd;
+    UInt64 offset;
 } CPythonInStream;
 
+// Must be called with the GIL held.
 void CreatePythonInStream(CPythonInStream *stream, PyObject *file);
+void FreePythonInStream(CPythonInStream *stream);
 
+// Growing output buffer, the data that has not been discarded yet starts at
+// offset "pos".
 typedef struct
 {
     ISeqOutStream s;
     Byte *data;
     size_t size;
     size_t avail;
+    size_t pos;
 } CMemoryOutStream;
 
+#define MemoryOutStreamData(stream)         ((stream)->data + (stream)->pos)
+#define MemoryOutStreamAvailable(stream)    ((stream)->size - (stream)->pos)
+
 void CreateMemoryOutStream(CMemoryOutStream *stream);
 void MemoryOutStreamDiscard(CMemoryOutStream *stream, size_t size);
 
+// Output to a buffer of fixed size, "overflow" is set if data didn't fit.
+typedef struct
+{
+    ISeqOutStream s;
+    Byte *data;
+    size_t size;
+    size_t pos;
+    int overflow;
+} CBufferOutStream;
+
+void CreateBufferOutStream(CBufferOutStream *stream, Byte *data, size_t size);
+
 typedef struct
 {
     ILookInStream s;
@@ -74,4 +126,28 @@ typedef struct
 
 void CreateMemoryLookInStream(CMemoryLookInStream *stream, Byte *data, size_t size);
 
+// Calls a Python function with the number of input and output bytes processed
+// every "interval" bytes of input. Compression is aborted if the function
+// returns a false value or raises an exception.
+typedef struct
+{
+    ICompressProgress s;
+    PyObject *callback;
+    UInt64 interval;
+    UInt64 next;
+    PyObject *exc_type;
+    PyObject *exc_value;
+    PyObject *exc_traceback;
+} CPythonProgress;
+
+// Default number of input bytes between two calls of the progress function.
+#define DEFAULT_PROGRESS_INTERVAL   (1024*1024)
+
+// "callback" is borrowed and must be valid while the progress is used.
+void CreatePythonProgress(CPythonProgress *progress, PyObject *callback, UInt64 interval);
+// Call the progress function, the GIL must be held.
+SRes PythonProgressCall(CPythonProgress *progress, UInt64 inSize, UInt64 outSize);
+// Set the Python exception after compression was aborted, the GIL must be held.
+void PythonProgressSetError(CPythonProgress *progress);
+
 #endif
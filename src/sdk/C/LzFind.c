@@ -243,6 +243,7 @@ void MatchFinder_Construct(CMatchFinder *p)
   p->stream = NULL;
   p->hash = NULL;
   p->expectedDataSize = (UInt64)(Int64)-1;
+  p->resumable = 0;
   MatchFinder_SetDefaultSettings(p);
 
   for (i = 0; i < 256; i++)
@@ -526,6 +527,10 @@ static void MatchFinder_SetLimits(CMatchFinder *p)
       mm = k;
       if (k != 0)
         k = 1;
+      /* the binary tree can't be continued after positions were inserted
+         with a shorter length limit, so they are skipped instead */
+      if (p->resumable && p->btMode)
+        mm = 0;
     }
     p->lenLimit = mm;
   }
@@ -535,6 +540,17 @@ static void MatchFinder_SetLimits(CMatchFinder *p)
   p->posLimit = p->pos + n;
 }
 
+/* continue to read from the stream after it has reported its end,
+   requires (resumable) to be set before the end was reached */
+void MatchFinder_ResumeStream(CMatchFinder *p)
+{
+  p->streamEndWasReached = 0;
+  if (MatchFinder_NeedMove(p))
+    MatchFinder_MoveBlock(p);
+  MatchFinder_ReadBlock(p);
+  MatchFinder_SetLimits(p);
+}
+
 
 void MatchFinder_Init_LowHash(CMatchFinder *p)
 {
@@ -45,7 +45,8 @@ typedef struct
   UInt32 fixedHashSize;
   Byte numHashBytes_Min;
   Byte numHashOutBits;
-  Byte _pad2_[2];
+  Byte resumable;
+  Byte _pad2_[1];
   SRes result;
   UInt32 crc[256];
   size_t numRefs;
@@ -68,6 +69,7 @@ int MatchFinder_NeedMove(CMatchFinder *p);
 /* Byte *MatchFinder_GetPointerToCurrentPos(CMatchFinder *p); */
 void MatchFinder_MoveBlock(CMatchFinder *p);
 void MatchFinder_ReadIfRequired(CMatchFinder *p);
+void MatchFinder_ResumeStream(CMatchFinder *p);
 
 void MatchFinder_Construct(CMatchFinder *p);
 
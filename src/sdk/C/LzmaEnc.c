@@ -2889,6 +2889,26 @@ BoolInt LzmaEnc_IsFinished(CLzmaEncHandle pp)
   return p->finished;
 }
 
+UInt64 LzmaEnc_GetNumProcessed(CLzmaEncHandle pp)
+{
+  CLzmaEnc *p = (CLzmaEnc *)pp;
+  return p->nowPos64;
+}
+
+void LzmaEnc_SetResumable(CLzmaEncHandle pp)
+{
+  CLzmaEnc *p = (CLzmaEnc *)pp;
+  p->matchFinderBase.resumable = 1;
+}
+
+void LzmaEnc_ResumeStream(CLzmaEncHandle pp)
+{
+  CLzmaEnc *p = (CLzmaEnc *)pp;
+  if (!p->needInit)
+    MatchFinder_ResumeStream(&p->matchFinderBase);
+  p->finished = False;
+}
+
 SRes LzmaEnc_PrepareForLzma2(CLzmaEncHandle p,
     ISeqInStreamPtr inStream, UInt32 keepWindowSize,
     ISzAllocPtr alloc, ISzAllocPtr allocBig)
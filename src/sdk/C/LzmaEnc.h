@@ -87,6 +87,13 @@ EXTERN_C_END
 SRes LzmaEnc_Prepare(CLzmaEncHandle pp, ISeqOutStreamPtr outStream, ISeqInStreamPtr inStream, ISzAllocPtr alloc, ISzAllocPtr allocBig);
 SRes LzmaEnc_CodeOneBlock(CLzmaEncHandle pp, UInt32 maxPackSize, UInt32 maxUnpackSize);
 BoolInt LzmaEnc_IsFinished(CLzmaEncHandle pp);
+UInt64 LzmaEnc_GetNumProcessed(CLzmaEncHandle pp);
 void LzmaEnc_Finish(CLzmaEncHandle pp);
 
+/* The input stream may return more data after it has reported its end by
+   returning no data. Only supported without the multithreaded match finder,
+   LzmaEnc_SetResumable must be called before the end is reached. */
+void LzmaEnc_SetResumable(CLzmaEncHandle pp);
+void LzmaEnc_ResumeStream(CLzmaEncHandle pp);
+
 #endif
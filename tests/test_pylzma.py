@@ -63,12 +63,13 @@ class TestPyLZMA(unittest.TestCase):
     def test_compression_eos(self):
         # test compression with end of stream marker
         compressed = pylzma.compress(self.plain, eos=1)
-        self.assertEqual(compressed, self.plain_with_eos)
+        # the dictionary in the header is reduced to the minimum of 4KB for small inputs
+        self.assertEqual(compressed, self.plain_with_eos[:1] + unhexlify('00100000') + self.plain_with_eos[5:])
 
     def test_compression_no_eos(self):
         # test compression without end of stream marker
         compressed = pylzma.compress(self.plain, eos=0)
-        self.assertEqual(compressed, self.plain_without_eos)
+        self.assertEqual(compressed, self.plain_without_eos[:1] + unhexlify('00100000') + self.plain_without_eos[5:])
 
     def test_decompression_eos(self):
         # test decompression with the end of stream marker
@@ -160,20 +161,203 @@ class TestPyLZMA(unittest.TestCase):
         outfile.write(decompress.flush())
         self.assertEqual(outfile.getvalue(), self.plain)
 
-    def _test_compression_streaming(self):
+    def test_decompression_streaming_pending(self):
+        # input that doesn't fit into the output is kept for later calls
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 18)
+        for lzma2 in (0, 1):
+            compressed = pylzma.compress(data, lzma2=lzma2)
+            for size, bufsize in ((3, 10), (4096, 1000), (1 << 16, 1 << 16), (len(compressed), 1 << 12)):
+                decompress = pylzma.decompressobj(lzma2=lzma2)
+                result = []
+                for pos in range(0, len(compressed), size):
+                    result.append(decompress.decompress(compressed[pos:pos+size], bufsize))
+                while True:
+                    tmp = decompress.decompress(bytes('', 'ascii'), bufsize)
+                    if not tmp: break
+                    result.append(tmp)
+                result.append(decompress.flush())
+                self.assertEqual(bytes('', 'ascii').join(result), data)
+
+    def test_decompression_streaming_known_size(self):
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        for lzma2 in (0, 1):
+            # the result is used as dictionary if it is not larger than the
+            # dictionary of the stream
+            for dictionary in (16, 24):
+                compressed = pylzma.compress(data, lzma2=lzma2, dictionary=dictionary)
+                decompress = pylzma.decompressobj(maxlength=len(data), lzma2=lzma2)
+                self.assertEqual(decompress.decompress(compressed, len(data)), data)
+                self.assertTrue(decompress.eof)
+
+                decompress = pylzma.decompressobj(maxlength=len(data), lzma2=lzma2)
+                result = []
+                output = bytearray(1000)
+                for i in range(0, len(compressed), 1 << 14):
+                    result.append(decompress.decompress(compressed[i:i+(1 << 13)], 1 << 16))
+                    written, consumed = decompress.decompress_into(compressed[i+(1 << 13):i+(1 << 14)], output)
+                    result.append(bytes(output[:written]))
+                    result.append(decompress.decompress(compressed[i+(1 << 13)+consumed:i+(1 << 14)], 1 << 16))
+                result.append(decompress.flush())
+                self.assertEqual(bytes('', 'ascii').join(result), data)
+
+    def test_decompression_streaming_skip(self):
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        for lzma2 in (0, 1):
+            compressed = pylzma.compress(data, lzma2=lzma2)
+            for maxlength in (-1, len(data)):
+                decompress = pylzma.decompressobj(maxlength=maxlength, lzma2=lzma2)
+                # not enough data to read the stream properties
+                self.assertEqual(decompress.skip(1000, compressed[:1]), 0)
+                self.assertEqual(decompress.decompress(compressed[1:200], 10), data[:10])
+                self.assertEqual(decompress.skip(1000), 1000)
+                self.assertEqual(decompress.decompress(bytes('', 'ascii'), 10), data[1010:1020])
+                # unconsumed input is kept for later calls
+                self.assertEqual(decompress.skip(300000, compressed[200:]), 300000)
+                self.assertEqual(decompress.decompress(bytes('', 'ascii'), max_length=-1), data[301020:])
+                self.assertTrue(decompress.eof)
+                # with a known size, the end marker might not have been read
+                self.assertEqual(decompress.skip(10, compressed), 0)
+                self.assertTrue(decompress.unused_data.endswith(compressed))
+            self.assertRaises(ValueError, pylzma.decompressobj(lzma2=lzma2).skip, -1)
+
+    def test_verify(self):
+        import zlib
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        crc = zlib.crc32(data) & 0xffffffff
+        for lzma2 in (0, 1):
+            compressed = pylzma.compress(data, lzma2=lzma2)
+            self.assertEqual(pylzma.verify(compressed, lzma2=lzma2), len(data))
+            self.assertEqual(pylzma.verify(compressed, lzma2=lzma2, crc32=crc), len(data))
+            self.assertEqual(pylzma.verify(compressed, 1000, lzma2=lzma2, crc32=zlib.crc32(data[:1000])), 1000)
+            self.assertRaises(ValueError, pylzma.verify, compressed, lzma2=lzma2, crc32=crc ^ 1)
+            self.assertRaises(ValueError, pylzma.verify, compressed[:-20], lzma2=lzma2)
+
+        compressed = pylzma.compress(data, eos=0)
+        self.assertEqual(pylzma.verify(compressed, len(data), crc32=crc), len(data))
+
+    def test_decompression_streaming_eof(self):
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        garbage = bytes("garbage", 'ascii')
+        for lzma2 in (0, 1):
+            compressed = pylzma.compress(data, lzma2=lzma2)
+            decompress = pylzma.decompressobj(lzma2=lzma2)
+            self.assertFalse(decompress.eof)
+            self.assertTrue(decompress.needs_input)
+            self.assertEqual(decompress.decompress(compressed + garbage, max_length=-1), data)
+            self.assertTrue(decompress.eof)
+            self.assertFalse(decompress.needs_input)
+            self.assertEqual(decompress.unused_data, garbage)
+            # data after the end of the stream is not decompressed
+            self.assertEqual(decompress.decompress(garbage), bytes('', 'ascii'))
+            self.assertEqual(decompress.unused_data, garbage + garbage)
+            self.assertEqual(decompress.flush(), bytes('', 'ascii'))
+
+            decompress = pylzma.decompressobj(lzma2=lzma2)
+            result = []
+            for i in range(0, len(compressed), 1000):
+                result.append(decompress.decompress(compressed[i:i+1000], max_length=100))
+                while not decompress.needs_input and not decompress.eof:
+                    result.append(decompress.decompress(bytes('', 'ascii'), max_length=100))
+            self.assertEqual(bytes('', 'ascii').join(result), data)
+            self.assertTrue(decompress.eof)
+
+            decompress.reset()
+            self.assertFalse(decompress.eof)
+            self.assertEqual(decompress.unused_data, bytes('', 'ascii'))
+            # a truncated stream doesn't reach the end
+            result = decompress.decompress(compressed[:-20], max_length=-1)
+            self.assertEqual(result, data[:len(result)])
+            self.assertFalse(decompress.eof)
+            self.assertTrue(decompress.needs_input)
+
+        compressed = pylzma.compress(data, eos=0)
+        decompress = pylzma.decompressobj(maxlength=len(data))
+        self.assertEqual(decompress.decompress(compressed + garbage, max_length=-1), data)
+        self.assertTrue(decompress.eof)
+        self.assertEqual(decompress.unused_data, garbage)
+        self.assertRaises(ValueError, decompress.decompress, compressed, max_length=0)
+
+        # an end marker after the known size is part of the stream
+        for compressed, options in ((pylzma.compress(data), {'maxlength': len(data)}),
+                                    (pylzma.compress(data, format='alone'), {'format': 'alone'})):
+            decompress = pylzma.decompressobj(**options)
+            self.assertEqual(decompress.decompress(compressed, max_length=-1), data)
+            self.assertTrue(decompress.eof)
+            self.assertEqual(decompress.unused_data, bytes('', 'ascii'))
+
+            decompress = pylzma.decompressobj(**options)
+            result = []
+            for i in range(0, len(compressed), 999):
+                result.append(decompress.decompress(compressed[i:i+999] + (garbage if i + 999 >= len(compressed) else bytes('', 'ascii')), max_length=-1))
+            self.assertEqual(bytes('', 'ascii').join(result), data)
+            self.assertTrue(decompress.eof)
+            self.assertEqual(decompress.unused_data, garbage)
+
+    def test_decompression_streaming_into(self):
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 18)
+        for lzma2 in (0, 1):
+            compressed = pylzma.compress(data, lzma2=lzma2)
+            for size, bufsize in ((3, 10), (4096, 1000), (1 << 16, 1 << 17)):
+                decompress = pylzma.decompressobj(lzma2=lzma2)
+                # input kept by "decompress" is used first
+                result = [decompress.decompress(compressed[:100], 10)]
+                output = bytearray(bufsize)
+                pos = 100
+                while True:
+                    written, consumed = decompress.decompress_into(compressed[pos:pos+size], output)
+                    self.assertTrue(0 <= consumed <= size)
+                    result.append(bytes(output[:written]))
+                    pos += consumed
+                    if pos >= len(compressed) and not written:
+                        break
+                self.assertEqual(bytes('', 'ascii').join(result), data)
+
+        decompress = pylzma.decompressobj()
+        compressed = pylzma.compress(data)
+        output = bytearray(16)
+        self.assertEqual(decompress.decompress_into(compressed[:3], output), (0, 3))
+        written, consumed = decompress.decompress_into(compressed[3:], memoryview(output)[4:8])
+        self.assertEqual(written, 4)
+        self.assertTrue(0 < consumed < len(compressed) - 3)
+        self.assertEqual(output[4:8], data[:4])
+        self.assertRaises(TypeError, decompress.decompress_into, compressed, bytes(10))
+
+    def test_compression_streaming(self):
         # test compressing with one byte at a time...
-        # XXX: disabled as LZMA doesn't support streaming compression yet
         compress = pylzma.compressobj(eos=1)
         infile = BytesIO(self.plain)
         outfile = BytesIO()
         while 1:
             data = infile.read(1)
             if not data: break
-            outfile.write(compress.compress(data, 1))
+            outfile.write(compress.compress(data))
         outfile.write(compress.flush())
         check = pylzma.decompress(outfile.getvalue())
         self.assertEqual(check, self.plain)
 
+    def test_compression_streaming_busy(self):
+        import threading
+        # the encoder and its buffers can't be changed while another thread compresses
+        compress = pylzma.compressobj()
+        data = generate_random(1 << 20)
+        result = []
+        thread = threading.Thread(target=lambda: result.append(compress.compress(data)))
+        thread.start()
+        busy = False
+        while thread.is_alive() and not busy:
+            try:
+                compress.__init__()
+            except TypeError:
+                # already initialized while the other thread is not compressing
+                pass
+            except RuntimeError:
+                busy = True
+                self.assertRaises(RuntimeError, compress.compress, data)
+                self.assertRaises(RuntimeError, compress.flush)
+        thread.join()
+        self.assertTrue(busy)
+        self.assertEqual(pylzma.decompress(result[0] + compress.flush()), data)
+
     def test_compression_file(self):
         # test compressing from file-like object (C class)
         infile = BytesIO(self.plain)
@@ -245,6 +429,699 @@ class TestPyLZMA(unittest.TestCase):
         # prevent regression of github #10
         self.assertRaises(ValueError, pylzma.compress, bytes("foo", 'ascii'), dictionary=100)
 
+    def test_compression_lzma2(self):
+        data = generate_random(1 << 17)
+        compressed = pylzma.compress(data, lzma2=1)
+        self.assertEqual(pylzma.decompress(compressed, lzma2=1), data)
+        self.assertEqual(pylzma.decompress(compressed, lzma2=1, maxlength=len(data)), data)
+
+    def test_compression_lzma2_threads(self):
+        # multiple blocks are compressed in parallel
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        compressed = pylzma.compress(data, lzma2=1, threads=4, block_size=1 << 18)
+        self.assertEqual(pylzma.decompress(compressed, lzma2=1), data)
+        decompress = pylzma.decompressobj(lzma2=1)
+        result = decompress.decompress(compressed) + decompress.flush()
+        self.assertEqual(result, data)
+
+    def test_compression_lzma2_invalid(self):
+        self.assertRaises(ValueError, pylzma.compress, self.plain, threads=4)
+        self.assertRaises(ValueError, pylzma.compress, self.plain, lzma2=1, threads=-1)
+        self.assertRaises(ValueError, pylzma.compress, self.plain, lzma2=1, block_size=-1)
+
+    def test_compress_into(self):
+        data = generate_random(1 << 16)
+        buffer = bytearray(pylzma.compress_bound(len(data)))
+        length = pylzma.compress_into(buffer, data, eos=1)
+        self.assertEqual(bytes(buffer[:length]), pylzma.compress(data, eos=1))
+        length = pylzma.compress_into(buffer, data, lzma2=1)
+        self.assertEqual(pylzma.decompress(memoryview(buffer)[:length], lzma2=1), data)
+
+    def test_compress_into_too_small(self):
+        data = generate_random(1 << 16)
+        self.assertRaises(ValueError, pylzma.compress_into, bytearray(1024), data)
+        self.assertRaises(ValueError, pylzma.compress_into, bytearray(1024), data, lzma2=1)
+        self.assertRaises(TypeError, pylzma.compress_into, bytes(1024), data)
+
+    def test_compressor(self):
+        # compressor objects can be reused and create the same data as "compress"
+        compressor = pylzma.Compressor(dictionary=20, eos=1)
+        for i in range(4, 18):
+            original = generate_random(1 << i)
+            compressed = compressor.compress(original)
+            self.assertEqual(compressed, pylzma.compress(original, dictionary=20, eos=1))
+            self.assertEqual(pylzma.decompress(compressed), original)
+
+    def test_compressor_lzma2(self):
+        compressor = pylzma.Compressor(lzma2=1)
+        for i in range(4, 18):
+            original = generate_random(1 << i)
+            self.assertEqual(pylzma.decompress(compressor.compress(original), lzma2=1), original)
+
+    def test_compressor_invalid(self):
+        self.assertRaises(ValueError, pylzma.Compressor, dictionary=100)
+
+    def test_compressor_busy(self):
+        import threading
+        # the encoder can't be replaced while another thread compresses
+        compressor = pylzma.Compressor()
+        data = generate_random(1 << 20)
+        result = []
+        thread = threading.Thread(target=lambda: result.append(compressor.compress(data)))
+        thread.start()
+        busy = False
+        while thread.is_alive() and not busy:
+            try:
+                compressor.__init__()
+            except RuntimeError:
+                busy = True
+        thread.join()
+        self.assertTrue(busy)
+        self.assertEqual(pylzma.decompress(result[0]), data)
+
+    def test_matchfinder(self):
+        for matchfinder in ('hc4', 'hc5', 'bt2', 'bt3', 'bt4', 'bt5'):
+            compressed = pylzma.compress(self.plain, matchfinder=matchfinder)
+            self.assertEqual(pylzma.decompress(compressed), self.plain)
+            compressed = pylzma.compress(self.plain, matchfinder=matchfinder, mc=4, numHashOutBits=16)
+            self.assertEqual(pylzma.decompress(compressed), self.plain)
+        self.assertRaises(ValueError, pylzma.compress, self.plain, matchfinder='hc3')
+        self.assertRaises(ValueError, pylzma.compress, self.plain, mc=-1)
+        self.assertRaises(ValueError, pylzma.compress, self.plain, numHashOutBits=33)
+
+    def test_matchfinder_compressfile(self):
+        infile = BytesIO(self.plain)
+        compressed = pylzma.compressfile(infile, matchfinder='hc4', eos=1).read()
+        self.assertEqual(pylzma.decompress(compressed), self.plain)
+        self.assertRaises(ValueError, pylzma.compressfile, BytesIO(self.plain), matchfinder='xx')
+
+    def test_level(self):
+        data = self.plain * 100
+        for level in range(10):
+            compressed = pylzma.compress(data, level=level)
+            self.assertEqual(pylzma.decompress(compressed), data)
+        # explicit parameters override the level
+        self.assertEqual(pylzma.compress(data, level=9, dictionary=16, fastBytes=32, algorithm=1),
+            pylzma.compress(data, level=5, dictionary=16, fastBytes=32, algorithm=1))
+        self.assertRaises(ValueError, pylzma.compress, data, level=10)
+
+    def test_preset(self):
+        data = self.plain * 100
+        for preset in range(10):
+            for extreme in (0, 1):
+                compressed = pylzma.compress(data, preset=preset, extreme=extreme)
+                self.assertEqual(pylzma.decompress(compressed), data)
+        # explicit parameters override the preset
+        self.assertEqual(pylzma.compress(data, preset=9, dictionary=16),
+            pylzma.compress(data, preset=8, dictionary=16))
+        self.assertEqual(pylzma.compress(data, extreme=1), pylzma.compress(data, preset=6, extreme=1))
+        self.assertRaises(ValueError, pylzma.compress, data, preset=10)
+        self.assertRaises(ValueError, pylzma.compress, data, preset=1, level=1)
+
+    def test_preset_compressfile(self):
+        compressed = pylzma.compressfile(BytesIO(self.plain), preset=0, eos=1).read()
+        self.assertEqual(pylzma.decompress(compressed), self.plain)
+        # the compressed data only differs in the dictionary size of the header
+        self.assertEqual(compressed[5:], pylzma.compress(self.plain, preset=0)[5:])
+
+    def test_small_input(self):
+        # the dictionary is reduced to the size of the input (rounded to 2^n or 3*2^n)
+        compressed = pylzma.compress(generate_random(10000))
+        self.assertEqual(compressed[1:5], unhexlify('00300000'))
+        compressor = pylzma.Compressor()
+        for size in (0, 1, 100, 4096, 4097, 65536, 65537, 100, 200000, 10):
+            data = generate_random(size)
+            for lzma2 in (0, 1):
+                compressed = pylzma.compress(data, lzma2=lzma2)
+                self.assertEqual(pylzma.decompress(compressed, lzma2=lzma2), data)
+            compressed = compressor.compress(data)
+            self.assertEqual(compressed, pylzma.compress(data))
+            self.assertEqual(pylzma.decompress(compressed), data)
+
+    def test_compress_many(self):
+        items = [generate_random(size) for size in (0, 1, 100, 1000, 10000, 100000)] * 3
+        for threads in (0, 1, 4):
+            compressed = pylzma.compress_many(items, threads=threads)
+            self.assertEqual(compressed, [pylzma.compress(x) for x in items])
+            self.assertEqual(pylzma.decompress_many(compressed, threads=threads), items)
+        compressed = pylzma.compress_many(iter(items), lzma2=1, eos=0)
+        self.assertEqual(compressed, [pylzma.compress(x, lzma2=1) for x in items])
+        self.assertEqual(pylzma.decompress_many(compressed, lzma2=1), items)
+        self.assertEqual(pylzma.compress_many([]), [])
+        self.assertEqual(pylzma.decompress_many([]), [])
+
+    def test_compress_many_invalid(self):
+        self.assertRaises(TypeError, pylzma.compress_many, [self.plain, 1])
+        self.assertRaises(TypeError, pylzma.compress_many, 1)
+        self.assertRaises(ValueError, pylzma.compress_many, [self.plain], threads=-1)
+        self.assertRaises(ValueError, pylzma.decompress_many, [self.plain_with_eos, self.plain_with_eos[:10]])
+        self.assertRaises(TypeError, pylzma.decompress_many, [self.plain_with_eos, b'\xff' * 20])
+
+    def test_progress(self):
+        data = generate_random(1 << 20)
+        for lzma2 in (0, 1):
+            calls = []
+            def progress(bytes_in, bytes_out):
+                calls.append((bytes_in, bytes_out))
+                return True
+            compressed = pylzma.compress(data, lzma2=lzma2, progress=progress, progress_interval=128 * 1024)
+            self.assertEqual(pylzma.decompress(compressed, lzma2=lzma2), data)
+            self.assertTrue(len(calls) > 1)
+            self.assertEqual(calls, sorted(calls))
+            self.assertTrue(calls[-1][0] <= len(data))
+        self.assertRaises(TypeError, pylzma.compress, data, progress=1)
+        self.assertRaises(ValueError, pylzma.compress, data, progress=progress, progress_interval=-1)
+        self.assertEqual(pylzma.compress(self.plain, progress=None), pylzma.compress(self.plain))
+
+    def test_progress_abort(self):
+        data = generate_random(1 << 20)
+        def abort(bytes_in, bytes_out):
+            return False
+        def fail(bytes_in, bytes_out):
+            raise KeyError(bytes_in)
+        for lzma2 in (0, 1):
+            self.assertRaises(RuntimeError, pylzma.compress, data, lzma2=lzma2, progress=abort, progress_interval=0)
+            self.assertRaises(KeyError, pylzma.compress, data, lzma2=lzma2, progress=fail, progress_interval=0)
+
+    def test_progress_compressfile(self):
+        data = generate_random(1 << 20)
+        calls = []
+        def progress(bytes_in, bytes_out):
+            calls.append((bytes_in, bytes_out))
+            return True
+        compressed = pylzma.compressfile(BytesIO(data), progress=progress, progress_interval=128 * 1024).read()
+        self.assertEqual(pylzma.decompress(compressed), data)
+        self.assertTrue(len(calls) > 1)
+        def fail(bytes_in, bytes_out):
+            raise KeyError(bytes_in)
+        compressor = pylzma.compressfile(BytesIO(data), progress=fail, progress_interval=0)
+        self.assertRaises(KeyError, compressor.read)
+        self.assertRaises(RuntimeError, compressor.read)
+
+    def test_compressfile_os_file(self):
+        # regular files are read from the current position of the file object
+        import tempfile
+        data = generate_random(1 << 20)
+        fp = tempfile.TemporaryFile()
+        try:
+            fp.write(data)
+            fp.seek(0)
+            fp.read(1000)
+            compressed = pylzma.compressfile(fp, eos=1).read()
+            self.assertEqual(pylzma.decompress(compressed), data[1000:])
+            self.assertEqual(fp.tell(), len(data))
+        finally:
+            fp.close()
+
+    def test_compressfile_read_only(self):
+        # file objects without "readinto" are supported
+        class Reader(object):
+            def __init__(self, data):
+                self.fp = BytesIO(data)
+            def read(self, length):
+                return self.fp.read(min(length, 1000))
+        data = generate_random(1 << 17)
+        compressed = pylzma.compressfile(Reader(data), eos=1).read()
+        self.assertEqual(pylzma.decompress(compressed), data)
+
+    def test_compressfile_outfile(self):
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 20)
+        expected = pylzma.compressfile(BytesIO(data), eos=1).read()
+        outfile = BytesIO()
+        compress = pylzma.compressfile(BytesIO(data), eos=1, outfile=outfile)
+        self.assertEqual(compress.read(), len(expected))
+        self.assertEqual(compress.read(), 0)
+        self.assertEqual(outfile.getvalue(), expected)
+
+        class PartialWriter(object):
+            # writes at most 1000 bytes per call
+            def __init__(self):
+                self.fp = BytesIO()
+            def write(self, data):
+                return self.fp.write(data[:1000])
+        outfile = PartialWriter()
+        compress = pylzma.compressfile(BytesIO(data), eos=1, outfile=outfile)
+        written = 0
+        while True:
+            length = compress.read(1 << 16)
+            if not length: break
+            self.assertTrue(length >= 1 << 16 or written + length == len(expected))
+            written += length
+        self.assertEqual(outfile.fp.getvalue(), expected)
+        self.assertRaises(TypeError, pylzma.compressfile, BytesIO(data), outfile=object())
+
+    def test_compressfile_small_reads(self):
+        data = generate_random(1 << 18)
+        compress = pylzma.compressfile(BytesIO(data), eos=1)
+        result = []
+        while True:
+            tmp = compress.read(100)
+            if not tmp: break
+            result.append(tmp)
+        self.assertEqual(pylzma.decompress(bytes('', 'ascii').join(result)), data)
+
+    def test_compress_file(self):
+        import os, shutil, tempfile
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 20)
+        path = tempfile.mkdtemp()
+        try:
+            src = os.path.join(path, 'src')
+            compressed = os.path.join(path, 'compressed')
+            dst = os.path.join(path, 'dst')
+            fp = open(src, 'wb')
+            fp.write(data)
+            fp.close()
+            for options in ({}, {'lzma2': 1}, {'lzma2': 1, 'threads': 2, 'block_size': 1 << 19}):
+                stats = pylzma.compress_file(src, compressed, **options)
+                fp = open(compressed, 'rb')
+                result = fp.read()
+                fp.close()
+                self.assertEqual(stats['bytes_read'], len(data))
+                self.assertEqual(stats['bytes_written'], len(result))
+                self.assertEqual(pylzma.decompress(result, lzma2=options.get('lzma2', 0)), data)
+                stats = pylzma.decompress_file(compressed, dst, lzma2=options.get('lzma2', 0))
+                self.assertEqual(stats['bytes_read'], len(result))
+                self.assertEqual(stats['bytes_written'], len(data))
+                for key in ('time', 'reader_stall', 'codec_input_stall', 'codec_output_stall', 'writer_stall'):
+                    self.assertTrue(stats[key] >= 0)
+                fp = open(dst, 'rb')
+                self.assertEqual(fp.read(), data)
+                fp.close()
+
+            # streams without end marker need the length
+            pylzma.compress_file(src, compressed, eos=0)
+            self.assertRaises(ValueError, pylzma.decompress_file, compressed, dst)
+            pylzma.decompress_file(compressed, dst, maxlength=len(data))
+            self.assertEqual(os.path.getsize(dst), len(data))
+
+            self.assertRaises(OSError, pylzma.compress_file, os.path.join(path, 'missing'), dst)
+            self.assertRaises(OSError, pylzma.compress_file, src, os.path.join(path, 'missing', 'dst'))
+            self.assertRaises(TypeError, pylzma.decompress_file, src, dst)
+
+            # the input must not be truncated by opening the output
+            self.assertRaises(ValueError, pylzma.compress_file, src, src)
+            self.assertRaises(ValueError, pylzma.decompress_file, compressed, compressed, maxlength=len(data))
+            self.assertEqual(os.path.getsize(src), len(data))
+            self.assertEqual(pylzma.decompress_file(compressed, dst, maxlength=len(data))['bytes_written'], len(data))
+        finally:
+            shutil.rmtree(path)
+
+    def test_compress_file_fifo(self):
+        import os, shutil, tempfile, threading
+        if not hasattr(os, 'mkfifo'):
+            return
+        # repeated outside of a dictionary reduced to a few KB
+        data = generate_random(1 << 16) * 8
+        path = tempfile.mkdtemp()
+        try:
+            src = os.path.join(path, 'src')
+            fifo = os.path.join(path, 'fifo')
+            dst = os.path.join(path, 'dst')
+            with open(src, 'wb') as fp:
+                fp.write(data)
+            os.mkfifo(fifo)
+            for options in ({}, {'lzma2': 1}, {'format': 'alone'}):
+                pylzma.compress_file(src, dst, **options)
+                expected = os.path.getsize(dst)
+                def writer():
+                    with open(fifo, 'wb') as fp:
+                        fp.write(data)
+                thread = threading.Thread(target=writer)
+                thread.start()
+                try:
+                    stats = pylzma.compress_file(fifo, dst, **options)
+                finally:
+                    thread.join()
+                self.assertEqual(stats['bytes_read'], len(data))
+                # the encoder is not sized for an empty input
+                self.assertTrue(stats['bytes_written'] < expected + 100)
+                with open(dst, 'rb') as fp:
+                    self.assertEqual(pylzma.decompress(fp.read(), **options), data)
+        finally:
+            shutil.rmtree(path)
+
+    def test_estimate_ratio(self):
+        text = self.plain * 10000
+        self.assertTrue(pylzma.estimate_ratio(text) < 0.5)
+        self.assertTrue(pylzma.estimate_ratio(text, sample=1) < 0.5)
+        compressed = pylzma.compress(generate_random(1 << 20))
+        self.assertTrue(pylzma.estimate_ratio(compressed) > 0.95)
+        self.assertEqual(pylzma.estimate_ratio(bytes('', 'ascii')), 1.0)
+        self.assertRaises(ValueError, pylzma.estimate_ratio, text, sample=0)
+
+    def test_store_if_incompressible(self):
+        text = generate_random(1 << 20)
+        incompressible = pylzma.compress(text)
+        for data in (incompressible, text + incompressible + text, text, incompressible[:100], bytes('', 'ascii')):
+            compressed = pylzma.compress(data, lzma2=1, store_if_incompressible=1)
+            self.assertEqual(pylzma.decompress(compressed, lzma2=1), data)
+            decompress = pylzma.decompressobj(lzma2=1)
+            self.assertEqual(decompress.decompress(compressed) + decompress.flush(), data)
+        # uncompressed chunks have 3 bytes of overhead per 64KB
+        compressed = pylzma.compress(incompressible, lzma2=1, store_if_incompressible=1)
+        self.assertTrue(len(compressed) <= len(incompressible) + 3 * (len(incompressible) // 65536 + 1) + 2)
+        self.assertRaises(ValueError, pylzma.compress, text, store_if_incompressible=1)
+
+        # the progress covers compressed and stored regions of the whole input
+        data = text + incompressible + text + incompressible
+        for threads in (0, 2):
+            calls = []
+            def progress(bytes_in, bytes_out):
+                calls.append((bytes_in, bytes_out))
+                return True
+            compressed = pylzma.compress(data, lzma2=1, threads=threads, store_if_incompressible=1, progress=progress, progress_interval=0)
+            self.assertEqual(pylzma.decompress(compressed, lzma2=1), data)
+            self.assertEqual(calls, sorted(calls))
+            self.assertEqual(calls[-1][0], len(data))
+            self.assertTrue(calls[-1][1] < len(compressed))
+
+    def test_compressobj(self):
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        for lzma2 in (0, 1):
+            compress = pylzma.compressobj(lzma2=lzma2)
+            compressed = bytes('', 'ascii')
+            for i in range(0, len(data), 10000):
+                compressed += compress.compress(data[i:i+10000])
+            compressed += compress.flush(pylzma.FLUSH_FINISH)
+            self.assertEqual(pylzma.decompress(compressed, lzma2=lzma2), data)
+            self.assertRaises(ValueError, compress.compress, data)
+            self.assertRaises(ValueError, compress.flush)
+        self.assertEqual(pylzma.decompress(pylzma.compressobj().flush()), bytes('', 'ascii'))
+        self.assertRaises(ValueError, pylzma.compressobj().flush, pylzma.FLUSH_SYNC)
+        self.assertRaises(ValueError, pylzma.compressobj(lzma2=1).flush, 0)
+
+    def test_compressobj_sync(self):
+        # all data passed before a sync flush can be decompressed
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 17)
+        for matchfinder in ('bt4', 'hc4'):
+            compress = pylzma.compressobj(lzma2=1, matchfinder=matchfinder)
+            decompress = pylzma.decompressobj(lzma2=1)
+            result = bytes('', 'ascii')
+            for i in range(0, len(data), 100000):
+                result += decompress.decompress(compress.compress(data[i:i+100000]), len(data))
+                result += decompress.decompress(compress.flush(pylzma.FLUSH_SYNC), len(data))
+                self.assertEqual(result, data[:i+100000])
+            result += decompress.decompress(compress.flush(), len(data))
+            self.assertEqual(result, data)
+
+    def test_lzmafile(self):
+        import io, os, shutil, tempfile
+        lines = [bytes('line %d ' % (i), 'ascii') * random.randint(1, 20) + bytes('\n', 'ascii') for i in range(20000)]
+        data = bytes('', 'ascii').join(lines) + bytes('no newline', 'ascii')
+        for options in ({}, {'lzma2': 1}, {'eos': 0}):
+            fp = BytesIO()
+            with pylzma.LZMAFile(fp, 'w', **options) as compressed:
+                self.assertTrue(isinstance(compressed, io.BufferedIOBase))
+                for i in range(0, len(data), 50000):
+                    self.assertEqual(compressed.write(data[i:i+50000]), len(data[i:i+50000]))
+                self.assertRaises(io.UnsupportedOperation, compressed.read)
+            self.assertTrue(compressed.closed)
+            self.assertFalse(fp.closed)
+            self.assertEqual(pylzma.decompress(fp.getvalue(), maxlength=len(data), lzma2=options.get('lzma2', 0)), data)
+
+            decompressed = pylzma.LZMAFile(BytesIO(fp.getvalue()), lzma2=options.get('lzma2', 0))
+            self.assertEqual(list(decompressed), lines + [bytes('no newline', 'ascii')])
+            decompressed.seek(0)
+            self.assertEqual(decompressed.readline(), lines[0])
+            self.assertEqual(decompressed.readline(3), lines[1][:3])
+            self.assertEqual(decompressed.peek()[:4], lines[1][3:7])
+            self.assertEqual(decompressed.read(4), lines[1][3:7])
+            buf = bytearray(1000)
+            self.assertEqual(decompressed.readinto(buf), 1000)
+            self.assertEqual(bytes(buf), data[len(lines[0])+7:len(lines[0])+1007])
+            self.assertEqual(decompressed.read(), data[len(lines[0])+1007:])
+            self.assertEqual(decompressed.read(), bytes('', 'ascii'))
+            decompressed.close()
+            self.assertRaises(ValueError, decompressed.read)
+
+        # filenames are opened and closed by the file object
+        path = tempfile.mkdtemp()
+        try:
+            filename = os.path.join(path, 'data.lzma')
+            with pylzma.LZMAFile(filename, 'w', level=1) as compressed:
+                compressed.write(data)
+            self.assertRaises(IOError, pylzma.LZMAFile, filename, 'x')
+            with pylzma.LZMAFile(filename) as decompressed:
+                self.assertEqual(decompressed.readlines(), lines + [bytes('no newline', 'ascii')])
+        finally:
+            shutil.rmtree(path)
+
+        self.assertEqual(pylzma.LZMAFile(BytesIO()).read(), bytes('', 'ascii'))
+        self.assertRaises(EOFError, pylzma.LZMAFile(BytesIO(pylzma.compress(data)[:-10])).read)
+        self.assertRaises(ValueError, pylzma.LZMAFile, BytesIO(), 'a')
+        self.assertRaises(ValueError, pylzma.LZMAFile, BytesIO(), 'r', level=1)
+        self.assertRaises(TypeError, pylzma.LZMAFile, BytesIO(), 'w', invalid=1)
+        self.assertRaises(TypeError, pylzma.LZMAFile, 1)
+
+    def test_lzmafile_seek(self):
+        data = generate_random(1 << 20)
+        fp = BytesIO(bytes('xxxx', 'ascii') + pylzma.compress(data))
+        fp.seek(4)
+        decompressed = pylzma.LZMAFile(fp)
+        self.assertTrue(decompressed.seekable())
+        self.assertEqual(decompressed.seek(500000), 500000)
+        self.assertEqual(decompressed.read(10), data[500000:500010])
+        # seeking backward starts at the position the file had when opened
+        self.assertEqual(decompressed.seek(-500000, 1), 10)
+        self.assertEqual(decompressed.read(10), data[10:20])
+        self.assertEqual(decompressed.seek(-10, 2), len(data) - 10)
+        self.assertEqual(decompressed.tell(), len(data) - 10)
+        self.assertEqual(decompressed.read(), data[-10:])
+        self.assertEqual(decompressed.seek(len(data) + 10), len(data))
+
+        # streams without end marker need the length if they are not complete
+        compressed = pylzma.compress(data, eos=0)
+        decompressed = pylzma.LZMAFile(BytesIO(compressed), maxlength=1000)
+        self.assertEqual(decompressed.read(), data[:1000])
+
+    def test_lzmafile_busy(self):
+        import threading
+        data = generate_random(1 << 16)
+        compressed = pylzma.compress(data)
+        reading = threading.Event()
+        release = threading.Event()
+        class SlowFile(object):
+            def __init__(self):
+                self.fp = BytesIO(compressed)
+            def read(self, size):
+                reading.set()
+                release.wait()
+                return self.fp.read(size)
+        # the buffers can't be changed or freed while another thread is reading
+        decompressed = pylzma.LZMAFile(SlowFile())
+        result = []
+        thread = threading.Thread(target=lambda: result.append(decompressed.read()))
+        thread.start()
+        reading.wait()
+        self.assertRaises(RuntimeError, decompressed.read)
+        self.assertRaises(RuntimeError, decompressed.peek)
+        self.assertRaises(RuntimeError, decompressed.close)
+        release.set()
+        thread.join()
+        self.assertEqual(result, [data])
+        decompressed.close()
+
+    def test_format_alone(self):
+        import struct
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 16)
+        for eos in (0, 1):
+            compressed = pylzma.compress(data, format='alone', eos=eos)
+            self.assertEqual(compressed[:5], pylzma.compress(data, eos=eos)[:5])
+            self.assertEqual(struct.unpack('<Q', compressed[5:13])[0], len(data))
+            # the size from the header is used instead of maxlength
+            self.assertEqual(pylzma.decompress(compressed, format='alone'), data)
+            self.assertEqual(pylzma.decompress(compressed, format='alone', maxlength=100), data[:100])
+            self.assertRaises(ValueError, pylzma.decompress, compressed[:-100], format='alone')
+            decompress = pylzma.decompressobj(format='alone')
+            result = bytes('', 'ascii')
+            for i in range(0, len(compressed), 1000):
+                result += decompress.decompress(compressed[i:i+1000])
+            result += decompress.flush()
+            self.assertEqual(result, data)
+            self.assertTrue(decompress.eof)
+
+        # streams of unknown size are written with the end marker
+        compress = pylzma.compressobj(format='alone')
+        for compressed in (pylzma.compressfile(BytesIO(data), format='alone').read(),
+                           compress.compress(data) + compress.flush()):
+            self.assertEqual(compressed[5:13], unhexlify('ffffffffffffffff'))
+            self.assertEqual(pylzma.decompress(compressed, format='alone'), data)
+        fp = BytesIO()
+        with pylzma.LZMAFile(fp, 'w', format='alone') as compressed:
+            compressed.write(data)
+        self.assertEqual(pylzma.decompress(fp.getvalue(), format='alone'), data)
+        self.assertEqual(pylzma.LZMAFile(BytesIO(fp.getvalue()), format='alone').read(), data)
+        self.assertEqual(pylzma.decompress(pylzma.compress(bytes('', 'ascii'), format='alone'), format='alone'), bytes('', 'ascii'))
+
+        try:
+            import lzma
+        except ImportError:
+            pass
+        else:
+            # compatible to .lzma files of xz
+            self.assertEqual(lzma.decompress(pylzma.compress(data, format='alone'), format=lzma.FORMAT_ALONE), data)
+            self.assertEqual(pylzma.decompress(lzma.compress(data, format=lzma.FORMAT_ALONE), format='alone'), data)
+
+        self.assertRaises(ValueError, pylzma.compress, data, format='alone', lzma2=1)
+        self.assertRaises(ValueError, pylzma.compress, data, format='invalid')
+        self.assertRaises(ValueError, pylzma.compressobj, format='alone', eos=0)
+        self.assertRaises(ValueError, pylzma.decompressobj, format='alone', lzma2=1)
+
+    def test_format_xz(self):
+        import os, shutil, tempfile
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 20)
+        results = [pylzma.compress(data, format='xz', check=check) for check in ('crc64', 'crc32', 'sha256', 'none')]
+        results.append(pylzma.compress(data, format='xz', threads=4, block_size=1 << 18))
+        compress = pylzma.compressobj(format='xz', check='sha256')
+        results.append(compress.compress(data[:1000]) + compress.flush(pylzma.FLUSH_SYNC) + compress.compress(data[1000:]) + compress.flush())
+        fp = BytesIO()
+        with pylzma.LZMAFile(fp, 'w', format='xz') as compressed:
+            compressed.write(data)
+        results.append(fp.getvalue())
+        path = tempfile.mkdtemp()
+        try:
+            src = os.path.join(path, 'src')
+            with open(src, 'wb') as fp:
+                fp.write(data)
+            filename = os.path.join(path, 'compressed.xz')
+            pylzma.compress_file(src, filename, format='xz', threads=2, block_size=1 << 18)
+            with open(filename, 'rb') as fp:
+                results.append(fp.read())
+        finally:
+            shutil.rmtree(path)
+        for compressed in results:
+            self.assertEqual(compressed[:6], unhexlify('fd377a585a00'))
+            self.assertEqual(compressed[-2:], bytes('YZ', 'ascii'))
+
+        try:
+            import lzma
+        except ImportError:
+            pass
+        else:
+            # compatible to .xz files of xz
+            for compressed in results:
+                self.assertEqual(lzma.decompress(compressed, format=lzma.FORMAT_XZ), data)
+            self.assertEqual(lzma.decompress(pylzma.compress(bytes('', 'ascii'), format='xz')), bytes('', 'ascii'))
+            self.assertEqual(lzma.decompress(pylzma.compressobj(format='xz').flush()), bytes('', 'ascii'))
+
+        self.assertRaises(ValueError, pylzma.compress, data, check='crc64')
+        self.assertRaises(ValueError, pylzma.compress, data, format='xz', check='invalid')
+        self.assertRaises(ValueError, pylzma.compress, data, format='xz', block_size=1024)
+        self.assertRaises(ValueError, pylzma.compress, data, format='xz', store_if_incompressible=1)
+        self.assertRaises(ValueError, pylzma.compressfile, BytesIO(data), format='xz')
+
+    def test_decompress_xz(self):
+        import os, shutil, tempfile
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 20)
+        single = pylzma.compress(data, format='xz', check='sha256')
+        blocks = pylzma.compress(data, format='xz', threads=4, block_size=1 << 18)
+        for compressed in (single, blocks):
+            for threads in (1, 2, 0):
+                self.assertEqual(pylzma.decompress(compressed, format='xz', threads=threads), data)
+            self.assertEqual(pylzma.decompress(compressed, format='xz', threads=2, memlimit=1 << 16), data)
+            self.assertEqual(pylzma.decompress(compressed, format='xz', maxlength=1000), data[:1000])
+            # concatenated streams with padding and trailing garbage
+            self.assertEqual(pylzma.decompress(compressed + bytes(4) + compressed, format='xz'), data + data)
+            self.assertEqual(pylzma.decompress(compressed + bytes('garbage', 'ascii'), format='xz'), data)
+
+            # the streaming decoder stops at the end of the first stream
+            decompress = pylzma.decompressobj(format='xz')
+            result = bytes()
+            for i in range(0, len(compressed), 999):
+                result += decompress.decompress(compressed[i:i+999], max_length=-1)
+            self.assertEqual(result, data)
+            self.assertTrue(decompress.eof)
+            decompress.reset()
+            self.assertEqual(decompress.skip(1000, compressed + bytes(4) + compressed), 1000)
+            self.assertEqual(decompress.decompress(bytes(), max_length=-1), data[1000:])
+            self.assertEqual(decompress.unused_data, bytes(4) + compressed)
+
+        path = tempfile.mkdtemp()
+        try:
+            src = os.path.join(path, 'src.xz')
+            dst = os.path.join(path, 'dst')
+            with open(src, 'wb') as fp:
+                fp.write(blocks + single)
+            stats = pylzma.decompress_file(src, dst, format='xz', threads=2)
+            self.assertEqual(stats['streams'], 2)
+            self.assertEqual(stats['blocks'], 7)
+            with open(dst, 'rb') as fp:
+                self.assertEqual(fp.read(), data + data)
+            stats = pylzma.decompress_file(src, dst, format='xz', maxlength=1000)
+            self.assertFalse(stats['multithreaded'])
+            self.assertEqual(os.path.getsize(dst), 1000)
+        finally:
+            shutil.rmtree(path)
+
+        try:
+            import lzma
+        except ImportError:
+            pass
+        else:
+            # .xz files created by xz
+            self.assertEqual(pylzma.decompress(lzma.compress(data), format='xz'), data)
+            self.assertEqual(pylzma.decompress(lzma.compress(bytes()), format='xz'), bytes())
+
+        corrupted = bytearray(single)
+        corrupted[-20] ^= 1
+        self.assertRaises(ValueError, pylzma.decompress, bytes(corrupted), format='xz')
+        self.assertRaises(ValueError, pylzma.decompress, single[:-10], format='xz')
+        self.assertRaises(ValueError, pylzma.decompress, bytes('garbage', 'ascii'), format='xz')
+        self.assertRaises(ValueError, pylzma.decompress, single, format='xz', threads=-1)
+        self.assertRaises(ValueError, pylzma.decompress, self.plain_with_eos, threads=2)
+        self.assertRaises(ValueError, pylzma.LZMAFile, BytesIO(single), format='xz')
+
+    def test_decompress_lzma2_threads(self):
+        import os, shutil, tempfile
+        data = bytes("asdf", 'ascii')*123456 + generate_random(1 << 20)
+        single = pylzma.compress(data, lzma2=1)
+        blocks = pylzma.compress(data, lzma2=1, threads=4, block_size=1 << 18)
+        for compressed in (single, blocks):
+            for threads in (2, 0):
+                self.assertEqual(pylzma.decompress(compressed, lzma2=1, threads=threads), data)
+            self.assertEqual(pylzma.decompress(compressed, lzma2=1, threads=2, memlimit=1 << 16), data)
+            self.assertEqual(pylzma.decompress(compressed, lzma2=1, threads=2, maxlength=1000), data[:1000])
+            self.assertEqual(pylzma.decompress(compressed + bytes('garbage', 'ascii'), lzma2=1, threads=2), data)
+            # streams truncated inside of the last block
+            self.assertRaises(ValueError, pylzma.decompress, compressed[:-10], lzma2=1, threads=2)
+
+        path = tempfile.mkdtemp()
+        try:
+            src = os.path.join(path, 'src.lzma2')
+            dst = os.path.join(path, 'dst')
+            with open(src, 'wb') as fp:
+                fp.write(blocks)
+            stats = pylzma.decompress_file(src, dst, lzma2=1, threads=2)
+            self.assertTrue(stats['multithreaded'])
+            with open(dst, 'rb') as fp:
+                self.assertEqual(fp.read(), data)
+            pylzma.decompress_file(src, dst, lzma2=1, threads=2, maxlength=1000)
+            self.assertEqual(os.path.getsize(dst), 1000)
+            stats = pylzma.decompress_file(src, dst, lzma2=1)
+            self.assertNotIn('multithreaded', stats)
+            self.assertRaises(ValueError, pylzma.decompress_file, src, dst, threads=2)
+        finally:
+            shutil.rmtree(path)
+
+        self.assertRaises(ValueError, pylzma.decompress, blocks, lzma2=1, threads=-1)
+
+    def test_buffer_input(self):
+        # all codecs accept objects supporting the buffer protocol
+        compressed = pylzma.compress(self.plain, eos=1)
+        for wrap in (bytearray, memoryview):
+            self.assertEqual(pylzma.compress(wrap(self.plain), eos=1), compressed)
+            self.assertEqual(pylzma.decompress(wrap(compressed)), self.plain)
+            decompress = pylzma.decompressobj()
+            data = decompress.decompress(wrap(compressed))
+            data += decompress.flush()
+            self.assertEqual(data, self.plain)
+            self.assertEqual(pylzma.delta_decode(pylzma.delta_encode(wrap(self.plain), 2), 2), self.plain)
+            self.assertEqual(pylzma.bcj_x86_convert(pylzma.bcj_x86_convert(wrap(self.plain), 1)), self.plain)
+            self.assertEqual(pylzma.bcj_arm_convert(pylzma.bcj_arm_convert(wrap(self.plain), 1)), self.plain)
+        # slices of memoryviews don't need to be copied
+        view = memoryview(bytes('xxxx', 'ascii') + compressed)[4:]
+        self.assertEqual(pylzma.decompress(view), self.plain)
+
     def test_delta(self):
         for i in range(8, 18):
             size = 1 << i